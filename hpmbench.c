@@ -0,0 +1,209 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * host side microbenchmarks for command-stream encoders and data kernels
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <libaltusb.h>
+#include <libhpmusb.h>
+#include <libM25Pxx_flash.h>
+#include <libblank.h>
+#include <libdigest.h>
+
+#include "osi.h"
+
+#ifndef GITVERSION
+#define GITVERSION "not a git build"
+#endif
+
+#define BENCH_MINTIME		200000	/* us per measurement */
+#define BENCH_MAXSIZE		(16 << 20)
+
+struct bench_t {
+	const char	*name;
+	void		(*fct)(uint8_t *src, uint8_t *dst, size_t size);
+	bool		erased;		/* run on 0xFF instead random data */
+	int		(*select)(int level);
+	int		kernel;		/* level for select() */
+};
+
+static unsigned int sink;
+
+static void bench_hpmusb_encode(uint8_t *src, uint8_t *dst, size_t size)
+{
+	struct hpmusb_priv_t priv = {
+		.portstate = 0xF8,
+		.dir = 0xFB,
+		.csmsk = 0x10,
+		.trxcmd = 0x31,
+	};
+	unsigned int n;
+
+	while (size) {
+		n = size > HPMUSB_CHUNK ? HPMUSB_CHUNK : size;
+		sink += hpmusb_encode(&priv, dst, priv.trxcmd, src, n,
+				      NULL, 0, size == n);
+		src += n;
+		size -= n;
+	}
+}
+
+static void bench_altusb_encode(uint8_t *src, uint8_t *dst, size_t size)
+{
+	unsigned int n, xlen;
+
+	while (size) {
+		xlen = ALTUSB_XBUFSIZE - 1;
+		n = altusb_encode(dst, &xlen, src, size, true);
+		sink += xlen;
+		src += n;
+		size -= n;
+	}
+}
+
+static void bench_altusb_decode(uint8_t *src, uint8_t *dst, size_t size)
+{
+	unsigned int n;
+
+	while (size) {
+		n = size > ALTUSB_XBUFSIZE ? ALTUSB_XBUFSIZE : size;
+		altusb_decode(dst, src, n);
+		src += n;
+		size -= n;
+	}
+}
+
+static void bench_blankcheck(uint8_t *src, uint8_t *dst, size_t size)
+{
+	unsigned int n;
+
+	while (size) {
+		n = size > 0x100 ? 0x100 : size;
+		sink += blank_check(src, n);
+		src += n;
+		size -= n;
+	}
+}
+
+#define ALT	altusb_kernel_select
+#define BLANK	blank_kernel_select
+#define DIGEST	digest_kernel_select
+
+static void bench_crc32c(uint8_t *src, uint8_t *dst, size_t size)
+{
+	sink += crc32c(0, src, size);
+}
+
+static void bench_sha256(uint8_t *src, uint8_t *dst, size_t size)
+{
+	struct sha256_t ctx;
+
+	sha256_init(&ctx);
+	sha256_update(&ctx, src, size);
+	sha256_final(&ctx, dst);
+	sink += dst[0];
+}
+
+static const struct bench_t benches[] = {
+	{ "hpmusb encode", bench_hpmusb_encode, false, ALT,
+	  ALTUSB_KERNEL_AUTO },
+	{ "altusb encode scalar", bench_altusb_encode, false, ALT,
+	  ALTUSB_KERNEL_SCALAR },
+	{ "altusb encode ssse3", bench_altusb_encode, false, ALT,
+	  ALTUSB_KERNEL_SSSE3 },
+	{ "altusb encode avx2", bench_altusb_encode, false, ALT,
+	  ALTUSB_KERNEL_AVX2 },
+	{ "altusb decode scalar", bench_altusb_decode, false, ALT,
+	  ALTUSB_KERNEL_SCALAR },
+	{ "altusb decode ssse3", bench_altusb_decode, false, ALT,
+	  ALTUSB_KERNEL_SSSE3 },
+	{ "altusb decode avx2", bench_altusb_decode, false, ALT,
+	  ALTUSB_KERNEL_AVX2 },
+	{ "page blank (data)", bench_blankcheck, false, BLANK,
+	  BLANK_KERNEL_AUTO },
+	{ "page blank scalar", bench_blankcheck, true, BLANK,
+	  BLANK_KERNEL_SCALAR },
+	{ "page blank sse2", bench_blankcheck, true, BLANK,
+	  BLANK_KERNEL_SSE2 },
+	{ "page blank avx2", bench_blankcheck, true, BLANK,
+	  BLANK_KERNEL_AVX2 },
+	{ "page blank neon", bench_blankcheck, true, BLANK,
+	  BLANK_KERNEL_NEON },
+	{ "crc32c scalar", bench_crc32c, false, DIGEST,
+	  DIGEST_KERNEL_SCALAR },
+	{ "crc32c sse4.2", bench_crc32c, false, DIGEST,
+	  DIGEST_KERNEL_SSE42 },
+	{ "crc32c armv8", bench_crc32c, false, DIGEST,
+	  DIGEST_KERNEL_ARMV8 },
+	{ "sha256 scalar", bench_sha256, false, DIGEST,
+	  DIGEST_KERNEL_SCALAR },
+	{ "sha256 sha-ni", bench_sha256, false, DIGEST,
+	  DIGEST_KERNEL_SHANI },
+	{ NULL },
+};
+
+static const size_t sizes[] = {
+	4, 0x100, 0x1000, 0x10000, 0x100000, BENCH_MAXSIZE, 0
+};
+
+int main(int argc, char **argv)
+{
+	const struct bench_t *b;
+	uint8_t *data, *erased, *dst;
+	uint64_t ts_start, t;
+	unsigned long iter, n;
+	unsigned int i;
+	double nspb;
+
+	data = malloc(BENCH_MAXSIZE);
+	erased = malloc(BENCH_MAXSIZE);
+	dst = malloc(BENCH_MAXSIZE + 0x20000);
+	if (data == NULL || erased == NULL || dst == NULL) {
+		fprintf(stderr, "no mem for benchmark buffers!\n");
+		return -1;
+	}
+
+	srand(0x5A5A);
+	for (i = 0; i < BENCH_MAXSIZE; i++)
+		data[i] = rand();
+	memset(erased, 0xFF, BENCH_MAXSIZE);
+
+	printf("hpmbench version '%s'\n", GITVERSION);
+	printf("%-22s %10s %10s %10s\n", "kernel", "size", "ns/byte", "MB/s");
+
+	for (b = benches; b->name != NULL; b++) {
+		if (b->select(b->kernel) != 0) {
+			printf("%-22s %10s\n", b->name, "n/a");
+			continue;
+		}
+		for (i = 0; sizes[i] != 0; i++) {
+			iter = 1;
+			do {
+				ts_start = GetTimeStamp();
+				for (n = 0; n < iter; n++)
+					b->fct(b->erased ? erased : data,
+					       dst, sizes[i]);
+				t = GetTimeStamp() - ts_start;
+				if (t >= BENCH_MINTIME)
+					break;
+				iter *= 2;
+			} while (1);
+
+			nspb = (t * 1000.0) / ((double)iter * sizes[i]);
+			printf("%-22s %10zu %10.3f %10.1f\n",
+			       b->name, sizes[i], nspb, 1000.0 / nspb);
+		}
+	}
+
+	free(data);
+	free(erased);
+	free(dst);
+
+	return sink == 0xDEADBEEF;
+}
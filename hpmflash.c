@@ -5,17 +5,36 @@
  * Copyright (C) 2018 Hannes Schmelzer <oe5hpm@oevsv.at>
  *
  */
+#ifdef __linux__
+#define _GNU_SOURCE	/* struct ucred */
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <getopt.h>
+#ifdef __linux__
+#include <stdarg.h>
+#include <signal.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
 #include <libaltusb.h>
 #include <libhpmusb.h>
 #include <libftdi.h>
 #include <spihw.h>
 #include <libM25Pxx_flash.h>
+#include <libtrace.h>
+#include <libimage.h>
+#include <libblank.h>
+#include <libplan.h>
+#include <libconf.h>
+#include <libdigest.h>
+#include <libjournal.h>
 
 #include "osi.h"
 
@@ -25,6 +44,8 @@
 
 #define STDERR(...) fprintf(stderr, __VA_ARGS__)
 
+#define GANG_MAX	16
+
 #ifdef __linux__
 #define ANSI_COLOR_RED     "\x1b[31m"
 #define ANSI_COLOR_GREEN   "\x1b[32m"
@@ -43,29 +64,1663 @@
 #define ANSI_COLOR_RESET   ""
 #endif
 
-void flash_progress(void *arg, unsigned int percent, unsigned int flag)
-{
-	char *str = (char *)arg;
+void flash_progress(void *arg, unsigned int percent, unsigned int flag)
+{
+	char *str = (char *)arg;
+
+	if (percent == 0)
+		printf("[");
+	else if (percent == 100)
+		printf("*"ANSI_COLOR_RESET"] %s\n", str != NULL ? str : "");
+	else if (flag == 0)
+		printf(ANSI_COLOR_GREEN"*");
+	else if (flag == 2)
+		printf(ANSI_COLOR_MAGENTA"*");
+	else if (flag == 1)
+		printf(ANSI_COLOR_YELLOW"*");
+	else
+		printf(ANSI_COLOR_RED"*");
+	fflush(stdout);
+}
+
+struct m25pxx_progress_t progprogress = {
+	.fct = flash_progress,
+	.arg = 0,
+};
+
+static void print_time(const char *what, uint64_t ts_start)
+{
+	float tdisp = (GetTimeStamp() - ts_start) / 1000.0f;
+
+	printf("%s: %.2f %s\n", what,
+	       tdisp > 1000.0 ? tdisp / 1000.0 : tdisp,
+	       tdisp > 1000.0 ? "s" : "ms");
+}
+
+/* -V: retries of a page whose inline read back differs */
+#define VERIFY_RETRIES	2
+
+static void print_verify(const struct m25pxxflash_t *flash)
+{
+	if (flash->verify == 0)
+		return;
+	printf("inline verify: %lu spans read back, %lu programmed again\n",
+	       flash->verified, flash->reprogrammed);
+}
+
+/* transport faults the backend recovered from (or not) */
+static void print_linkstat(const char *who, const struct spistat_t *stat)
+{
+	if (stat->errors == 0)
+		return;
+	printf("%s: %lu USB errors, %lu resyncs, %lu retried, %lu failed\n",
+	       who, stat->errors, stat->resyncs, stat->retries, stat->fatal);
+}
+
+/* -x: time spent in each phase of the startup */
+static void print_phase(bool debug, const char *what, uint64_t *ts)
+{
+	uint64_t now = GetTimeStamp();
+
+	if (debug == true)
+		printf("startup %-14s: %8.2f ms\n", what, (now - *ts) / 1000.0);
+	*ts = now;
+}
+
+/* nCE / TMS combinations in the order they are tried */
+static const struct pinstate_t {
+	bool		nce;
+	bool		tms;
+	const char	*name;
+} pinstates[] = {
+	{ false, true, "nCE low / TMS high" },
+	{ false, false, "nCE low / TMS low" },
+	{ true, false, "nCE high / TMS low" },
+	{ true, true, "nCE high / TMS high" },
+};
+
+#define PINSTATES	(sizeof(pinstates) / sizeof(pinstates[0]))
+
+/*
+ * Detect the flashes on all chipselects of 'csl' at once: per pin state
+ * the ID probes of all chipselects go out in one batch and are decoded
+ * together. The pin state that worked last time on this adapter ('serial',
+ * may be NULL) is tried first and remembered in the config store.
+ */
+static int flash_detect(struct spihw_t *spihw, struct m25pxxflash_t **flash,
+			unsigned int *csl, unsigned int ncs,
+			const char *serial, bool verbose)
+{
+	struct spixfer_t xfer[M25PXX_MULTI_MAX * M25PXX_PROBE_XFERS];
+	struct m25pxx_probe_t probe[M25PXX_MULTI_MAX];
+	struct flashparam_t *chip[M25PXX_MULTI_MAX];
+	const struct pinstate_t *ps;
+	unsigned int order[PINSTATES], hint = 0, found = 0, s, i;
+	char key[48], val[16];
+	bool all;
+
+	if (serial != NULL) {
+		snprintf(key, sizeof(key), "detect.%s", serial);
+		if (conf_get(key, val, sizeof(val)) == 0 &&
+		    (unsigned int)atoi(val) < PINSTATES)
+			hint = atoi(val);
+	}
+	order[0] = hint;
+	for (i = 0, s = 1; i < PINSTATES; i++) {
+		if (i != hint)
+			order[s++] = i;
+	}
+
+	for (s = 0; s < PINSTATES; s++) {
+		ps = &pinstates[order[s]];
+		if (verbose)
+			printf("%s with setting %s.\n",
+			       s == 0 ? "try" : "retry", ps->name);
+		TRACE_BEGIN_ARG("detect scan", order[s]);
+		spihw->ops->set_clr_nce(spihw, ps->nce);
+		spihw->ops->set_clr_tms(spihw, ps->tms);
+		for (i = 0; i < ncs; i++) {
+			flash[i]->flash_detected = NULL;
+			m25pxx_probe_prepare(&probe[i], csl[i],
+					     &xfer[i * M25PXX_PROBE_XFERS]);
+		}
+		if (spihw->ops->trx_batch(spihw, xfer,
+					  ncs * M25PXX_PROBE_XFERS) != 0) {
+			TRACE_END("detect scan");
+			return -1;
+		}
+		TRACE_END("detect scan");
+
+		for (i = 0, all = true; i < ncs; i++) {
+			chip[i] = m25pxx_probe_decode(flash[i], &probe[i]);
+			if (chip[i] != NULL)
+				found |= 1 << i;
+			else
+				all = false;
+		}
+		if (all == false)
+			continue;
+
+		for (i = 0; i < ncs; i++) {
+			if (m25pxx_attach(flash[i], chip[i], csl[i]) != 0)
+				return -1;
+		}
+		if (serial != NULL && order[s] != hint) {
+			snprintf(val, sizeof(val), "%d", order[s]);
+			conf_set(key, val);
+		}
+		return 0;
+	}
+
+	for (i = 0; verbose && i < ncs; i++) {
+		if ((found & (1 << i)) == 0)
+			printf("M25Pxx detect @ CS %d failed.\n", csl[i]);
+	}
+	if (verbose && found == (1U << ncs) - 1)
+		printf("no common nCE / TMS setting for all chipselects.\n");
+
+	return -1;
+}
+
+/* wait for the decoder of a compressed image, tell what's in the image */
+static int image_ready(struct image_t *img, const char *filename)
+{
+	if (image_wait(img) != 0)
+		return -1;
+
+	printf("%s: %s, %u bytes in %u extents (0x%x .. 0x%x)\n",
+	       filename, img->format, img->payload, img->next,
+	       img->ext[0].addr, img->ext[img->next - 1].addr +
+	       img->ext[img->next - 1].size);
+
+	return 0;
+}
+
+/*
+ * checkpoint journal of the single device read/erase/program job, kept
+ * in '<file>.journal' while the job runs. The header line pins adapter,
+ * chipselect, chip, parameters and the image, so -R only continues the
+ * very same job.
+ */
+static struct journal_t *job_journal(struct m25pxxflash_t *flash,
+				     const char *serial, unsigned int cs,
+				     const char *filename, const char *ops,
+				     uint32_t offset, uint32_t size,
+				     const struct image_t *img, bool resume)
+{
+	char path[FILENAME_MAX], header[JOURNAL_HDRMAX];
+	const struct imgext_t *e;
+	uint32_t crc = 0;
+	unsigned int i;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s.journal", filename);
+	for (i = 0; img != NULL && i < img->next; i++) {
+		e = &img->ext[i];
+		crc = crc32c(crc, &e->addr, sizeof(e->addr));
+		crc = crc32c(crc, &e->size, sizeof(e->size));
+		crc = crc32c(crc, e->data, e->size);
+	}
+	snprintf(header, sizeof(header),
+		 "hpmflash-journal 1 %s cs%u %s %s 0x%x 0x%x %08x",
+		 serial, cs, flash->flash_detected->name, ops, offset, size,
+		 crc);
+
+	if (resume == false) {
+		f = fopen(path, "r");
+		if (f != NULL) {
+			printf("WARN: discarding %s of an interrupted job, -R resumes it.\n",
+			       path);
+			fclose(f);
+		}
+	}
+
+	return journal_open(path, header, resume);
+}
+
+/*
+ * The unit journaled last might not have made it into the flash before
+ * the adapter went away, check it against the flash and redo it if not.
+ */
+static int journal_verify(struct m25pxxflash_t *flash, struct journal_t *j)
+{
+	const struct jrec_t *rec;
+	uint8_t *tmp;
+	bool ok;
+
+	if (j->nrec == 0)
+		return 0;
+	rec = &j->rec[j->nrec - 1];
+
+	tmp = malloc(rec->size);
+	if (tmp == NULL) {
+		STDERR("no mem for journal verify!\n");
+		return -1;
+	}
+	if (m25pxx_read(flash, tmp, rec->addr, rec->size) != 0) {
+		free(tmp);
+		return -1;
+	}
+	if (rec->type == JOURNAL_ERASE)
+		ok = m25pxx_isblank(tmp, rec->size);
+	else
+		ok = crc32c(0, tmp, rec->size) == rec->crc;
+	free(tmp);
+
+	printf("resuming after %u done units, last one (%c @ 0x%x) %s.\n",
+	       j->nrec, rec->type, rec->addr, ok ? "verified" : "is redone");
+	if (ok == false)
+		return journal_drop(j, rec);
+
+	return 0;
+}
+
+/* the extent of the job starting at 'addr' */
+static uint32_t job_extent(uint32_t addr, uint32_t end)
+{
+	uint32_t n = JOURNAL_EXTENT - (addr % JOURNAL_EXTENT);
+
+	return n > end - addr ? end - addr : n;
+}
+
+/*
+ * transport tuning: each parameter is swept on its own, keeping the best
+ * value found so far for the others, with a read of the flash as workload.
+ */
+#define TUNE_SIZE	0x100000
+#define TUNE_RUNS	2
+
+static const unsigned int tune_latency[] = { 1, 2, 4, 8, 16, 0 };
+static const unsigned int tune_usbsize[] = { 0x1000, 0x4000, 0x10000, 0 };
+static const unsigned int tune_chunk[] = { 0x1000, 0x4000, 0x10000, 0 };
+
+/* best of TUNE_RUNS reads, in bytes/s, 0 on failure */
+static uint64_t tune_measure(struct spihw_t *spihw,
+			     struct m25pxxflash_t *flash,
+			     const struct spitune_t *tune,
+			     uint8_t *buf, uint32_t size)
+{
+	uint64_t ts_start, t, best = 0;
+	unsigned int run;
+
+	if (spihw->ops->set_tune(spihw, tune) != 0)
+		return 0;
+	for (run = 0; run < TUNE_RUNS; run++) {
+		ts_start = GetTimeStamp();
+		if (m25pxx_read(flash, buf, 0, size) != 0)
+			return 0;
+		t = GetTimeStamp() - ts_start;
+		if (t != 0 && (uint64_t)size * 1000000 / t > best)
+			best = (uint64_t)size * 1000000 / t;
+	}
+	printf("latency %2u ms, usb %6u, chunk %6u: %8.1f kB/s\n",
+	       spihw->tune.latency, tune->usbsize, spihw->tune.chunk,
+	       best / 1000.0);
+
+	return best;
+}
+
+static int tune_session(struct spihw_t *spihw, struct m25pxxflash_t *flash,
+			const char *serial)
+{
+	const unsigned int *sweep[] = {
+		tune_latency, tune_usbsize, tune_chunk
+	};
+	struct spitune_t best = spihw->tune, t;
+	unsigned int *field[3];
+	uint64_t rate, bestrate;
+	uint32_t size = flash->flash_detected->size;
+	unsigned int p, i;
+	uint8_t *buf;
+
+	if (size > TUNE_SIZE)
+		size = TUNE_SIZE;
+	buf = malloc(size);
+	if (buf == NULL) {
+		STDERR("no mem for tuning buffer!\n");
+		return -1;
+	}
+
+	printf("tuning transport of '%s' with %u byte reads ...\n",
+	       serial, size);
+	bestrate = tune_measure(spihw, flash, &best, buf, size);
+	best = spihw->tune;
+	for (p = 0; p < 3; p++) {
+		t = best;
+		field[0] = &t.latency;
+		field[1] = &t.usbsize;
+		field[2] = &t.chunk;
+		for (i = 0; sweep[p][i] != 0; i++) {
+			*field[p] = sweep[p][i];
+			rate = tune_measure(spihw, flash, &t, buf, size);
+			if (rate > bestrate) {
+				bestrate = rate;
+				best = spihw->tune;
+			}
+		}
+	}
+	free(buf);
+
+	if (bestrate == 0 || spihw->ops->set_tune(spihw, &best) != 0) {
+		STDERR("transport tuning failed!\n");
+		return -1;
+	}
+	printf("best: latency %u ms, usb %u, chunk %u (%.1f kB/s)\n",
+	       best.latency, best.usbsize, best.chunk, bestrate / 1000.0);
+
+	return ftdi_tune_store(serial, &best);
+}
+
+/*
+ * gang programming: one worker thread per adapter, all of them working
+ * from the same mapped image and the same plan.
+ */
+struct gangctx_t {
+	const struct image_t	*img;	/* NULL: erase only */
+	uint32_t		offset;
+	uint32_t		size;
+	unsigned int		speed;
+	unsigned int		cs;
+	unsigned int		verify;	/* inline verify retries */
+	bool			detectonly;
+	bool			erase;
+	bool			write;
+
+	osi_mutex_t		lock;
+	struct flashplan_t	*plan;	/* made by the first detected board */
+};
+
+struct gang_t {
+	struct gangctx_t	*ctx;
+	osi_thread_t		thread;
+	int			devidx;
+	bool			altusb;
+	char			serial[16];
+	/* result */
+	int			rc;
+	const char		*fail;
+	char			chip[12];
+	uint64_t		t_detect;
+	uint64_t		t_erase;
+	uint64_t		t_program;
+	uint64_t		t_total;
+};
+
+static struct flashplan_t *gang_plan(struct gangctx_t *ctx,
+				     struct flashparam_t *chip)
+{
+	struct flashplan_t *plan;
+
+	osi_mutex_lock(&ctx->lock);
+	if (ctx->plan == NULL && ctx->img != NULL)
+		ctx->plan = plan_create(chip, ctx->img);
+	else if (ctx->plan == NULL)
+		ctx->plan = plan_create_erase(chip, ctx->offset, ctx->size);
+	plan = ctx->plan;
+	osi_mutex_unlock(&ctx->lock);
+
+	if (plan != NULL && plan->chip != chip)
+		return NULL;
+
+	return plan;
+}
+
+static void *gang_worker(void *arg)
+{
+	struct gang_t *g = arg;
+	struct gangctx_t *ctx = g->ctx;
+	struct spihw_t *spihw;
+	struct m25pxxflash_t *flash = NULL;
+	struct flashplan_t *plan;
+	uint64_t ts_start, ts;
+
+	ts_start = GetTimeStamp();
+	g->rc = -1;
+	g->fail = "open";
+	spihw = g->altusb ? altusb_create(g->devidx) :
+			    hpmusb_create(g->devidx);
+	if (spihw == NULL)
+		return NULL;
+
+	do {
+		flash = m25pxxflash_create(spihw);
+		if (flash == NULL)
+			break;
+		flash->verify = ctx->verify;
+		spihw->ops->claim(spihw);
+		spihw->ops->set_speed_mode(spihw, ctx->speed, 1);
+
+		g->fail = "detect";
+		ts = GetTimeStamp();
+		TRACE_BEGIN("detect");
+		if (flash_detect(spihw, &flash, &ctx->cs, 1, g->serial,
+				 false) != 0) {
+			TRACE_END("detect");
+			break;
+		}
+		TRACE_END("detect");
+		g->t_detect = GetTimeStamp() - ts;
+		strncpy(g->chip, flash->flash_detected->name,
+			sizeof(g->chip) - 1);
+		if (ctx->detectonly) {
+			g->rc = 0;
+			break;
+		}
+
+		g->fail = "plan";
+		plan = gang_plan(ctx, flash->flash_detected);
+		if (plan == NULL)
+			break;
+
+		if (ctx->erase) {
+			g->fail = "erase";
+			ts = GetTimeStamp();
+			if (plan_erase(flash, plan, NULL) != 0)
+				break;
+			g->t_erase = GetTimeStamp() - ts;
+		}
+		if (ctx->write) {
+			g->fail = "program";
+			ts = GetTimeStamp();
+			if (plan_program(flash, plan, NULL) != 0)
+				break;
+			g->t_program = GetTimeStamp() - ts;
+		}
+		/* only compiled plans carry digests */
+		if (plan->ndigests != 0) {
+			g->fail = "verify";
+			if (plan_verify(flash, plan, NULL) != 0)
+				break;
+		}
+		g->rc = 0;
+	} while (0);
+
+	m25pxxflash_destroy(flash);
+	spihw->ops->release(spihw);
+	print_linkstat(g->serial, &spihw->stat);
+	if (g->altusb)
+		altusb_destroy(spihw);
+	else
+		hpmusb_destroy(spihw);
+	g->t_total = GetTimeStamp() - ts_start;
+
+	return NULL;
+}
+
+static int gang_session(struct gang_t *gang, unsigned int ngang,
+			struct gangctx_t *ctx)
+{
+	struct flashplan_t *plan;
+	uint64_t ts_start;
+	unsigned int i, ok = 0;
+
+	osi_mutex_init(&ctx->lock);
+	printf("gang session on %d adapters ...\n", ngang);
+	ts_start = GetTimeStamp();
+	for (i = 0; i < ngang; i++) {
+		gang[i].ctx = ctx;
+		gang[i].rc = -1;
+		gang[i].fail = "thread";
+		if (osi_thread_create(&gang[i].thread, gang_worker,
+				      &gang[i]) != 0)
+			gang[i].devidx = -1;
+	}
+	for (i = 0; i < ngang; i++) {
+		if (gang[i].devidx != -1)
+			osi_thread_join(gang[i].thread);
+	}
+
+	plan = ctx->plan;
+	if (plan != NULL) {
+		printf("plan: %s, %d sectors, %d pages\n",
+		       plan->chiperase ? "chip erase" : "sector erase",
+		       plan->chiperase ? 0 : plan->nsectors, plan->npages);
+	}
+	printf("%-16s %-7s %-12s %10s %10s %10s %10s  %s\n",
+	       "adapter", "backend", "chip", "detect", "erase", "program",
+	       "total", "result");
+	for (i = 0; i < ngang; i++) {
+		printf("%-16s %-7s %-12s %7.1f ms %7.1f ms %7.1f ms %7.1f ms  %s%s\n",
+		       gang[i].serial, gang[i].altusb ? "altusb" : "hpmusb",
+		       gang[i].chip[0] ? gang[i].chip : "-",
+		       gang[i].t_detect / 1000.0, gang[i].t_erase / 1000.0,
+		       gang[i].t_program / 1000.0, gang[i].t_total / 1000.0,
+		       gang[i].rc == 0 ? "ok" : "FAILED: ",
+		       gang[i].rc == 0 ? "" : gang[i].fail);
+		if (gang[i].rc == 0)
+			ok++;
+	}
+	printf("%d of %d adapters ok, ", ok, ngang);
+	print_time("gang time", ts_start);
+
+	plan_destroy(ctx->plan);
+	osi_mutex_destroy(&ctx->lock);
+
+	return ok == ngang ? 0 : -1;
+}
+
+#ifdef __linux__
+/*
+ * daemon mode: adapters are opened, claimed and kept by one thread each,
+ * clients hand in jobs over a unix socket. One request per connection,
+ * a single line:
+ *
+ *   <prio> <adapters|*> <ops> <cs> <offset> <size> <path>
+ *
+ * 'ops' is a combination of d(etect), e(rase), w(rite), r(ead) or '-',
+ * 'path' the image (w) or output file (r), '-' if none. Images are mapped
+ * from 'path', so a file in /dev/shm passes them by shared memory. Per
+ * adapter jobs run in order of priority (higher first), FIFO within the
+ * same. The daemon answers one line per adapter and a final 'done <rc>'.
+ */
+#define DAEMON_BACKLOG	8
+
+struct dconn_t;
+struct dadapter_t;
+
+struct djob_t {
+	struct djob_t		*next;
+	struct dconn_t		*conn;
+	struct dadapter_t	*a;
+	struct gang_t		*g;	/* result */
+	bool			finished;
+	bool			reported;
+};
+
+struct dconn_t {
+	struct dconn_t		*next;	/* live connections */
+	int			fd;
+	int			prio;
+	unsigned int		cs;
+	bool			detectonly;
+	bool			erase;
+	bool			write;
+	bool			read;
+	uint32_t		offset;
+	uint32_t		size;
+	char			path[PATH_MAX];
+	struct image_t		*img;
+
+	osi_mutex_t		lock;
+	osi_cond_t		cond;
+	unsigned int		njob;
+	struct djob_t		job[GANG_MAX];
+};
+
+struct dadapter_t {
+	struct gang_t		*g;
+	struct spihw_t		*spihw;
+	struct m25pxxflash_t	*flash;
+	osi_thread_t		thread;
+	osi_mutex_t		lock;
+	osi_cond_t		cond;
+	struct djob_t		*head;
+	bool			stop;
+};
+
+static struct dadapter_t dadapter[GANG_MAX];
+static unsigned int ndadapter;
+/* connection threads are detached, shutdown waits for this list to drain */
+static struct dconn_t *dconns;
+static osi_mutex_t dconn_lock;
+static osi_cond_t dconn_cond;
+static volatile sig_atomic_t daemon_quit;
+
+static void daemon_signal(int sig)
+{
+	daemon_quit = 1;
+}
+
+static int daemon_job(struct dadapter_t *a, struct dconn_t *c,
+		      struct gang_t *g)
+{
+	struct flashplan_t *plan = NULL;
+	struct flashparam_t *chip;
+	uint8_t *buf;
+	uint32_t size;
+	FILE *f;
+	int rc = -1;
+
+	g->fail = "detect";
+	if (flash_detect(a->spihw, &a->flash, &c->cs, 1, g->serial,
+			 false) != 0)
+		return -1;
+	chip = a->flash->flash_detected;
+	strncpy(g->chip, chip->name, sizeof(g->chip) - 1);
+	if (c->detectonly)
+		return 0;
+
+	if (c->read) {
+		g->fail = "read";
+		size = c->size;
+		if (c->offset >= chip->size)
+			return -1;
+		if (size == 0 || size > chip->size - c->offset)
+			size = chip->size - c->offset;
+		buf = malloc(size);
+		if (buf == NULL)
+			return -1;
+		if (m25pxx_read(a->flash, buf, c->offset, size) == 0) {
+			f = fopen(c->path, "wb");
+			if (f != NULL) {
+				if (fwrite(buf, 1, size, f) == size)
+					rc = 0;
+				fclose(f);
+			}
+		}
+		free(buf);
+		return rc;
+	}
+
+	g->fail = "plan";
+	plan = c->write ? plan_create(chip, c->img) :
+			  plan_create_erase(chip, c->offset, c->size);
+	if (plan == NULL)
+		return -1;
+	do {
+		if (c->erase) {
+			g->fail = "erase";
+			if (plan_erase(a->flash, plan, NULL) != 0)
+				break;
+		}
+		if (c->write) {
+			g->fail = "program";
+			if (plan_program(a->flash, plan, NULL) != 0)
+				break;
+		}
+		rc = 0;
+	} while (0);
+	plan_destroy(plan);
+
+	return rc;
+}
+
+static void daemon_finish(struct djob_t *j)
+{
+	struct dconn_t *c = j->conn;
+
+	osi_mutex_lock(&c->lock);
+	j->finished = true;
+	osi_cond_broadcast(&c->cond);
+	osi_mutex_unlock(&c->lock);
+}
+
+/* jobs still queued at shutdown fail, their clients get 'done' */
+static void daemon_fail(struct djob_t *j)
+{
+	j->g->rc = -1;
+	j->g->fail = "shutdown";
+	daemon_finish(j);
+}
+
+static void *daemon_adapter(void *arg)
+{
+	struct dadapter_t *a = arg;
+	struct djob_t *j;
+	struct dconn_t *c;
+	uint64_t ts_start;
+
+	osi_mutex_lock(&a->lock);
+	while (a->stop == false) {
+		j = a->head;
+		if (j == NULL) {
+			osi_cond_wait(&a->cond, &a->lock);
+			continue;
+		}
+		a->head = j->next;
+		osi_mutex_unlock(&a->lock);
+
+		c = j->conn;
+		ts_start = GetTimeStamp();
+		TRACE_BEGIN("daemon job");
+		j->g->rc = daemon_job(a, c, j->g);
+		TRACE_END("daemon job");
+		j->g->t_total = GetTimeStamp() - ts_start;
+		daemon_finish(j);
+
+		osi_mutex_lock(&a->lock);
+	}
+	osi_mutex_unlock(&a->lock);
+
+	return NULL;
+}
+
+/* higher priority first, FIFO within the same */
+static void daemon_enqueue(struct dadapter_t *a, struct djob_t *j)
+{
+	struct djob_t **pp;
+
+	osi_mutex_lock(&a->lock);
+	if (a->stop) {
+		osi_mutex_unlock(&a->lock);
+		daemon_fail(j);
+		return;
+	}
+	for (pp = &a->head; *pp != NULL; pp = &(*pp)->next) {
+		if ((*pp)->conn->prio < j->conn->prio)
+			break;
+	}
+	j->next = *pp;
+	*pp = j;
+	osi_cond_broadcast(&a->cond);
+	osi_mutex_unlock(&a->lock);
+}
+
+static void daemon_reply(struct dconn_t *c, const char *fmt, ...)
+{
+	char line[256];
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+	if (n > 0 && write(c->fd, line, n) != n)
+		STDERR("%s: client gone.\n", __func__);
+}
+
+static int daemon_request(struct dconn_t *c, char *line)
+{
+	char adapters[GANG_MAX * 20], ops[8], *tok, *p;
+	unsigned int i;
+
+	if (sscanf(line, "%d %319s %7s %u %u %u %4095[^\n]", &c->prio,
+		   adapters, ops, &c->cs, &c->offset, &c->size,
+		   c->path) != 7) {
+		daemon_reply(c, "error malformed request\n");
+		return -1;
+	}
+	for (p = ops; *p != '\0'; p++) {
+		if (*p == 'd')
+			c->detectonly = true;
+		else if (*p == 'e')
+			c->erase = true;
+		else if (*p == 'w')
+			c->write = true;
+		else if (*p == 'r')
+			c->read = true;
+	}
+	if (c->write) {
+		c->img = image_load(c->path, c->offset, c->size);
+		if (c->img == NULL || image_wait(c->img) != 0) {
+			daemon_reply(c, "error cannot load %s\n", c->path);
+			return -1;
+		}
+	}
+
+	for (tok = strtok(adapters, ","); tok != NULL;
+	     tok = strtok(NULL, ",")) {
+		for (i = 0; i < ndadapter; i++) {
+			if (strcmp(tok, "*") != 0 &&
+			    strcmp(tok, dadapter[i].g->serial) != 0)
+				continue;
+			if (c->njob == GANG_MAX)
+				break;
+			c->job[c->njob].conn = c;
+			c->job[c->njob].g = calloc(1, sizeof(struct gang_t));
+			if (c->job[c->njob].g == NULL)
+				break;
+			strcpy(c->job[c->njob].g->serial,
+			       dadapter[i].g->serial);
+			c->job[c->njob].a = &dadapter[i];
+			c->njob++;
+		}
+	}
+	if (c->njob == 0 || (c->read && c->njob > 1)) {
+		daemon_reply(c, "error %s\n", c->njob == 0 ?
+			     "no such adapter" : "read needs one adapter");
+		return -1;
+	}
+
+	for (i = 0; i < c->njob; i++)
+		daemon_enqueue(c->job[i].a, &c->job[i]);
+
+	return 0;
+}
+
+static void daemon_conn_add(struct dconn_t *c)
+{
+	osi_mutex_lock(&dconn_lock);
+	c->next = dconns;
+	dconns = c;
+	osi_mutex_unlock(&dconn_lock);
+}
+
+static void daemon_conn_del(struct dconn_t *c)
+{
+	struct dconn_t **pp;
+
+	osi_mutex_lock(&dconn_lock);
+	for (pp = &dconns; *pp != NULL; pp = &(*pp)->next) {
+		if (*pp == c) {
+			*pp = c->next;
+			break;
+		}
+	}
+	osi_cond_broadcast(&dconn_cond);
+	osi_mutex_unlock(&dconn_lock);
+}
+
+static void *daemon_conn(void *arg)
+{
+	struct dconn_t *c = arg;
+	struct djob_t *j;
+	char line[PATH_MAX + 128];
+	unsigned int i, left = 0;
+	ssize_t n, len = 0;
+	int rc = 0;
+
+	/* read the request line */
+	while (len < sizeof(line) - 1) {
+		n = read(c->fd, &line[len], sizeof(line) - 1 - len);
+		if (n <= 0)
+			break;
+		len += n;
+		if (memchr(line, '\n', len) != NULL)
+			break;
+	}
+	line[len] = '\0';
+
+	osi_mutex_init(&c->lock);
+	osi_cond_init(&c->cond);
+	if (daemon_request(c, line) == 0) {
+		left = c->njob;
+		osi_mutex_lock(&c->lock);
+		while (left != 0) {
+			for (i = 0; i < c->njob; i++) {
+				j = &c->job[i];
+				if (!j->finished || j->reported)
+					continue;
+				j->reported = true;
+				left--;
+				if (j->g->rc != 0)
+					rc = -1;
+				daemon_reply(c, "%s %s %s%s %.1f ms\n",
+					     j->g->serial,
+					     j->g->chip[0] ? j->g->chip : "-",
+					     j->g->rc == 0 ? "ok" : "FAILED:",
+					     j->g->rc == 0 ? "" : j->g->fail,
+					     j->g->t_total / 1000.0);
+			}
+			if (left != 0)
+				osi_cond_wait(&c->cond, &c->lock);
+		}
+		osi_mutex_unlock(&c->lock);
+		daemon_reply(c, "done %d\n", rc);
+	}
+
+	for (i = 0; i < c->njob; i++)
+		free(c->job[i].g);
+	image_destroy(c->img);
+	osi_cond_destroy(&c->cond);
+	osi_mutex_destroy(&c->lock);
+	daemon_conn_del(c);
+	close(c->fd);
+	free(c);
+
+	return NULL;
+}
+
+static int daemon_serve(const char *sockpath, struct gang_t *gang,
+			unsigned int ngang, unsigned int speed)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	struct sigaction sig = { .sa_handler = daemon_signal };
+	struct dadapter_t *a;
+	struct djob_t *j;
+	struct dconn_t *c;
+	struct ucred cred;
+	socklen_t credlen;
+	osi_thread_t thread;
+	uint64_t ts_start = GetTimeStamp();
+	unsigned int i;
+	mode_t mask;
+	int ret = -1, rc, fd, sfd = -1;
+
+	osi_mutex_init(&dconn_lock);
+	osi_cond_init(&dconn_cond);
+	for (ndadapter = 0; ndadapter < ngang; ndadapter++) {
+		a = &dadapter[ndadapter];
+		a->g = &gang[ndadapter];
+		a->spihw = a->g->altusb ? altusb_create(a->g->devidx) :
+					  hpmusb_create(a->g->devidx);
+		if (a->spihw == NULL) {
+			STDERR("cannot open adapter %s!\n", a->g->serial);
+			goto out;
+		}
+		a->flash = m25pxxflash_create(a->spihw);
+		if (a->flash == NULL)
+			goto out;
+		a->spihw->ops->claim(a->spihw);
+		a->spihw->ops->set_speed_mode(a->spihw, speed, 1);
+		osi_mutex_init(&a->lock);
+		osi_cond_init(&a->cond);
+		if (osi_thread_create(&a->thread, daemon_adapter, a) != 0) {
+			osi_cond_destroy(&a->cond);
+			osi_mutex_destroy(&a->lock);
+			goto out;
+		}
+	}
+
+	if (strlen(sockpath) >= sizeof(sa.sun_path)) {
+		STDERR("socket path '%s' too long!\n", sockpath);
+		goto out;
+	}
+	strcpy(sa.sun_path, sockpath);
+	unlink(sockpath);
+	/*
+	 * jobs read and write files with the rights of the daemon, only its
+	 * own user (and root) may connect
+	 */
+	sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	mask = umask(0077);
+	rc = sfd < 0 ? -1 : bind(sfd, (struct sockaddr *)&sa, sizeof(sa));
+	umask(mask);
+	if (rc != 0 || listen(sfd, DAEMON_BACKLOG) != 0) {
+		STDERR("cannot listen on '%s'!\n", sockpath);
+		goto out;
+	}
+
+	/* no SA_RESTART, a signal has to break accept() */
+	sigaction(SIGINT, &sig, NULL);
+	sigaction(SIGTERM, &sig, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("daemon listening on %s with %d adapters, ", sockpath, ngang);
+	print_time("startup", ts_start);
+	fflush(stdout);
+
+	while (daemon_quit == 0) {
+		fd = accept(sfd, NULL, NULL);
+		if (fd < 0)
+			continue;
+		credlen = sizeof(cred);
+		cred.uid = (uid_t)-1;
+		if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred,
+			       &credlen) != 0 ||
+		    (cred.uid != 0 && cred.uid != getuid())) {
+			STDERR("daemon: refusing client of uid %d!\n",
+			       (int)cred.uid);
+			close(fd);
+			continue;
+		}
+		c = calloc(1, sizeof(*c));
+		if (c == NULL) {
+			close(fd);
+			continue;
+		}
+		c->fd = fd;
+		daemon_conn_add(c);
+		if (osi_thread_create(&thread, daemon_conn, c) != 0) {
+			daemon_conn_del(c);
+			close(fd);
+			free(c);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+	printf("daemon shutting down.\n");
+	ret = 0;
+out:
+	if (sfd >= 0) {
+		close(sfd);
+		unlink(sockpath);
+	}
+	/* running jobs complete, queued ones and late comers fail */
+	for (i = 0; i < ndadapter; i++) {
+		a = &dadapter[i];
+		osi_mutex_lock(&a->lock);
+		a->stop = true;
+		while ((j = a->head) != NULL) {
+			a->head = j->next;
+			daemon_fail(j);
+		}
+		osi_cond_broadcast(&a->cond);
+		osi_mutex_unlock(&a->lock);
+		osi_thread_join(a->thread);
+	}
+	/* a client that is still sending its request gets EOF */
+	osi_mutex_lock(&dconn_lock);
+	for (c = dconns; c != NULL; c = c->next)
+		shutdown(c->fd, SHUT_RD);
+	while (dconns != NULL)
+		osi_cond_wait(&dconn_cond, &dconn_lock);
+	osi_mutex_unlock(&dconn_lock);
+	for (i = 0; i < ndadapter; i++) {
+		osi_cond_destroy(&dadapter[i].cond);
+		osi_mutex_destroy(&dadapter[i].lock);
+	}
+	osi_cond_destroy(&dconn_cond);
+	osi_mutex_destroy(&dconn_lock);
+	/* the adapter that failed to start is the one at ndadapter */
+	for (i = 0; i <= ndadapter && i < ngang; i++) {
+		a = &dadapter[i];
+		if (a->flash != NULL)
+			m25pxxflash_destroy(a->flash);
+		if (a->spihw == NULL)
+			continue;
+		a->spihw->ops->release(a->spihw);
+		if (a->g->altusb)
+			altusb_destroy(a->spihw);
+		else
+			hpmusb_destroy(a->spihw);
+	}
+
+	return ret;
+}
+
+static int daemon_client(const char *sockpath, int prio, const char *adapters,
+			 const char *ops, unsigned int cs, uint32_t offset,
+			 uint32_t size, const char *filename)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	char path[PATH_MAX] = "-", line[PATH_MAX + 128];
+	char *p, *eol;
+	ssize_t n, len = 0;
+	int fd, rc = -1;
+
+	if (filename != NULL && filename[0] != '/') {
+		if (getcwd(path, sizeof(path) - strlen(filename) - 2) == NULL)
+			return -1;
+		strcat(path, "/");
+		strcat(path, filename);
+	} else if (filename != NULL) {
+		strncpy(path, filename, sizeof(path) - 1);
+	}
+	if (strlen(sockpath) >= sizeof(sa.sun_path))
+		return -1;
+	strcpy(sa.sun_path, sockpath);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+		STDERR("cannot connect to daemon at '%s'!\n", sockpath);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	n = snprintf(line, sizeof(line), "%d %s %s %u %u %u %s\n",
+		     prio, adapters, ops, cs, offset, size, path);
+	if (write(fd, line, n) != n) {
+		close(fd);
+		return -1;
+	}
+
+	/* echo the answer, the last line tells the result */
+	while ((n = read(fd, &line[len], sizeof(line) - 1 - len)) > 0) {
+		len += n;
+		line[len] = '\0';
+		p = line;
+		while ((eol = strchr(p, '\n')) != NULL) {
+			*eol = '\0';
+			printf("%s\n", p);
+			if (strncmp(p, "done ", 5) == 0)
+				rc = atoi(p + 5);
+			p = eol + 1;
+		}
+		len = strlen(p);
+		memmove(line, p, len);
+	}
+	close(fd);
+
+	return rc;
+}
+#endif /* __linux__ */
+
+/* set up the jobs of all chipselects for one range */
+static void multi_range(struct m25pxx_multi_t *job, unsigned int ncs,
+			const uint8_t *src, uint32_t addr, uint32_t size)
+{
+	unsigned int i;
+
+	for (i = 0; i < ncs; i++) {
+		job[i].src = src;
+		job[i].addr = addr;
+		job[i].size = size;
+	}
+}
+
+/*
+ * several flashes on different chipselects of the same adapter, erase and
+ * program them all at the same time. Sparse images are erased run by run
+ * of touched sectors and programmed extent by extent.
+ */
+static int multi_session(struct spihw_t *spihw, struct m25pxxflash_t **flash,
+			 unsigned int *csl, unsigned int ncs,
+			 bool detectonly, bool erase, bool write,
+			 struct image_t *img, uint32_t offset, uint32_t size)
+{
+	struct m25pxx_multi_t job[M25PXX_MULTI_MAX] = { };
+	struct flashparam_t *chip;
+	struct flashplan_t *plan = NULL;
+	const struct imgext_t *e;
+	uint32_t chipsize = flash[0]->flash_detected->size;
+	uint64_t ts_start;
+	unsigned int i, n;
+	int ret = -1;
+
+	job[0].flash = flash[0];
+	for (i = 1; i < ncs; i++) {
+		job[i].flash = flash[i];
+		chip = job[i].flash->flash_detected;
+		printf("----- M25Pxx detect @ CS %d ok (%-16s) -----\n",
+		       csl[i], chip->name);
+		if (chip->size < chipsize)
+			chipsize = chip->size;
+	}
+	if (detectonly == true) {
+		ret = 0;
+		goto out;
+	}
+
+	if (write == true) {
+		n = img->payload;
+		image_clip(img, 0, chipsize);
+		if (img->payload != n)
+			printf("WARN: image data beyond chip size (0x%x) is ignored!\n",
+			       chipsize);
+		if (img->next == 0) {
+			STDERR("no image data within the chip!\n");
+			goto out;
+		}
+		plan = plan_create(flash[0]->flash_detected, img);
+		if (plan == NULL)
+			goto out;
+		for (i = 0; i < ncs; i++)
+			job[i].occ = plan->occ;
+	} else if (size != 0 && offset + size > chipsize) {
+		printf("WARN: offset (0x%x) + size (0x%x) exceeds chip size (0x%x)!\n",
+		       offset, size, chipsize);
+		size = chipsize - offset;
+	}
+
+	if (erase == true) {
+		ts_start = GetTimeStamp();
+		if (write == false && size == 0) {
+			printf("> starting chip erase on %d chips ...\n", ncs);
+			ret = m25pxx_multi_chiperase(job, ncs, &progprogress);
+		} else {
+			if (write == false) {
+				chip = flash[0]->flash_detected;
+				plan = plan_create_erase(chip, offset, size);
+				if (plan == NULL)
+					goto out;
+			}
+			ret = 0;
+			for (i = 0; i < plan->nsectors && ret == 0; i += n) {
+				/* run of adjacent sectors */
+				for (n = 1; i + n < plan->nsectors; n++) {
+					if (plan->sectors[i + n].addr !=
+					    plan->sectors[i].addr +
+					    n * plan->sectors[i].size)
+						break;
+				}
+				printf("-> erase 0x%x .. 0x%x on %d chips ...\n",
+				       plan->sectors[i].addr,
+				       plan->sectors[i].addr +
+				       n * plan->sectors[i].size, ncs);
+				multi_range(job, ncs, NULL,
+					    plan->sectors[i].addr,
+					    n * plan->sectors[i].size);
+				ret = m25pxx_multi_sectorerase(job, ncs,
+							       &progprogress);
+			}
+			for (i = 0; i < plan->nedges && ret == 0; i++)
+				printf("-> blank 0x%x .. 0x%x on %d chips\n",
+				       plan->edges[i].addr,
+				       plan->edges[i].addr +
+				       plan->edges[i].size, ncs);
+			for (i = 0; i < ncs && ret == 0; i++)
+				ret = plan_blank_edges(job[i].flash, plan);
+		}
+		if (ret != 0) {
+			STDERR("erase failed!\n");
+			goto out;
+		}
+		print_time("erase done", ts_start);
+	}
+
+	if (write == true) {
+		printf("programming %d bytes in %d extents on %d chips\n",
+		       img->payload, img->next, ncs);
+		ts_start = GetTimeStamp();
+		for (i = 0; i < img->next; i++) {
+			e = &img->ext[i];
+			multi_range(job, ncs, e->data, e->addr, e->size);
+			ret = m25pxx_multi_program(job, ncs, &progprogress);
+			if (ret != 0) {
+				STDERR("flash write failed!\n");
+				goto out;
+			}
+		}
+		print_time("flash program done", ts_start);
+	}
+	ret = 0;
+out:
+	for (i = 0; i < ncs; i++) {
+		if (job[i].rc != 0)
+			STDERR("CS %d failed!\n", csl[i]);
+	}
+	plan_destroy(plan);
+
+	return ret;
+}
+
+/*
+ * -C: erase list, pages and sector digests of an image are worked out once
+ * and stored together with the page data, -X runs them on every board
+ * without looking at an image again
+ */
+static int compile_session(const char *part, const char *filename,
+			   const char *basefile, uint32_t offset,
+			   uint32_t size, const char *planfile)
+{
+	struct flashparam_t *chip;
+	struct image_t *img = NULL, *base = NULL;
+	struct flashplan_t *plan = NULL;
+	int ret = -1;
+
+	chip = m25pxx_find(part);
+	if (chip == NULL) {
+		STDERR("unknown part '%s'!\n", part);
+		return -1;
+	}
+
+	do {
+		img = image_load(filename, offset, size);
+		if (img == NULL || image_ready(img, filename) != 0)
+			break;
+		if (basefile != NULL) {
+			base = image_load(basefile, offset, size);
+			if (base == NULL || image_ready(base, basefile) != 0)
+				break;
+		}
+		image_clip(img, 0, chip->size);
+		if (img->next == 0) {
+			STDERR("no image data within the chip!\n");
+			break;
+		}
+		plan = plan_compile(chip, img, base);
+		if (plan == NULL || plan_save(plan, planfile) != 0)
+			break;
+		printf("plan for %s: %s, %d sectors, %d pages, %d digests -> %s\n",
+		       chip->name,
+		       plan->chiperase ? "chip erase" : "sector erase",
+		       plan->chiperase ? 0 : plan->nsectors, plan->npages,
+		       plan->ndigests, planfile);
+		ret = 0;
+	} while (0);
+
+	plan_destroy(plan);
+	image_destroy(base);
+	image_destroy(img);
+
+	return ret;
+}
+
+/* -X: a compiled plan, its pages straight from the mapped file */
+static int plan_session(struct m25pxxflash_t *flash, struct flashplan_t *plan)
+{
+	uint64_t ts_start;
+
+	if (plan->chip != flash->flash_detected) {
+		STDERR("plan is made for %s, not for the detected %s!\n",
+		       plan->chip->name, flash->flash_detected->name);
+		return -1;
+	}
+	printf("plan: %s, %d sectors, %d pages, %d digests\n",
+	       plan->chiperase ? "chip erase" : "sector erase",
+	       plan->chiperase ? 0 : plan->nsectors, plan->npages,
+	       plan->ndigests);
+
+	ts_start = GetTimeStamp();
+	if (plan_erase(flash, plan, &progprogress) != 0) {
+		STDERR("flash erase failed!\n");
+		return -1;
+	}
+	print_time("erase done", ts_start);
+
+	ts_start = GetTimeStamp();
+	if (plan_program(flash, plan, &progprogress) != 0) {
+		STDERR("flash write failed!\n");
+		return -1;
+	}
+	print_time("flash program done", ts_start);
+	print_verify(flash);
+
+	ts_start = GetTimeStamp();
+	if (plan_verify(flash, plan, &progprogress) != 0) {
+		STDERR("flash verify failed!\n");
+		return -1;
+	}
+	print_time("verify done", ts_start);
+
+	return 0;
+}
+
+/*
+ * -U: the image goes through the buffered writer, bytes around and between
+ * its extents stay as they are. Sectors are erased only where a bit has to
+ * go from 0 to 1, small updates of data already there need no erase.
+ */
+static int update_session(struct m25pxxflash_t *flash,
+			  const struct image_t *img)
+{
+	uint32_t sectorsize = flash->flash_detected->sectorsize;
+	struct imgext_t span = { img->spanaddr, img->spansize, NULL };
+	const struct imgext_t *e = img->ext, *last = &img->ext[img->next];
+	unsigned int percent, percentx = 0, hint = 0;
+	uint32_t a, n, done = 0, total = img->payload;
+	uint64_t ts_start;
+	uint8_t *buf;
+
+	/* a binary is written as a whole, blank pages it has dropped too */
+	if (img->spansize != 0) {
+		e = &span;
+		last = &span + 1;
+		total = img->spansize;
+	}
+	buf = malloc(sectorsize);
+	if (buf == NULL) {
+		STDERR("no mem for update!\n");
+		return -1;
+	}
+
+	printf("updating %d bytes in %d extents\n", total, (int)(last - e));
+	ts_start = GetTimeStamp();
+	progprogress.fct(progprogress.arg, 0, 0);
+	for (; e < last; e++) {
+		for (a = e->addr; a < e->addr + e->size; a += n) {
+			n = sectorsize - a % sectorsize;
+			if (n > e->addr + e->size - a)
+				n = e->addr + e->size - a;
+			image_render(img, &hint, a, n, buf);
+			if (m25pxx_write(flash, buf, a, n) != 0) {
+				STDERR("flash update failed @ 0x%x!\n", a);
+				free(buf);
+				return -1;
+			}
+			done += n;
+			percent = (uint64_t)done * 100 / total;
+			if (percent != 0 && percent != 100 &&
+			    percent != percentx) {
+				percentx = percent;
+				progprogress.fct(progprogress.arg, percent, 0);
+			}
+		}
+	}
+	free(buf);
+	if (m25pxx_flush(flash) != 0) {
+		STDERR("flash update failed!\n");
+		return -1;
+	}
+	progprogress.fct(progprogress.arg, 100, 0);
+	print_time("flash update done", ts_start);
+	printf("update: %lu sectors read, %lu erased, %lu pages programmed\n",
+	       flash->wstat.reads, flash->wstat.erases, flash->wstat.pages);
+	print_verify(flash);
+
+	return 0;
+}
+
+/*
+ * -H: digest of the flash without a file in between. Windows of one
+ * sector are read into a small ring while a worker thread hashes them,
+ * memory stays the same whatever the chip size is.
+ */
+#define DIGEST_BUFS	4
+
+struct dgctx_t {
+	int			alg;
+	const struct image_t	*img;	/* NULL or expected content */
+	uint32_t		winsize;
+	uint8_t			*buf[DIGEST_BUFS];
+	uint32_t		addr[DIGEST_BUFS];
+	uint32_t		len[DIGEST_BUFS];
+	uint8_t			*ref;	/* window of 'img' */
+	uint8_t			*blank;
+	unsigned int		head;	/* windows read */
+	unsigned int		tail;	/* windows hashed */
+	bool			eof;
+	bool			stop;	/* mismatch, no need to read on */
+	osi_mutex_t		lock;
+	osi_cond_t		cond;
+	/* worker state */
+	struct digest_t		all;
+	struct digest_t		data;	/* without trailing 0xFF, as -r */
+	uint32_t		datasize;
+	uint32_t		pending;	/* 0xFF not yet fed into 'data' */
+	unsigned int		hint;
+	unsigned int		nwin;
+	unsigned int		nblank;
+};
+
+static void print_digest(const char *what, const uint8_t *md, unsigned int n,
+			 const char *tail)
+{
+	unsigned int i;
+
+	printf("%s", what);
+	for (i = 0; i < n; i++)
+		printf("%02x", md[i]);
+	printf("%s\n", tail);
+}
+
+/* -1 if the window differs from the image, no need to read on */
+static int digest_window(struct dgctx_t *c, const uint8_t *p, uint32_t addr,
+			 uint32_t size)
+{
+	struct digest_t r;
+	uint8_t md[DIGEST_MAXSIZE], mdref[DIGEST_MAXSIZE];
+	char txt[48];
+	unsigned int n;
+	uint32_t last;
+
+	c->nwin++;
+	digest_update(&c->all, p, size);
+	if (blank_check(p, size)) {
+		c->pending += size;
+		c->nblank++;
+	} else {
+		for (; c->pending != 0; c->pending -= n) {
+			n = c->pending < c->winsize ? c->pending : c->winsize;
+			digest_update(&c->data, c->blank, n);
+		}
+		for (last = size; p[last - 1] == 0xFF; last--)
+			;
+		digest_update(&c->data, p, last);
+		c->datasize = addr + last;
+		c->pending = size - last;
+	}
+	if (c->img == NULL && blank_check(p, size))
+		return 0;
+
+	digest_init(&r, c->alg);
+	digest_update(&r, p, size);
+	n = digest_final(&r, md);
+	sprintf(txt, "  0x%06x .. 0x%06x  ", addr, addr + size);
+	if (c->img == NULL) {
+		print_digest(txt, md, n, "");
+		return 0;
+	}
+	image_render(c->img, &c->hint, addr, size, c->ref);
+	digest_init(&r, c->alg);
+	digest_update(&r, c->ref, size);
+	digest_final(&r, mdref);
+	if (memcmp(md, mdref, n) == 0) {
+		if (!blank_check(p, size))
+			print_digest(txt, md, n, "");
+		return 0;
+	}
+	print_digest(txt, md, n, "  DIFFERS, expected:");
+	print_digest("                          ", mdref, n, "");
+
+	return -1;
+}
+
+static void *digest_worker(void *arg)
+{
+	struct dgctx_t *c = arg;
+	unsigned int i;
+	int rc;
+
+	osi_mutex_lock(&c->lock);
+	while (!c->stop) {
+		if (c->tail == c->head) {
+			if (c->eof)
+				break;
+			osi_cond_wait(&c->cond, &c->lock);
+			continue;
+		}
+		i = c->tail % DIGEST_BUFS;
+		osi_mutex_unlock(&c->lock);
+		rc = digest_window(c, c->buf[i], c->addr[i], c->len[i]);
+		osi_mutex_lock(&c->lock);
+		if (rc != 0)
+			c->stop = true;
+		c->tail++;
+		osi_cond_broadcast(&c->cond);
+	}
+	osi_cond_broadcast(&c->cond);
+	osi_mutex_unlock(&c->lock);
+
+	return NULL;
+}
+
+static int digest_session(struct m25pxxflash_t *flash, const char *algsel,
+			  const struct image_t *img, uint32_t offset,
+			  uint32_t size)
+{
+	struct flashparam_t *chip = flash->flash_detected;
+	struct dgctx_t c = { .img = img, .winsize = chip->sectorsize };
+	uint8_t md[DIGEST_MAXSIZE], exp[DIGEST_MAXSIZE];
+	const char *hex = strchr(algsel, ':');
+	char name[8] = { };
+	unsigned int i, n, nexp = 0;
+	osi_thread_t thread;
+	uint64_t ts_start;
+	uint32_t a, end;
+	bool stop;
+	int ret = -1;
+
+	/* <alg>[:<expected digest of the data>] */
+	n = hex != NULL ? hex - algsel : strlen(algsel);
+	strncpy(name, algsel, n < sizeof(name) ? n : sizeof(name) - 1);
+	c.alg = digest_alg(name);
+	if (c.alg < 0) {
+		STDERR("unknown digest '%s', crc32c or sha256!\n", name);
+		return -1;
+	}
+	if (hex != NULL) {
+		nexp = c.alg == DIGEST_SHA256 ? 32 : 4;
+		hex++;
+		if (strlen(hex) != 2 * nexp ||
+		    strspn(hex, "0123456789abcdefABCDEF") != 2 * nexp) {
+			STDERR("expected %s digest needs %u hex digits!\n",
+			       name, 2 * nexp);
+			return -1;
+		}
+		for (i = 0; i < nexp; i++)
+			sscanf(&hex[2 * i], "%2hhx", &exp[i]);
+	}
+	if (offset >= chip->size) {
+		STDERR("offset 0x%x beyond chip size 0x%x!\n",
+		       offset, chip->size);
+		return -1;
+	}
+	end = size == 0 || size > chip->size - offset ?
+	      chip->size : offset + size;
+
+	for (i = 0; i < DIGEST_BUFS; i++)
+		c.buf[i] = malloc(c.winsize);
+	c.ref = malloc(c.winsize);
+	c.blank = malloc(c.winsize);
+	for (i = 0; i < DIGEST_BUFS && c.buf[i] != NULL; i++)
+		;
+	if (i < DIGEST_BUFS || c.ref == NULL || c.blank == NULL) {
+		STDERR("no mem for digest windows!\n");
+		goto out;
+	}
+	memset(c.blank, 0xFF, c.winsize);
+	digest_init(&c.all, c.alg);
+	digest_init(&c.data, c.alg);
+	osi_mutex_init(&c.lock);
+	osi_cond_init(&c.cond);
+	if (osi_thread_create(&thread, digest_worker, &c) != 0) {
+		STDERR("cannot start digest worker!\n");
+		osi_cond_destroy(&c.cond);
+		osi_mutex_destroy(&c.lock);
+		goto out;
+	}
+
+	printf("%s (%s) of 0x%x .. 0x%x%s%s:\n", name, digest_kernel_name(),
+	       offset, end, img != NULL ? ", expecting " : "",
+	       img != NULL ? img->format : "");
+	ts_start = GetTimeStamp();
+	ret = 0;
+	for (a = offset; a < end; a += n) {
+		n = c.winsize - (a % c.winsize);
+		if (n > end - a)
+			n = end - a;
+		osi_mutex_lock(&c.lock);
+		while (c.head - c.tail == DIGEST_BUFS && !c.stop)
+			osi_cond_wait(&c.cond, &c.lock);
+		stop = c.stop;
+		osi_mutex_unlock(&c.lock);
+		if (stop)
+			break;
+		i = c.head % DIGEST_BUFS;
+		if (m25pxx_read(flash, c.buf[i], a, n) != 0) {
+			STDERR("cannot read flash @ 0x%x!\n", a);
+			ret = -1;
+			break;
+		}
+		c.addr[i] = a;
+		c.len[i] = n;
+		osi_mutex_lock(&c.lock);
+		c.head++;
+		osi_cond_broadcast(&c.cond);
+		osi_mutex_unlock(&c.lock);
+	}
+	osi_mutex_lock(&c.lock);
+	c.eof = true;
+	osi_cond_broadcast(&c.cond);
+	osi_mutex_unlock(&c.lock);
+	osi_thread_join(thread);
+	osi_cond_destroy(&c.cond);
+	osi_mutex_destroy(&c.lock);
+	if (ret != 0)
+		goto out;
+	if (c.stop) {
+		printf("flash differs from the image, stopped after %u windows.\n",
+		       c.nwin);
+		ret = -1;
+		goto out;
+	}
 
-	if (percent == 0)
-		printf("[");
-	else if (percent == 100)
-		printf("*"ANSI_COLOR_RESET"] %s\n", str != NULL ? str : "");
-	else if (flag == 0)
-		printf(ANSI_COLOR_GREEN"*");
-	else if (flag == 2)
-		printf(ANSI_COLOR_MAGENTA"*");
-	else if (flag == 1)
-		printf(ANSI_COLOR_YELLOW"*");
-	else
-		printf(ANSI_COLOR_RED"*");
-	fflush(stdout);
-}
+	printf("  %u of %u windows blank\n", c.nblank, c.nwin);
+	n = digest_final(&c.all, md);
+	print_digest("range  ", md, n, "");
+	n = digest_final(&c.data, md);
+	printf("data   ");
+	print_digest("", md, n, "");
+	printf("       0x%x .. 0x%x without trailing 0xFF, as -r writes it\n",
+	       offset, c.datasize > offset ? c.datasize : offset);
+	print_time("digest done", ts_start);
+	if (img != NULL)
+		printf("flash matches the image.\n");
+	if (nexp != 0) {
+		ret = memcmp(md, exp, n) == 0 ? 0 : -1;
+		printf("data digest %s the expected one.\n",
+		       ret == 0 ? "matches" : "DIFFERS from");
+	}
+out:
+	for (i = 0; i < DIGEST_BUFS; i++)
+		free(c.buf[i]);
+	free(c.ref);
+	free(c.blank);
 
-struct m25pxx_progress_t progprogress = {
-	.fct = flash_progress,
-	.arg = 0,
-};
+	return ret;
+}
 
 int main(int argc, char **argv)
 {
@@ -85,6 +1740,21 @@ int main(int argc, char **argv)
 	struct spihw_t *spihw = NULL;
 	unsigned int speed = 16000000;
 	unsigned int cs = 0;
+	unsigned int csl[M25PXX_MULTI_MAX] = { 0 };
+	unsigned int ncs = 1;
+	struct m25pxxflash_t *flashes[M25PXX_MULTI_MAX] = { };
+
+	/* gang programming */
+	char *gangsel = NULL;
+	char *daemonsock = NULL;
+	char *clientsock = NULL;
+	char ops[8] = "-";
+	int prio = 0;
+	struct gang_t gang[GANG_MAX] = { };
+	unsigned int ngang = 0;
+	struct gangctx_t gangctx = { };
+	struct image_t *img = NULL;
+	char *tok;
 
 	/* flash programming */
 	struct m25pxxflash_t *flash = NULL;
@@ -92,17 +1762,39 @@ int main(int argc, char **argv)
 
 	FILE *f;
 	char *filename = NULL;
-	size_t filesize;
+	char *tracefile = NULL;
 
 	char txtbuf[64] = { };
 	uint64_t ts_start, ts_end, t;
+	uint64_t ts_boot, ts_phase;
 	float tdisp;
 
 	uint32_t offset = 0, size = 0;
 	uint8_t *buf = NULL;
-	uint8_t *cmpbuf = NULL;
+	struct flashplan_t *plan = NULL;
+	const struct imgext_t *e;
+	const uint8_t *src;
+
+	/* compiled plans */
+	char *compilefile = NULL;
+	char *runfile = NULL;
+	char *basefile = NULL;
+	char *partsel = NULL;
+	char *digestsel = NULL;
+
+	/* checkpoint journal */
+	struct journal_t *journal = NULL;
+	const struct jrec_t *rec;
+	const struct planrange_t *r;
+	char partname[FILENAME_MAX];
+	FILE *part = NULL;
+	uint32_t a, n, done, crc;
 
 	bool detectonly = false;
+	bool tune = false;
+	bool resume = false;
+	bool verify = false;
+	bool update = false;
 	bool erase = false;
 	bool read = false;
 	bool write = false;
@@ -112,7 +1804,7 @@ int main(int argc, char **argv)
 	int argrun;
 
 	for (argrun = 1; argrun;) {
-		switch (getopt(argc, argv, ":f:i:w:r:o:s:c:dexhv")) {
+		switch (getopt(argc, argv, ":f:i:w:r:o:s:c:g:t:D:S:P:C:B:m:X:H:dTRUVexhv")) {
 		case 'o':
 			offset = strtod(optarg, &end);
 			break;
@@ -120,7 +1812,49 @@ int main(int argc, char **argv)
 			size = strtod(optarg, &end);
 			break;
 		case 'c':
-			cs = strtod(optarg, &end);
+			/* comma separated list of chipselects */
+			end = optarg;
+			for (ncs = 0; ncs < M25PXX_MULTI_MAX; ncs++) {
+				csl[ncs] = strtoul(end, &end, 0);
+				if (*end != ',') {
+					ncs++;
+					break;
+				}
+				end++;
+			}
+			if (*end != '\0') {
+				STDERR("invalid chipselect list in -c argument!\n");
+				return -1;
+			}
+			cs = csl[0];
+			break;
+		case 'g':
+			if (optarg == NULL || strlen(optarg) < 1) {
+				STDERR("invalid adapter list in -g argument!\n");
+				return -1;
+			}
+			gangsel = strdup(optarg);
+			break;
+		case 'D':
+			daemonsock = strdup(optarg);
+			break;
+		case 'S':
+			clientsock = strdup(optarg);
+			break;
+		case 'P':
+			prio = strtol(optarg, &end, 0);
+			break;
+		case 'C':
+			compilefile = strdup(optarg);
+			break;
+		case 'B':
+			basefile = strdup(optarg);
+			break;
+		case 'm':
+			partsel = strdup(optarg);
+			break;
+		case 'X':
+			runfile = strdup(optarg);
 			break;
 		case 'd':
 			detectonly = true;
@@ -144,6 +1878,33 @@ int main(int argc, char **argv)
 		case 'e':
 			erase = true;
 			break;
+		case 'T':
+			tune = true;
+			break;
+		case 'R':
+			resume = true;
+			break;
+		case 'U':
+			update = true;
+			break;
+		case 'V':
+			verify = true;
+			break;
+		case 'H':
+			if (optarg == NULL || strlen(optarg) < 1) {
+				STDERR("invalid digest in -H argument!\n");
+				return -1;
+			}
+			digestsel = strdup(optarg);
+			break;
+		case 't':
+			if (optarg == NULL || strlen(optarg) < 1) {
+				STDERR("invalid filename in -t argument!\n");
+				return -1;
+			}
+			tracefile = strdup(optarg);
+			trace_start();
+			break;
 		case 'i':
 			if (optarg == NULL || strlen(optarg) < 1) {
 				STDERR("invalid filename in -i argument!\n");
@@ -153,12 +1914,16 @@ int main(int argc, char **argv)
 				devname = strdup("USB-Blaster");
 			} else if (strcmp(optarg, "hpmusb") == 0) {
 				devname = strdup("Quad RS232-HS A");
+			} else if (strcmp(optarg, "hpmusb-b") == 0) {
+				devname = strdup("Quad RS232-HS B");
 			} else {
 				STDERR(
 				"unknown interface '%s' !\n"
 				"known interaces are:\n"
 				"altusb - Altera USB-Blaster (old PX-blaster)\n"
-				"hpmusb - FT4232 based hpm-blaster\n", optarg);
+				"hpmusb - FT4232 based hpm-blaster\n"
+				"hpmusb-b - 2nd SPI bus (channel B) of the hpm-blaster\n",
+				optarg);
 				return -1;
 			}
 			break;
@@ -173,15 +1938,47 @@ int main(int argc, char **argv)
 		case 'h':
 			printf("hpmflash version '%s', commandlist:\n"
 			       "-i <interface> select the SPI interface\n"
-			       "-c <chipsel>   number of SPI-chipselect to use\n"
+			       "-c <chipsel>   number of SPI-chipselect to use,\n"
+			       "               a list (-c 0,1,3) erases/writes all at once\n"
+			       "-g <adapters>  gang mode, comma separated list of adapter\n"
+			       "               serial numbers or LocIds, one thread each\n"
 			       "-o <offset>    offset within flash\n"
 			       "-s <size>      amount of bytes to read/write\n"
 			       "               zero size always progresses the whole chip\n"
 			       "-r <file>      reads flash into file\n"
-			       "-w <file>      writes file into flash\n"
+			       "-w <file>      writes file into flash, raw binary, ELF,\n"
+			       "               Intel HEX (.hex) or S-record (.srec/.s19)\n"
+			       "               at their addresses plus <offset>, binaries\n"
+			       "               may be gzip, zstd, xz or lz4 compressed\n"
 			       "-e             erase before write, or just erase\n"
+			       "-R             resume an interrupted read/write job\n"
+			       "               from its journal (<file>.journal)\n"
+			       "-U             update mode for -w, erases only sectors\n"
+			       "               that need it and keeps the bytes around\n"
+			       "               the image\n"
+			       "-V             verify each page inline while programming,\n"
+			       "               a differing page is programmed again\n"
+			       "-C <plan>      compile the image (-w) for a part (-m) into\n"
+			       "               a plan: erase list, pages and digests\n"
+			       "-m <part>      flash part of the plan, e.g. M25P16\n"
+			       "-B <file>      image known to be in the flash, the plan\n"
+			       "               only touches sectors that differ from it\n"
+			       "-X <plan>      run a compiled plan: erase, program, verify\n"
+			       "-H <alg>[:<digest>]\n"
+			       "               crc32c or sha256 of the flash (-o, -s) per\n"
+			       "               window and in total, compared with <digest>\n"
+			       "               or window by window with an image (-w)\n"
 			       "-f <speed>     SPI speed given in Hz\n"
 			       "-d             just detect flash and exit\n"
+			       "-T             tune the USB transport of the adapter,\n"
+			       "               the profile is stored per adapter and host\n"
+			       "-t <file>      write timeline trace (chrome trace-event json)\n"
+#ifdef __linux__
+			       "-D <socket>    daemon mode, keep the adapters (-i or -g)\n"
+			       "               open and serve jobs on a unix socket\n"
+			       "-S <socket>    hand the job over to a daemon\n"
+			       "-P <prio>      job priority within the daemon (default 0)\n"
+#endif
 			       "-v             version\n"
 			       "-x             switch debug mode on\n"
 			       , GITVERSION);
@@ -205,34 +2002,84 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (devname == NULL) {
+	if (runfile != NULL &&
+	    (read || write || erase || ncs > 1 || daemonsock != NULL ||
+	     clientsock != NULL)) {
+		STDERR("a plan (-X) runs on its own, no -w, -r, -e, chipselect list or daemon!\n");
+		return -1;
+	}
+	if (digestsel != NULL &&
+	    (read || erase || ncs > 1 || runfile != NULL ||
+	     compilefile != NULL || tune || gangsel != NULL ||
+	     daemonsock != NULL || clientsock != NULL)) {
+		STDERR("a digest (-H) only reads one chip, -w gives the expected image!\n");
+		return -1;
+	}
+	if (verify == true &&
+	    (ncs > 1 || daemonsock != NULL || clientsock != NULL)) {
+		STDERR("inline verify (-V) works on a single chipselect, not with a daemon!\n");
+		return -1;
+	}
+	if (update == true &&
+	    (write == false || read || erase || ncs > 1 || resume ||
+	     runfile != NULL || compilefile != NULL || digestsel != NULL ||
+	     gangsel != NULL || daemonsock != NULL || clientsock != NULL)) {
+		STDERR("update (-U) just takes an image (-w) for one chip!\n");
+		return -1;
+	}
+	if (compilefile != NULL) {
+		if (write == false || partsel == NULL) {
+			STDERR("compiling a plan (-C) needs an image (-w) and a part (-m)!\n");
+			return -1;
+		}
+		ret = compile_session(partsel, filename, basefile, offset, size,
+				      compilefile);
+		goto out;
+	}
+
+	if (clientsock != NULL) {
+#ifdef __linux__
+		i = 0;
+		if (detectonly)
+			ops[i++] = 'd';
+		if (erase)
+			ops[i++] = 'e';
+		if (write)
+			ops[i++] = 'w';
+		if (read)
+			ops[i++] = 'r';
+		ret = daemon_client(clientsock, prio,
+				    gangsel != NULL ? gangsel : "*",
+				    ops, cs, offset, size, filename);
+#else
+		STDERR("no daemon support on this platform!\n");
+		ret = -1;
+#endif
+		goto out;
+	}
+
+	if (devname == NULL && gangsel == NULL) {
 		STDERR("provide at least -i <interface> argument!\n");
 		return -1;
 	}
+	if (gangsel != NULL && (read == true || ncs > 1)) {
+		STDERR("gang mode neither reads nor takes a chipselect list!\n");
+		return -1;
+	}
 
 	/* create FTDI instance */
+	ts_boot = GetTimeStamp();
+	ts_phase = ts_boot;
 	ftdifunc = ftdi_create();
 	if (ftdifunc == NULL) {
 		fprintf(stderr, "ftdi_create() failed!\n");
 		return -1;
 	}
+	print_phase(debug, "library load", &ts_phase);
 
-	/* add the altera usb-blaster to ftdi device list */
-#ifndef __MINGW32__
-	rc = ftdifunc->set_vidpid(0x09fb, 0x6001);
-	if (rc != FT_OK) {
-		printf("cannot add 0x09fb:6001 to ftdi devs!\n");
-		ret = -1;
-		goto out;
-	}
-#endif
 	/* check for available FTDI devices */
-	rc = ftdifunc->createdevlist(&numdevs);
-	if (rc != FT_OK) {
-		fprintf(stderr, "cannot create ftdi devlist!\n");
-		ret = -1;
-		goto out;
-	}
+	devinfo_base = ftdi_devlist(ftdifunc, &numdevs, false);
+	print_phase(debug, "enumeration", &ts_phase);
 	if (numdevs == 0) {
 		fprintf(stderr, "no FTDI devices available!\n");
 		ret = -1;
@@ -244,8 +2091,6 @@ int main(int argc, char **argv)
 		goto out;
 	}
 
-	devinfo_base = calloc(numdevs, sizeof(*devinfo));
-	ftdifunc->get_devinfo(devinfo_base, &numdevs);
 	devinfo = devinfo_base;
 
 	for (i = 0; i < numdevs; i++) {
@@ -266,16 +2111,120 @@ int main(int argc, char **argv)
 			printf("LocID         : %x\n", devinfo->LocId);
 		}
 
-		if (strcmp(devinfo->Description, devname) == 0) {
+		if (devname != NULL &&
+		    strcmp(devinfo->Description, devname) == 0) {
 			devidx = i;
 			break;
 		}
 		devinfo++;
 	}
-	free(devinfo_base);
 	if (debug == true)
 		printf("-----------------------------------------------\n");
 
+	/* a daemon on just one interface (-i) */
+	if (daemonsock != NULL && gangsel == NULL && devidx != -1) {
+		gang[0].devidx = devidx;
+		gang[0].altusb = strcmp(devname, "USB-Blaster") == 0;
+		strncpy(gang[0].serial, devinfo->SerialNumber,
+			sizeof(gang[0].serial) - 1);
+		ngang = 1;
+	}
+
+	if (gangsel != NULL) {
+		for (tok = strtok(gangsel, ","); tok != NULL;
+		     tok = strtok(NULL, ",")) {
+			if (ngang == GANG_MAX) {
+				STDERR("more than %d adapters in gang!\n",
+				       GANG_MAX);
+				ret = -1;
+				break;
+			}
+			devinfo = devinfo_base;
+			for (i = 0; i < numdevs; i++, devinfo++) {
+				if (strcmp(devinfo->SerialNumber, tok) == 0)
+					break;
+				if (devinfo->LocId == strtoul(tok, &end, 0) &&
+				    *end == '\0')
+					break;
+			}
+			if (i == numdevs) {
+				STDERR("adapter '%s' not in FTDI devicelist!\n",
+				       tok);
+				ret = -1;
+				break;
+			}
+			if (strcmp(devinfo->Description, "USB-Blaster") == 0) {
+				gang[ngang].altusb = true;
+			} else if (strcmp(devinfo->Description,
+					  "Quad RS232-HS A") != 0 &&
+				   strcmp(devinfo->Description,
+					  "Quad RS232-HS B") != 0) {
+				STDERR("adapter '%s' is a '%s', no SPI interface!\n",
+				       tok, devinfo->Description);
+				ret = -1;
+				break;
+			}
+			gang[ngang].devidx = i;
+			strncpy(gang[ngang].serial, devinfo->SerialNumber,
+				sizeof(gang[ngang].serial) - 1);
+			ngang++;
+		}
+	}
+	if (ret != 0)
+		goto out;
+
+	if (daemonsock != NULL) {
+#ifdef __linux__
+		ret = ngang != 0 ? daemon_serve(daemonsock, gang, ngang,
+						speed) : -1;
+#else
+		STDERR("no daemon support on this platform!\n");
+		ret = -1;
+#endif
+		goto out;
+	}
+
+	/* a compressed image decodes while the adapter comes up */
+	if (write == true) {
+		img = image_load(filename, offset, size);
+		if (img == NULL) {
+			ret = -1;
+			goto out;
+		}
+	}
+	if (runfile != NULL) {
+		plan = plan_load(runfile);
+		if (plan == NULL) {
+			ret = -1;
+			goto out;
+		}
+	}
+
+	if (gangsel != NULL) {
+		if (img != NULL && image_ready(img, filename) != 0) {
+			ret = -1;
+			goto out;
+		}
+		/* the session owns and frees the plan */
+		if (plan != NULL) {
+			gangctx.plan = plan;
+			erase = true;
+			write = true;
+			plan = NULL;
+		}
+		gangctx.img = img;
+		gangctx.offset = offset;
+		gangctx.size = size;
+		gangctx.speed = speed;
+		gangctx.cs = cs;
+		gangctx.verify = verify ? VERIFY_RETRIES : 0;
+		gangctx.detectonly = detectonly;
+		gangctx.erase = erase;
+		gangctx.write = write;
+		ret = gang_session(gang, ngang, &gangctx);
+		goto out;
+	}
+
 	if (devidx == -1) {
 		STDERR(
 		       "interface '%s' not in FTDI devicelist, not present? permissions?\n",
@@ -287,7 +2236,8 @@ int main(int argc, char **argv)
 	/* create the spi interface */
 	if (strcmp(devname, "USB-Blaster") == 0) {
 		spihw = altusb_create(devidx);
-	} else if (strcmp(devname, "Quad RS232-HS A") == 0) {
+	} else if (strcmp(devname, "Quad RS232-HS A") == 0 ||
+		   strcmp(devname, "Quad RS232-HS B") == 0) {
 		spihw = hpmusb_create(devidx);
 	} else {
 		STDERR("invalid devicename '%s' !\n", devname);
@@ -298,68 +2248,109 @@ int main(int argc, char **argv)
 		fprintf(stderr, "cannot create spi hardware instance!\n");
 		return -1;
 	}
+	print_phase(debug, "adapter open", &ts_phase);
 
-	/* create the flash handler instance */
-	flash = m25pxxflash_create(spihw);
-	if (flash == NULL) {
-		fprintf(stderr, "cannot create M25Pxx flash instance!\n");
-
-		return -1;
+	/* create the flash handler instances, one per chipselect */
+	for (i = 0; i < ncs; i++) {
+		flashes[i] = m25pxxflash_create(spihw);
+		if (flashes[i] == NULL) {
+			STDERR("cannot create M25Pxx flash instance!\n");
+			ret = -1;
+			goto out;
+		}
 	}
+	flash = flashes[0];
 
 	/* flash handling */
 	spihw->ops->claim(spihw);
 	spihw->ops->set_speed_mode(spihw, speed, 1);
+	print_phase(debug, "claim", &ts_phase);
 
-	rc = -1;
-	i = 0;
-	printf("try with setting nCE low / TMS high.\n");
-	while (rc != 0 && i < 4) {
-		rc = m25pxx_detect(flash, cs);
-		if (rc == 0) {
-			chip = flash->flash_detected;
-			printf("-----------------------------------------------\n");
-			printf("----- M25Pxx detect ok (%-16s) -----\n",
-			       flash->flash_detected->name);
-			m25pxx_printflash(flash->flash_detected);
-
-			m25pxx_rdsr(flash, txtbuf);
-			printf("chip-status           : 0x%02x\n", txtbuf[0]);
-			printf("-----------------------------------------------\n");
-			if (detectonly == true)
-				goto out;
-		} else if (i == 0) {
-			printf("retry with setting nCE low / TMS low.\n");
-			spihw->ops->set_clr_tms(spihw, false);
-		} else if (i == 1) {
-			printf("retry with setting nCE high / TMS low.\n");
-			spihw->ops->set_clr_nce(spihw, true);
-		} else if (i == 2) {
-			printf("retry with setting nCE high / TMS high.\n");
-			spihw->ops->set_clr_tms(spihw, true);
-		}
-		i++;
-	}
+	TRACE_BEGIN("detect");
+	rc = flash_detect(spihw, flashes, csl, ncs, devinfo->SerialNumber,
+			  true);
+	TRACE_END("detect");
+	print_phase(debug, "detect", &ts_phase);
+	if (debug == true)
+		print_time("startup total", ts_boot);
 	if (rc != 0) {
-		printf("M25Pxx detect @ CS %d failed.\n", cs);
 		ret = -1;
 		goto out;
 	}
+	chip = flash->flash_detected;
+	flash->verify = verify ? VERIFY_RETRIES : 0;
+	printf("-----------------------------------------------\n");
+	printf("----- M25Pxx detect ok (%-16s) -----\n", chip->name);
+	m25pxx_printflash(chip);
 
-	/* create inout buffer */
-	buf = calloc(1, chip->size);
-	cmpbuf = calloc(1, chip->sectorsize);
+	m25pxx_rdsr(flash, txtbuf);
+	printf("chip-status           : 0x%02x\n", txtbuf[0]);
+	printf("-----------------------------------------------\n");
+	if (detectonly == true && ncs == 1)
+		goto out;
 
-	if (buf == NULL) {
-		printf("no mem for creating flash buffer.\n");
+	if (plan != NULL) {
+		ret = plan_session(flash, plan);
+		goto out;
+	}
+
+	if (img != NULL && image_ready(img, filename) != 0) {
+		ret = -1;
+		goto out;
+	}
+
+	if (digestsel != NULL) {
+		ret = digest_session(flash, digestsel, img, offset, size);
+		goto out;
+	}
+
+	if (tune == true) {
+		ret = tune_session(spihw, flash, devinfo->SerialNumber);
+		goto out;
+	}
+
+	if (ncs > 1) {
+		if (read == true) {
+			STDERR("reading is only possible from one chipselect!\n");
+			ret = -1;
+			goto out;
+		}
+		ret = multi_session(spihw, flashes, csl, ncs, detectonly,
+				    erase, write, img, offset, size);
 		goto out;
 	}
 
-	if (cmpbuf == NULL) {
-		printf("no mem for creating compare buffer.\n");
+	if (write == true) {
+		n = img->payload;
+		image_clip(img, 0, chip->size);
+		if (img->payload != n)
+			printf("WARN: image data beyond chip size (0x%x) is ignored!\n",
+			       chip->size);
+		if (img->next == 0) {
+			STDERR("no image data within the chip!\n");
+			ret = -1;
+			goto out;
+		}
+	}
+
+	if (update == true) {
+		ret = update_session(flash, img);
 		goto out;
 	}
 
+	if (filename != NULL) {
+		snprintf(txtbuf, sizeof(txtbuf), "%s%s%s", read ? "r" : "",
+			 erase ? "e" : "", write ? "w" : "");
+		journal = job_journal(flash, devinfo->SerialNumber, cs,
+				      filename, txtbuf, offset, size, img,
+				      resume);
+		if (journal == NULL ||
+		    (resume && journal_verify(flash, journal) != 0)) {
+			ret = -1;
+			goto out;
+		}
+	}
+
 	if (read == true) {
 		if (size == 0) {
 			printf("WARN: no size given, assuming whole chip.\n");
@@ -374,15 +2365,45 @@ int main(int argc, char **argv)
 		printf("> read flash from offset 0x%x with size 0x%x ...\n",
 		       offset, size);
 
-		/* read flash */
-		memset(buf, 0xFF, chip->size);
-		ts_start = GetTimeStamp();
-		rc = m25pxx_read(flash, buf, offset, size);
-		if (rc != 0) {
-			STDERR("read failed!\n");
+		/* read flash, extents done are kept in '<file>.part' */
+		buf = malloc(size);
+		if (buf == NULL) {
+			STDERR("no mem for creating flash buffer.\n");
+			ret = -1;
+			goto out;
+		}
+		snprintf(partname, sizeof(partname), "%s.part", filename);
+		part = fopen(partname, resume ? "r+b" : "w+b");
+		if (part == NULL) {
+			STDERR("cannot open %s!\n", partname);
 			ret = -1;
 			goto out;
 		}
+		ts_start = GetTimeStamp();
+		for (a = offset; a < offset + size; a += n) {
+			n = job_extent(a, offset + size);
+			rec = journal_find(journal, JOURNAL_READ, a);
+			if (rec != NULL && rec->size == n &&
+			    fseek(part, a - offset, SEEK_SET) == 0 &&
+			    fread(&buf[a - offset], 1, n, part) == n &&
+			    crc32c(0, &buf[a - offset], n) == rec->crc)
+				continue;
+			rc = m25pxx_read(flash, &buf[a - offset], a, n);
+			if (rc != 0) {
+				STDERR("read failed!\n");
+				ret = -1;
+				goto out;
+			}
+			if (fseek(part, a - offset, SEEK_SET) != 0 ||
+			    fwrite(&buf[a - offset], 1, n, part) != n ||
+			    osi_fsync(part) != 0 ||
+			    journal_add(journal, JOURNAL_READ, a, n,
+					crc32c(0, &buf[a - offset], n)) != 0) {
+				STDERR("cannot checkpoint read @ 0x%x!\n", a);
+				ret = -1;
+				goto out;
+			}
+		}
 		ts_end = GetTimeStamp();
 		t = ts_end - ts_start;
 		tdisp = t / 1000.0f;
@@ -417,77 +2438,51 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (erase == true) {
-		uint32_t eraseoffset = 0, erasesize = 0, erasesize_nonblank;
-		unsigned int sectors = 0;
-		bool havefile = false;
-		uint8_t *filebuf = NULL;
+	/* the plan also tells the program loop which pages hold data */
+	if (write == true) {
+		plan = plan_create(chip, img);
+		if (plan == NULL) {
+			ret = -1;
+			goto out;
+		}
+	}
 
-		if (write == true) {
-			f = fopen(filename, "rb");
-			if (f == NULL) {
-				STDERR("cannot open %s for read!\n", filename);
-				ret = -1;
-				goto out;
-			}
-			filesize = fread(buf, 1, chip->size, f);
-			havefile = true;
-			fclose(f);
-			if (size == 0) {
+	if (erase == true) {
+		if (write == false && size == 0) {
+			printf("WARN: zero size given, assuming chiperase.\n");
+			plan = plan_create_erase(chip, 0, 0);
+			if (plan != NULL)
+				plan->chiperase = true;
+		} else if (write == false) {
+			if ((offset + size) > chip->size)
 				printf(
-				       "WARN: zero size given, assuming filesize.\n");
-				erasesize = filesize;
-			} else {
-				erasesize = size;
-				filesize = size;
-			}
-		} else {
-			erasesize = size;
+				       "WARN: offset (0x%x) + size (0x%x) exceeds chip size (0x%x)!\n",
+				       offset, size, chip->size);
+			plan = plan_create_erase(chip, offset, size);
 		}
-		eraseoffset = offset - (offset % chip->sectorsize);
-		if ((eraseoffset + erasesize) > chip->size) {
-			printf(
-			       "WARN: offset (0x%x) + size (0x%x) exceeds chip size (0x%x)!\n",
-			       eraseoffset, erasesize, chip->size);
-			erasesize = chip->size - eraseoffset;
-		}
-		printf("-> erase from offset 0x%x with size %d ...\n",
-				eraseoffset, erasesize);
-
-		erasesize_nonblank = erasesize;
-		if (havefile) {
-			memset(cmpbuf, 0xFF, chip->sectorsize);
-			filebuf = buf;
-			do {
-				if (memcmp(filebuf, cmpbuf,
-					   chip->sectorsize) == 0) {
-					erasesize_nonblank -= chip->sectorsize;
-				}
-				filebuf += chip->sectorsize;
-				if (filesize > chip->sectorsize)
-					filesize -= chip->sectorsize;
-				else
-					filesize = 0;
-			} while (filesize > 0);
+		if (plan == NULL) {
+			ret = -1;
+			goto out;
 		}
-
-		sectors = erasesize_nonblank / chip->sectorsize;
-		if (eraseoffset < chip->sectorsize &&
-		    (chip->sectortime * sectors) > chip->bulktime) {
+		if (plan->chiperase && (write == true || size != 0))
 			printf(
 			       "using bulk erase instead erasing %d sectors ...\n",
-				sectors);
-			erasesize = 0;
-		}
-		if (erasesize == 0) {
-			printf("WARN: zero size given, assuming chiperase.\n");
+			       plan->nsectors);
+		if (plan->chiperase) {
 			printf("> starting chip erase ...\n");
 			ts_start = GetTimeStamp();
-			rc = m25pxx_chiperase(flash, &progprogress);
-			if (rc != 0) {
-				STDERR("chip erase failed!\n");
-				ret = -1;
-				goto out;
+			rec = journal_find(journal, JOURNAL_ERASE, 0);
+			if (rec != NULL && rec->size == chip->size) {
+				printf("chip erase already done.\n");
+			} else {
+				rc = m25pxx_chiperase(flash, &progprogress);
+				if (rc != 0 ||
+				    journal_add(journal, JOURNAL_ERASE, 0,
+						chip->size, 0) != 0) {
+					STDERR("chip erase failed!\n");
+					ret = -1;
+					goto out;
+				}
 			}
 			ts_end = GetTimeStamp();
 			t = ts_end - ts_start;
@@ -497,23 +2492,21 @@ int main(int argc, char **argv)
 			       tdisp > 1000.0 ? "s" : "ms");
 
 		} else {
+			printf("-> erase %d sectors from offset 0x%x ...\n",
+			       plan->nsectors, plan->nsectors ?
+			       plan->sectors[0].addr : 0);
 			ts_start = GetTimeStamp();
-			memset(cmpbuf, 0xFF, chip->sectorsize);
-			filebuf = buf;
-
-			while (erasesize > 0) {
-				sprintf(txtbuf, "0x%x", eraseoffset);
+			for (i = 0; i < plan->nsectors; i++) {
+				a = plan->sectors[i].addr;
+				sprintf(txtbuf, "0x%x", a);
 				progprogress.arg = txtbuf;
 
-				/* check if image has != 0xFF for this sector */
-				if (havefile &&
-				    memcmp(filebuf, cmpbuf,
-					   chip->sectorsize) == 0) {
+				rec = journal_find(journal, JOURNAL_ERASE, a);
+				if (rec != NULL) {
 					unsigned int cnt = 99;
 
-					sprintf(txtbuf,
-						"0x%x (skipped, blank)",
-						eraseoffset);
+					sprintf(txtbuf, "0x%x (skipped, done)",
+						a);
 					progprogress.fct(txtbuf, 0, 0);
 					do {
 						progprogress.fct(txtbuf,
@@ -522,22 +2515,41 @@ int main(int argc, char **argv)
 					} while (cnt-- > 1);
 					progprogress.fct(txtbuf, 100, 0);
 				} else {
-					rc = m25pxx_sectorerase(flash,
-								eraseoffset,
+					rc = m25pxx_sectorerase(flash, a,
 								&progprogress);
 					progprogress.arg = NULL;
+					if (rc == 0)
+						rc = journal_add(journal,
+							JOURNAL_ERASE, a,
+							chip->sectorsize, 0);
 					if (rc != 0) {
 						STDERR("sector erase failed!\n");
 						ret = -1;
 						goto out;
 					}
 				}
-				eraseoffset += chip->sectorsize;
-				filebuf += chip->sectorsize;
-				if (erasesize > chip->sectorsize)
-					erasesize -= chip->sectorsize;
-				else
-					erasesize = 0;
+			}
+			progprogress.arg = NULL;
+			/* a resumed job mustn't blank pages programmed since */
+			for (i = 0; i < plan->nedges; i++) {
+				r = &plan->edges[i];
+				rec = journal_find(journal, JOURNAL_ERASE,
+						   r->addr);
+				printf("-> blank 0x%x .. 0x%x%s\n", r->addr,
+				       r->addr + r->size,
+				       rec != NULL ? " (skipped, done)" : "");
+				if (rec != NULL)
+					continue;
+				rc = plan_blank_edge(flash, r);
+				if (rc == 0)
+					rc = journal_add(journal,
+						JOURNAL_ERASE, r->addr,
+						r->size, 0);
+				if (rc != 0) {
+					STDERR("partial erase failed!\n");
+					ret = -1;
+					goto out;
+				}
 			}
 			ts_end = GetTimeStamp();
 			t = ts_end - ts_start;
@@ -550,83 +2562,116 @@ int main(int argc, char **argv)
 	}
 
 	if (write == true) {
-		f = fopen(filename, "rb");
-		if (f == NULL) {
-			STDERR("cannot open %s for read!\n", filename);
-			ret = -1;
-			goto out;
-		}
-		filesize = fread(buf, 1, chip->size, f);
-		fclose(f);
-
-		if (filesize == 0) {
-			STDERR("cannot program empty file!\n");
-			ret = -1;
-			goto out;
-		}
-
-		printf("%s contains %ld bytes.\n", filename, filesize);
-		if (size > filesize) {
-			printf("WARN: size (%d) is larger than file (%ld)!\n",
-			       size, filesize);
-			size = filesize;
-		} else if (size == 0) {
-			printf("WARN: zero size given, assuming filesize.\n");
-			size = filesize;
-		}
-		if ((offset + size) > chip->size) {
-			printf(
-			       "WARN: offset (0x%x) + size (0x%x) exceeds chip size (0x%x)!\n",
-			       offset, size, chip->size);
-			size = chip->size - offset;
-		}
-
-		printf("programming %d bytes to offset 0x%x\n", size, offset);
+		printf("programming %d bytes in %d extents\n", img->payload,
+		       img->next);
 
 		progprogress.arg = NULL;
 		ts_start = GetTimeStamp();
-		rc = m25pxx_program(flash, buf, offset, size, &progprogress);
-		ts_end = GetTimeStamp();
-		if (rc != 0) {
-			STDERR("flash write failed!\n");
-			ret = -1;
-			goto out;
+		progprogress.fct(progprogress.arg, 0, 0);
+		done = 0;
+		i = 0;
+		for (e = img->ext; e < &img->ext[img->next]; e++) {
+			for (a = e->addr; a < e->addr + e->size; a += n) {
+				n = job_extent(a, e->addr + e->size);
+				src = &e->data[a - e->addr];
+				crc = crc32c(0, src, n);
+				rec = journal_find(journal, JOURNAL_PROGRAM,
+						   a);
+				if (rec == NULL || rec->size != n ||
+				    rec->crc != crc) {
+					rc = plan_program_range(flash, plan,
+								a, n, NULL);
+					if (rc == 0)
+						rc = journal_add(journal,
+							JOURNAL_PROGRAM, a, n,
+							crc);
+					if (rc != 0) {
+						STDERR("flash write failed!\n");
+						ret = -1;
+						goto out;
+					}
+				}
+				done += n;
+				t = (uint64_t)done * 100 / img->payload;
+				if (t != i && t != 100) {
+					i = t;
+					progprogress.fct(progprogress.arg, i,
+							 0);
+				}
+			}
 		}
+		progprogress.fct(progprogress.arg, 100, 0);
+		ts_end = GetTimeStamp();
 		t = ts_end - ts_start;
 		tdisp = t / 1000.0f;
 
 		printf("flash program done: %.2f %s\n",
 		       tdisp > 1000.0 ? tdisp / 1000.0 : tdisp,
 		       tdisp > 1000.0 ? "s" : "ms");
+		print_verify(flash);
 	}
 
 out:
+	if (part != NULL) {
+		fclose(part);
+		if (ret == 0)
+			remove(partname);
+	}
+	if (journal != NULL && ret != 0)
+		printf("job state kept in %s, -R continues it.\n",
+		       journal->path);
+	journal_close(journal, ret == 0);
+
 	if (filename != NULL)
 		free(filename);
 
 	if (buf != NULL)
 		free(buf);
 
-	if (cmpbuf != NULL)
-		free(cmpbuf);
+	plan_destroy(plan);
 
-	if (flash != NULL)
-		m25pxxflash_destroy(flash);
+	for (i = 0; i < ncs; i++) {
+		if (flashes[i] != NULL)
+			m25pxxflash_destroy(flashes[i]);
+	}
 
 	if (spihw != NULL) {
 		spihw->ops->release(spihw);
+		print_linkstat(devinfo->SerialNumber, &spihw->stat);
 
 		if (strcmp(devname, "USB-Blaster") == 0)
 			altusb_destroy(spihw);
-		else if (strcmp(devname, "Quad RS232-HS A") == 0)
+		else
 			hpmusb_destroy(spihw);
 	}
 
 	if (devname != NULL)
 		free(devname);
 
+	if (gangsel != NULL)
+		free(gangsel);
+
+	if (daemonsock != NULL)
+		free(daemonsock);
+
+	if (clientsock != NULL)
+		free(clientsock);
+
+	free(compilefile);
+	free(runfile);
+	free(basefile);
+	free(partsel);
+	free(digestsel);
+
+	image_destroy(img);
+
 	if (ftdifunc != NULL)
 		ftdi_destroy(ftdifunc);
 
+	if (tracefile != NULL) {
+		trace_dump(tracefile);
+		free(tracefile);
+	}
+
 	return ret;
 }
@@ -11,6 +11,7 @@
 #include <string.h>
 
 #include <spihw.h>
+#include <libblank.h>
 #include "libM25Pxx_flash.h"
 #include "osi.h"
 
@@ -311,88 +312,102 @@ static struct flashparam_t *m25pxx_search(struct flashparam_t *ptab,
 	return NULL;
 }
 
+/* part of the flash table by its name, for work without a detected chip */
+struct flashparam_t DLLEXPORT *m25pxx_find(const char *name)
+{
+	const struct flashparam_t *ptab;
+
+	for (ptab = fltab; ptab->type != 0xFF; ptab++) {
+		if (strcmp(ptab->name, name) == 0)
+			return (struct flashparam_t *)ptab;
+	}
+
+	return NULL;
+}
+
+/*
+ * ID probes: 'READID' (0x9F), 'read-signature' (0xAB) and the spansion
+ * 'read_id' (0x90). All of them are sent at once, each answer in place.
+ */
+void DLLEXPORT m25pxx_probe_prepare(struct m25pxx_probe_t *probe,
+				    unsigned int cs, struct spixfer_t *xfer)
+{
+	static const uint8_t cmd[M25PXX_PROBE_XFERS] = { 0x9F, 0xAB, 0x90 };
+	static const uint8_t len[M25PXX_PROBE_XFERS] = { 4, 8, 4 };
+	unsigned int i;
+
+	memset(probe, 0, sizeof(*probe));
+	probe->cs = cs;
+	for (i = 0; i < M25PXX_PROBE_XFERS; i++) {
+		probe->buf[i][0] = cmd[i];
+		xfer[i] = (struct spixfer_t) { cs, probe->buf[i],
+					       probe->buf[i], len[i] };
+	}
+}
+
+struct flashparam_t DLLEXPORT *m25pxx_probe_decode(struct m25pxxflash_t *inst,
+						   struct m25pxx_probe_t *probe)
+{
+	struct flashparam_t *chip = NULL;
+	uint8_t *id = probe->buf[0];
+	uint8_t *res = probe->buf[1];
+	uint8_t *rems = probe->buf[2];
+
+	if (id[2] != 0xFF && id[3] != 0xFF)
+		chip = m25pxx_search(inst->flash_db, id[2], id[3], 0xFF);
+	if (chip == NULL && res[4] != 0xFF)
+		chip = m25pxx_search(inst->flash_db, 0xFF, 0xFF, res[4]);
+	if (chip == NULL && rems[2] != 0xFF && rems[3] != 0xFF)
+		chip = m25pxx_search(inst->flash_db, rems[2], rems[3], 0xFF);
+
+	return chip;
+}
+
+/* bind a detected 'chip' on 'cs' to the instance */
+int DLLEXPORT m25pxx_attach(struct m25pxxflash_t *inst,
+			    struct flashparam_t *chip, uint8_t cs)
+{
+	inst->flash_detected = chip;
+	inst->cs = cs;
+
+	return 0;
+}
+
 int DLLEXPORT m25pxx_detect(struct m25pxxflash_t *inst, uint8_t cs)
 {
-	struct spiops_t *spi = inst->spi->ops;
+	struct spixfer_t xfer[M25PXX_PROBE_XFERS];
+	struct m25pxx_probe_t probe;
+	struct flashparam_t *chip;
 	int rc;
-	uint8_t xbuf[32] = { 0 };
 
 	if (inst == NULL)
 		return -1;
 
-	/* try 'READID' command */
-	xbuf[0] = 0x9F;
-	rc = spi->trx(inst->spi, cs, xbuf, xbuf, 4);
+	/* forget the flash of an earlier detect, the board may be swapped */
+	inst->flash_detected = NULL;
+
+	m25pxx_probe_prepare(&probe, cs, xfer);
+	rc = inst->spi->ops->trx_batch(inst->spi, xfer, M25PXX_PROBE_XFERS);
 	if (rc != 0) {
 		fprintf(stderr, "%s: spi trx failed!\n", __func__);
 		return -1;
 	}
 
-	if (xbuf[2] != 0xFF && xbuf[3] != 0xFF)
-		inst->flash_detected = m25pxx_search(inst->flash_db,
-						     xbuf[2], xbuf[3], 0xFF);
-
-	/* not found, try 'read-signature' command */
-	if (inst->flash_detected == NULL)  {
-		xbuf[0] = 0xAB;
-		rc = spi->trx(inst->spi, cs, xbuf, xbuf, 8);
-		if (rc != 0) {
-			fprintf(stderr, "%s: spi trx failed!\n", __func__);
-			return -1;
-		}
-
-		if (xbuf[4] != 0xFF)
-			inst->flash_detected = m25pxx_search(inst->flash_db,
-							     0xFF,
-							     0xFF,
-							     xbuf[4]);
-	}
-	/* still not found, try 'read_id' (spansion) command */
-	if (inst->flash_detected == NULL)  {
-		xbuf[0] = 0x90;
-		rc = spi->trx(inst->spi, cs, xbuf, xbuf, 4);
-		if (rc != 0) {
-			fprintf(stderr, "%s:spi trx failed!\n", __func__);
-			return -1;
-		}
-
-		if (xbuf[2] != 0xFF && xbuf[3] != 0xFF)
-			inst->flash_detected = m25pxx_search(inst->flash_db,
-							     xbuf[2],
-							     xbuf[3],
-							     0xFF);
-	}
-
-	if (inst->flash_detected == NULL) {
+	chip = m25pxx_probe_decode(inst, &probe);
+	if (chip == NULL) {
 		printf("typ: 0x%02x, cap: 0x%02x, sig: 0x%02x\n",
-		       xbuf[2], xbuf[3], xbuf[4]);
+		       probe.buf[2][2], probe.buf[2][3], probe.buf[1][4]);
 		return -1;
 	}
 
-	if ((inst->flash_detected->size + 0x10) != inst->xbufsize) {
-		inst->xbufsize = 0;
-		if (inst->xbuf)
-			free(inst->xbuf);
-
-		inst->xbuf = calloc(inst->flash_detected->size + 0x10, 1);
-		if (inst->xbuf == NULL) {
-			fprintf(stderr,
-				"%s: no mem for xbuf!\n",
-				__func__);
-
-			return -1;
-		}
-		inst->xbufsize = inst->flash_detected->size + 0x10;
-	}
-	inst->cs = cs;
-
-	return 0;
+	return m25pxx_attach(inst, chip, cs);
 }
 
 int DLLEXPORT m25pxx_read(struct m25pxxflash_t *inst,
 			  void *dst, uint32_t addr, size_t size)
 {
 	struct spiops_t *spi = inst->spi->ops;
+	struct spiseg_t seg[2];
 	int rc;
 
 	if (inst == NULL)
@@ -419,15 +434,16 @@ int DLLEXPORT m25pxx_read(struct m25pxxflash_t *inst,
 	inst->xbuf[2] = (addr & 0x0000FF00) >> 8;
 	inst->xbuf[3] = (addr & 0x000000FF) >> 0;
 
-	rc = spi->trx(inst->spi, inst->cs, inst->xbuf, inst->xbuf, size + 4);
+	/* answer to the command is of no use, data goes straight to 'dst' */
+	seg[0] = (struct spiseg_t) { inst->xbuf, NULL, 4 };
+	seg[1] = (struct spiseg_t) { NULL, dst, size };
+	rc = spi->trxv(inst->spi, inst->cs, seg, 2);
 	if (rc != 0) {
 		fprintf(stderr,
 			"%s: spi trx returned error (%d)!\n", __func__, rc);
 		return -1;
 	}
 
-	memcpy(dst, inst->xbuf + 4, size);
-
 	return 0;
 }
 
@@ -463,7 +479,7 @@ int DLLEXPORT m25pxx_wdsr(struct m25pxxflash_t *inst, uint8_t reg)
 	if (inst == NULL)
 		return -1;
 
-	rc = spi->trx(inst->spi, inst->cs, xbuf, xbuf, 2);
+	rc = spi->trx(inst->spi, inst->cs, xbuf, NULL, 2);
 	if (rc != 0) {
 		fprintf(stderr, "%s: cannot write status register!\n",
 			__func__);
@@ -473,10 +489,69 @@ int DLLEXPORT m25pxx_wdsr(struct m25pxxflash_t *inst, uint8_t reg)
 	return 0;
 }
 
+/* READ of a span into vbuf, shifted out and read back in place */
+static void m25pxx_vread(struct m25pxxflash_t *inst,
+			 const struct m25pxx_vpend_t *pend,
+			 struct spixfer_t *xfer)
+{
+	uint32_t addr = pend->addr;
+
+	memset(inst->vbuf, 0, sizeof(inst->vbuf));
+	inst->vbuf[0] = 0x03;
+	inst->vbuf[1] = (addr & 0x00FF0000) >> 16;
+	inst->vbuf[2] = (addr & 0x0000FF00) >> 8;
+	inst->vbuf[3] = (addr & 0x000000FF) >> 0;
+	*xfer = (struct spixfer_t) { inst->cs, inst->vbuf, inst->vbuf,
+				     4 + pend->size };
+}
+
+/* waits until a command the chip may have taken is done, bulk erase at most */
+static int m25pxx_idle(struct m25pxxflash_t *inst)
+{
+	struct flashparam_t *chip = inst->flash_detected;
+	unsigned int cnt = chip->bulktime_max / (chip->pagetime / 8) + 1;
+	uint8_t status;
+
+	do {
+		if (m25pxx_rdsr(inst, &status) != 0)
+			return -1;
+		if ((status & 0x1) == 0)
+			return 0;
+		_usleep(chip->pagetime / 8);
+	} while (--cnt > 0);
+	fprintf(stderr, "%s: flash stays busy!\n", __func__);
+
+	return -1;
+}
+
+/*
+ * a batch with WREN and a write enable gated command (PP, SE, BE). The
+ * backend doesn't repeat a failed gated shift, it can't tell whether it
+ * ran, see spihw_wrgated(). Once the chip is idle the whole batch goes
+ * again, a page programmed twice with the same data stays the same. A
+ * READ of 'pend' in front was read back in place and is set up again.
+ */
+static int m25pxx_wrbatch(struct m25pxxflash_t *inst, struct spixfer_t *xfer,
+			  unsigned int cnt, const struct m25pxx_vpend_t *pend)
+{
+	struct spiops_t *spi = inst->spi->ops;
+	unsigned int retry;
+
+	for (retry = 0; ; retry++) {
+		if (spi->trx_batch(inst->spi, xfer, cnt) == 0)
+			return 0;
+		if (retry == SPIHW_RETRIES || m25pxx_idle(inst) != 0)
+			return -1;
+		inst->spi->stat.retries++;
+		if (pend != NULL)
+			m25pxx_vread(inst, pend, &xfer[0]);
+	}
+}
+
 int DLLEXPORT m25pxx_chiperase(struct m25pxxflash_t *inst,
 			       struct m25pxx_progress_t *progress)
 {
-	struct spiops_t *spi = inst->spi->ops;
+	struct spixfer_t xfer[2];
 	uint8_t xbuf[4] = { 0 };
 	unsigned int cnt = 0, cntx;
 	unsigned int percent, percentx;
@@ -491,31 +566,33 @@ int DLLEXPORT m25pxx_chiperase(struct m25pxxflash_t *inst,
 		return -1;
 	}
 
+	TRACE_BEGIN("chip erase");
 	if (progress)
 		progress->fct(progress->arg, 0, 0);
 
 	xbuf[0] = 0x06;	/* write enable */
-	rc = spi->trx(inst->spi, inst->cs, xbuf, xbuf, 1);
-	if (rc != 0) {
-		fprintf(stderr, "%s: cannot set write enable!\n", __func__);
-		return -1;
-	}
-
-	xbuf[0] = 0xC7;	/* bulk erase */
-	rc = spi->trx(inst->spi, inst->cs, xbuf, xbuf, 1);
+	xbuf[1] = 0xC7;	/* bulk erase */
+	xfer[0] = (struct spixfer_t) { inst->cs, &xbuf[0], NULL, 1 };
+	xfer[1] = (struct spixfer_t) { inst->cs, &xbuf[1], NULL, 1 };
+	rc = m25pxx_wrbatch(inst, xfer, 2, NULL);
 	if (rc != 0) {
 		fprintf(stderr, "%s: cannot set bulk erase!\n", __func__);
+		TRACE_END("chip erase");
 		return -1;
 	}
 
 	cnt = inst->flash_detected->bulktime_max /
 	      (inst->flash_detected->bulktime / 64);
 	cntx = cnt;
+	TRACE_BEGIN("rdsr poll");
 	do {
 		_usleep(inst->flash_detected->bulktime / 64);
 		rc = m25pxx_rdsr(inst, &xbuf[0]);
-		if (rc != 0)
+		if (rc != 0) {
+			TRACE_END("rdsr poll");
+			TRACE_END("chip erase");
 			return -1;
+		}
 		DBG("%s: (%02x) delay %d, retry #%d\n",
 		    __func__,
 		    xbuf[0], inst->flash_detected->bulktime / 64, cnt);
@@ -527,9 +604,12 @@ int DLLEXPORT m25pxx_chiperase(struct m25pxxflash_t *inst,
 				progress->fct(progress->arg, percent, 0);
 		}
 	} while ((xbuf[0] & 0x1) == 0x1 && cnt > 0);
+	TRACE_END("rdsr poll");
 
-	if ((xbuf[0] & 0x1) != 0)
+	if ((xbuf[0] & 0x1) != 0) {
+		TRACE_END("chip erase");
 		return -1;
+	}
 
 	if (progress) {
 		while (percent++ < 99)
@@ -537,14 +617,15 @@ int DLLEXPORT m25pxx_chiperase(struct m25pxxflash_t *inst,
 		progress->fct(progress->arg, 100, 0);
 	}
 
+	TRACE_END("chip erase");
 	return 0;
 }
 
 int DLLEXPORT m25pxx_sectorerase(struct m25pxxflash_t *inst, uint32_t addr,
 				 struct m25pxx_progress_t *progress)
 {
-	struct spiops_t *spi = inst->spi->ops;
-	uint8_t xbuf[4] = { 0 };
+	struct spixfer_t xfer[2];
+	uint8_t xbuf[5] = { 0 };
 	unsigned int cnt = 0, cntx;
 	unsigned int percent, percentx;
 	int rc;
@@ -558,34 +639,36 @@ int DLLEXPORT m25pxx_sectorerase(struct m25pxxflash_t *inst, uint32_t addr,
 		return -1;
 	}
 
+	TRACE_BEGIN_ARG("sector erase", addr);
 	if (progress)
 		progress->fct(progress->arg, 0, 0);
 
 	xbuf[0] = 0x06;	/* write enable */
-	rc = spi->trx(inst->spi, inst->cs, xbuf, xbuf, 1);
-	if (rc != 0) {
-		fprintf(stderr, "%s: cannot set write enable!\n", __func__);
-		return -1;
-	}
-
-	xbuf[0] = 0xD8;
-	xbuf[1] = (addr & 0x00FF0000) >> 16;
-	xbuf[2] = (addr & 0x0000FF00) >> 8;
-	xbuf[3] = (addr & 0x000000FF) >> 0;
-	rc = spi->trx(inst->spi, inst->cs, xbuf, xbuf, 4);
+	xbuf[1] = 0xD8;
+	xbuf[2] = (addr & 0x00FF0000) >> 16;
+	xbuf[3] = (addr & 0x0000FF00) >> 8;
+	xbuf[4] = (addr & 0x000000FF) >> 0;
+	xfer[0] = (struct spixfer_t) { inst->cs, &xbuf[0], NULL, 1 };
+	xfer[1] = (struct spixfer_t) { inst->cs, &xbuf[1], NULL, 4 };
+	rc = m25pxx_wrbatch(inst, xfer, 2, NULL);
 	if (rc != 0) {
 		fprintf(stderr, "%s: cannot set sector erase!\n", __func__);
+		TRACE_END("sector erase");
 		return -1;
 	}
 
 	cnt = inst->flash_detected->sectortime_max /
 	      (inst->flash_detected->sectortime / 64);
 	cntx = cnt;
+	TRACE_BEGIN("rdsr poll");
 	do {
 		_usleep(inst->flash_detected->sectortime / 64);
 		rc = m25pxx_rdsr(inst, &xbuf[0]);
-		if (rc != 0)
+		if (rc != 0) {
+			TRACE_END("rdsr poll");
+			TRACE_END("sector erase");
 			return -1;
+		}
 		DBG("%s: (%02x) delay %d, retry #%d\n",
 		    __func__,
 		    xbuf[0], inst->flash_detected->sectortime / 64, cnt);
@@ -597,9 +680,12 @@ int DLLEXPORT m25pxx_sectorerase(struct m25pxxflash_t *inst, uint32_t addr,
 				progress->fct(progress->arg, percent, 0);
 		}
 	} while ((xbuf[0] & 0x1) == 0x1 && cnt > 0);
+	TRACE_END("rdsr poll");
 
-	if ((xbuf[0] & 0x1) != 0)
+	if ((xbuf[0] & 0x1) != 0) {
+		TRACE_END("sector erase");
 		return -1;
+	}
 
 
 	if (progress) {
@@ -607,55 +693,232 @@ int DLLEXPORT m25pxx_sectorerase(struct m25pxxflash_t *inst, uint32_t addr,
 			progress->fct(progress->arg, percent, 1);
 		progress->fct(progress->arg, 100, 0);
 	}
+	TRACE_END("sector erase");
 	return 0;
 }
 
-static int m25pxx_progpage(struct m25pxxflash_t *inst,
-			   void *src, uint32_t addr, size_t size)
+bool DLLEXPORT m25pxx_isblank(const void *buf, size_t size)
 {
-	struct spiops_t *spi = inst->spi->ops;
-	unsigned int cnt = 0;
-	int rc;
+	return blank_check(buf, size);
+}
 
-	inst->xbuf[0] = 0x06;	/* write enable */
-	rc = spi->trx(inst->spi, inst->cs, inst->xbuf, inst->xbuf, 1);
-	if (rc != 0) {
-		fprintf(stderr, "%s: cannot set write enable!\n", __func__);
-		return -1;
+/*
+ * cost model of a page program: every operation costs WREN, the PP header
+ * and at least one status poll, i.e. a sleep of pagetime / 8 and a USB
+ * round trip. Each byte costs its shift and, as partial pages program
+ * in a time proportional to the bytes given, pagetime / pagesize. A run of
+ * 0xFF inside a page is worth an operation of its own once it costs more
+ * than this overhead.
+ */
+#define PP_CMDBYTES	7	/* WREN, PP + address, RDSR */
+#define PP_USBTURN	125	/* [us] request/response on the USB */
+
+static size_t m25pxx_ppgap(struct m25pxxflash_t *inst)
+{
+	const struct flashparam_t *chip = inst->flash_detected;
+	uint64_t hz = inst->spi->speed ? inst->spi->speed : 6000000;
+	uint64_t op, byte;
+
+	/* in ns */
+	op = (chip->pagetime / 8 + PP_USBTURN) * 1000ULL +
+	     PP_CMDBYTES * 8000000000ULL / hz;
+	byte = 8000000000ULL / hz + chip->pagetime * 1000ULL / chip->pagesize;
+
+	return op / byte + 1;
+}
+
+/*
+ * first span of [p, p + size) worth programming: leading 0xFF are put
+ * into 'skip', trailing ones and those after a gap which pays off to be
+ * left out are not counted. Returns 0 if everything is blank.
+ */
+size_t DLLEXPORT m25pxx_span(struct m25pxxflash_t *inst, const uint8_t *p,
+			     size_t size, size_t *skip)
+{
+	size_t i, end, gap = m25pxx_ppgap(inst);
+
+	for (i = 0; i < size && p[i] == 0xFF; i++)
+		;
+	*skip = i;
+	for (end = i; i < size; i++) {
+		if (p[i] != 0xFF)
+			end = i + 1;
+		else if (i + 1 - end >= gap)
+			break;
 	}
 
-	inst->xbuf[0] = 0x02;
-	inst->xbuf[1] = (addr & 0x00FF0000) >> 16;
-	inst->xbuf[2] = (addr & 0x0000FF00) >> 8;
-	inst->xbuf[3] = (addr & 0x000000FF) >> 0;
-	memcpy(&inst->xbuf[4], src, size);
-	rc = spi->trx(inst->spi, inst->cs, inst->xbuf, inst->xbuf, size + 4);
-	if (rc != 0) {
-		fprintf(stderr, "%s: cannot set page program!\n", __func__);
-		return -1;
+	return end - *skip;
+}
+
+/* page piece [addr, addr + size) programmed span by span */
+int DLLEXPORT m25pxx_progspans(struct m25pxxflash_t *inst,
+			       const void *src, uint32_t addr, size_t size)
+{
+	const uint8_t *p = src;
+	size_t n, skip;
+
+	while (size) {
+		n = m25pxx_span(inst, p, size, &skip);
+		if (n == 0)
+			break;
+		if (m25pxx_progpage(inst, p + skip, addr + skip, n) != 0)
+			return -1;
+		p += skip + n;
+		addr += skip + n;
+		size -= skip + n;
 	}
 
+	return 0;
+}
+
+/* waits for the end of a page program */
+static int m25pxx_ppwait(struct m25pxxflash_t *inst)
+{
+	unsigned int cnt;
+	int rc;
+
 	cnt = inst->flash_detected->pagetime_max /
 	      (inst->flash_detected->pagetime / 8);
+	TRACE_BEGIN("rdsr poll");
 	do {
 		_usleep(inst->flash_detected->pagetime / 8);
 		rc = m25pxx_rdsr(inst, &inst->xbuf[0]);
-		if (rc != 0)
+		if (rc != 0) {
+			TRACE_END("rdsr poll");
 			return -1;
+		}
 		DBG("%s: (%02x) delay %d, retry #%d\n",
 		    __func__,
 		   inst->xbuf[0], inst->flash_detected->pagetime / 8, cnt);
 		cnt--;
 	} while ((inst->xbuf[0] & 0x1) == 0x1 && cnt > 0);
+	TRACE_END("rdsr poll");
+
+	return (inst->xbuf[0] & 0x1) != 0 ? -1 : 0;
+}
+
+/*
+ * the read back of 'pend' in vbuf didn't match: program it again as long
+ * as only bits are missing which a page program can still clear
+ */
+static int m25pxx_vretry(struct m25pxxflash_t *inst,
+			 struct m25pxx_vpend_t *pend)
+{
+	struct spiops_t *spi = inst->spi->ops;
+	struct spixfer_t xfer[2];
+	unsigned int retry, i;
+
+	for (retry = 0; retry < inst->verify; retry++) {
+		for (i = 0; i < pend->size; i++) {
+			if (pend->src[i] & ~inst->vbuf[4 + i])
+				break;
+		}
+		if (i < pend->size) {
+			fprintf(stderr,
+				"%s: page @ 0x%x has 0 bits that must be 1!\n",
+				__func__, pend->addr + i);
+			return -1;
+		}
+		inst->reprogrammed++;
+		inst->xbuf[0] = 0x06;
+		inst->xbuf[1] = 0x02;
+		inst->xbuf[2] = (pend->addr & 0x00FF0000) >> 16;
+		inst->xbuf[3] = (pend->addr & 0x0000FF00) >> 8;
+		inst->xbuf[4] = (pend->addr & 0x000000FF) >> 0;
+		xfer[0] = (struct spixfer_t) { inst->cs, &inst->xbuf[0], NULL,
+					       1 };
+		xfer[1] = (struct spixfer_t) { inst->cs, &inst->xbuf[1], NULL,
+					       4, pend->src, pend->size };
+		if (m25pxx_wrbatch(inst, xfer, 2, NULL) != 0 ||
+		    m25pxx_ppwait(inst) != 0)
+			return -1;
+		m25pxx_vread(inst, pend, &xfer[0]);
+		if (spi->trx_batch(inst->spi, xfer, 1) != 0)
+			return -1;
+		if (memcmp(&inst->vbuf[4], pend->src, pend->size) == 0)
+			return 0;
+	}
+	fprintf(stderr, "%s: page @ 0x%x still differs after %u retries!\n",
+		__func__, pend->addr, inst->verify);
+
+	return -1;
+}
+
+/*
+ * inline verify: a page program doesn't wait for its own read back, the
+ * READ of the previous span goes out in front of WREN and PP in the same
+ * batch and is compared as soon as the batch returns. A bad span is
+ * programmed again right after the current one is done.
+ */
+int DLLEXPORT m25pxx_progpage(struct m25pxxflash_t *inst,
+			      const void *src, uint32_t addr, size_t size)
+{
+	struct m25pxx_vpend_t pend = inst->vpend;
+	struct spixfer_t xfer[3];
+	unsigned int cnt = 0;
+	bool bad = false;
+	int rc;
+
+	TRACE_BEGIN_ARG("page program", addr);
+	if (pend.size != 0)
+		m25pxx_vread(inst, &pend, &xfer[cnt++]);
+	/* write enable and page program, payload taken from 'src' as is */
+	inst->xbuf[0] = 0x06;
+	inst->xbuf[1] = 0x02;
+	inst->xbuf[2] = (addr & 0x00FF0000) >> 16;
+	inst->xbuf[3] = (addr & 0x0000FF00) >> 8;
+	inst->xbuf[4] = (addr & 0x000000FF) >> 0;
+	xfer[cnt++] = (struct spixfer_t) { inst->cs, &inst->xbuf[0], NULL, 1 };
+	xfer[cnt++] = (struct spixfer_t) { inst->cs, &inst->xbuf[1], NULL, 4,
+					   src, size };
+	inst->vpend.size = 0;
+	rc = m25pxx_wrbatch(inst, xfer, cnt, pend.size != 0 ? &pend : NULL);
+	if (rc != 0) {
+		fprintf(stderr, "%s: cannot set page program!\n", __func__);
+		TRACE_END("page program");
+		return -1;
+	}
+	if (pend.size != 0) {
+		inst->verified++;
+		bad = memcmp(&inst->vbuf[4], pend.src, pend.size) != 0;
+	}
 
-	if ((inst->xbuf[0] & 0x1) != 0)
+	rc = m25pxx_ppwait(inst);
+	if (rc == 0 && bad)
+		rc = m25pxx_vretry(inst, &pend);
+	TRACE_END("page program");
+	if (rc != 0)
 		return -1;
 
+	if (inst->verify != 0 && size <= M25PXX_PAGEMAX)
+		inst->vpend = (struct m25pxx_vpend_t) { src, addr, size };
+	else
+		inst->vpend.size = 0;
+
 	return 0;
 }
 
+/* read back of the last programmed span, ends an inline verified program */
+int DLLEXPORT m25pxx_verify_flush(struct m25pxxflash_t *inst)
+{
+	struct m25pxx_vpend_t pend = inst->vpend;
+	struct spixfer_t xfer;
+
+	if (pend.size == 0)
+		return 0;
+	inst->vpend.size = 0;
+	m25pxx_vread(inst, &pend, &xfer);
+	if (inst->spi->ops->trx_batch(inst->spi, &xfer, 1) != 0)
+		return -1;
+	inst->verified++;
+	if (memcmp(&inst->vbuf[4], pend.src, pend.size) == 0)
+		return 0;
+
+	return m25pxx_vretry(inst, &pend);
+}
+
 int DLLEXPORT m25pxx_program(struct m25pxxflash_t *inst,
-			     void *src, uint32_t addr, size_t size,
+			     const void *src, uint32_t addr, size_t size,
 			     struct m25pxx_progress_t *progress)
 {
 	int rc;
@@ -702,15 +965,16 @@ int DLLEXPORT m25pxx_program(struct m25pxxflash_t *inst,
 				progress->fct(progress->arg, percent, 0);
 			}
 		}
-		prog = size > inst->flash_detected->pagesize ?
-			      inst->flash_detected->pagesize : size;
-
-		memset(inst->xbuf, 0xFF, inst->flash_detected->pagesize);
+		/* never across a page boundary, the chip would wrap */
+		prog = inst->flash_detected->pagesize -
+		       addr % inst->flash_detected->pagesize;
+		if (prog > size)
+			prog = size;
 
-		if (memcmp(src, inst->xbuf, prog) == 0) {
+		if (m25pxx_isblank(src, prog)) {
 			DBG("%s: skip empty page @ 0x%x\n", __func__, addr);
 		} else {
-			rc = m25pxx_progpage(inst, src, addr, prog);
+			rc = m25pxx_progspans(inst, src, addr, prog);
 			if (rc != 0) {
 				fprintf(stderr,
 					"%s: cannot program page @ 0x%x\n",
@@ -722,6 +986,8 @@ int DLLEXPORT m25pxx_program(struct m25pxxflash_t *inst,
 		addr += prog;
 		size -= prog;
 	}
+	if (m25pxx_verify_flush(inst) != 0)
+		return -1;
 
 	if (progress && percent != 100)
 		progress->fct(progress->arg, 100, 0);
@@ -729,6 +995,474 @@ int DLLEXPORT m25pxx_program(struct m25pxxflash_t *inst,
 	return 0;
 }
 
+/*
+ * random access writer
+ *
+ * Writes go into a write-back cache of whole sectors. A sector is read
+ * once when it is first written to, later writes only merge into the
+ * cached copy and mark the pages they change. On flush (or eviction of
+ * the least recently used sector) it is erased only if some bit has to go
+ * from 0 to 1, otherwise just the changed bytes of the dirty pages are
+ * programmed. Many small updates within a sector cost one read, at most
+ * one erase and a page program per touched page.
+ */
+static bool wline_dirty(const struct m25pxx_wline_t *l, unsigned int pg)
+{
+	return (l->dirty[pg / 64] >> (pg % 64)) & 1;
+}
+
+static int wline_flush(struct m25pxxflash_t *inst, struct m25pxx_wline_t *l)
+{
+	struct flashparam_t *chip = inst->flash_detected;
+	unsigned int pg, npages = chip->sectorsize / chip->pagesize;
+	uint32_t i, lo, hi, off;
+	bool erase = false;
+
+	for (pg = 0; pg < npages && !erase; pg++) {
+		if (!wline_dirty(l, pg))
+			continue;
+		off = pg * chip->pagesize;
+		for (i = off; i < off + chip->pagesize; i++) {
+			if (~l->flash[i] & l->data[i]) {
+				erase = true;
+				break;
+			}
+		}
+	}
+	if (erase) {
+		if (m25pxx_sectorerase(inst, l->addr, NULL) != 0)
+			return -1;
+		/* all of it is to be programmed, also if we fail below */
+		memset(l->flash, 0xFF, chip->sectorsize);
+		memset(l->dirty, 0xFF, (npages / 64 + 1) * sizeof(uint64_t));
+		inst->wstat.erases++;
+	}
+
+	for (pg = 0; pg < npages; pg++) {
+		if (!wline_dirty(l, pg))
+			continue;
+		/* first and last byte to change, the rest is there already */
+		off = pg * chip->pagesize;
+		for (lo = off; lo < off + chip->pagesize &&
+		     l->data[lo] == l->flash[lo]; lo++)
+			;
+		for (hi = off + chip->pagesize; hi > lo &&
+		     l->data[hi - 1] == l->flash[hi - 1]; hi--)
+			;
+		if (lo == hi)
+			continue;
+		if (m25pxx_progspans(inst, &l->data[lo], l->addr + lo,
+				     hi - lo) != 0)
+			return -1;
+		inst->wstat.pages++;
+	}
+	if (m25pxx_verify_flush(inst) != 0)
+		return -1;
+
+	memcpy(l->flash, l->data, chip->sectorsize);
+	memset(l->dirty, 0, (npages / 64 + 1) * sizeof(uint64_t));
+
+	return 0;
+}
+
+/* cached sector at 'addr', read in if it isn't there yet */
+static struct m25pxx_wline_t *wline_get(struct m25pxxflash_t *inst,
+					uint32_t addr)
+{
+	struct flashparam_t *chip = inst->flash_detected;
+	unsigned int i, npages = chip->sectorsize / chip->pagesize;
+	struct m25pxx_wline_t *l, *victim = NULL;
+
+	for (i = 0; i < M25PXX_WCACHE; i++) {
+		l = &inst->wc[i];
+		if (l->valid && l->addr == addr) {
+			l->used = ++inst->wstamp;
+			return l;
+		}
+		if (victim == NULL || !l->valid ||
+		    (victim->valid && l->used < victim->used))
+			victim = l;
+	}
+
+	l = victim;
+	if (l->valid && wline_flush(inst, l) != 0)
+		return NULL;
+	l->valid = false;
+	if (l->flash == NULL) {
+		l->flash = malloc(chip->sectorsize);
+		l->data = malloc(chip->sectorsize);
+		l->dirty = calloc(npages / 64 + 1, sizeof(uint64_t));
+		if (l->flash == NULL || l->data == NULL || l->dirty == NULL) {
+			fprintf(stderr, "%s: no mem for write cache!\n",
+				__func__);
+			free(l->flash);
+			free(l->data);
+			free(l->dirty);
+			l->flash = NULL;
+			l->data = NULL;
+			l->dirty = NULL;
+			return NULL;
+		}
+	}
+	if (m25pxx_read(inst, l->flash, addr, chip->sectorsize) != 0)
+		return NULL;
+	inst->wstat.reads++;
+	memcpy(l->data, l->flash, chip->sectorsize);
+	memset(l->dirty, 0, (npages / 64 + 1) * sizeof(uint64_t));
+	l->addr = addr;
+	l->used = ++inst->wstamp;
+	l->valid = true;
+
+	return l;
+}
+
+int DLLEXPORT m25pxx_write(struct m25pxxflash_t *inst,
+			   const void *src, uint32_t addr, size_t size)
+{
+	struct flashparam_t *chip = inst->flash_detected;
+	const uint8_t *p = src;
+	struct m25pxx_wline_t *l;
+	uint32_t off, pg;
+	size_t n;
+
+	if (chip == NULL || addr > chip->size || size > chip->size - addr) {
+		fprintf(stderr, "%s: 0x%x + 0x%lx is not within the flash!\n",
+			__func__, addr, (unsigned long)size);
+		return -1;
+	}
+
+	while (size) {
+		l = wline_get(inst, addr - addr % chip->sectorsize);
+		if (l == NULL)
+			return -1;
+		/* page by page, only changed ones become dirty */
+		off = addr - l->addr;
+		n = chip->pagesize - off % chip->pagesize;
+		if (n > size)
+			n = size;
+		if (memcmp(&l->data[off], p, n) != 0) {
+			memcpy(&l->data[off], p, n);
+			pg = off / chip->pagesize;
+			l->dirty[pg / 64] |= 1ULL << (pg % 64);
+		}
+		p += n;
+		addr += n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * writes all cached sectors back. A sector that failed stays cached, after
+ * an erase its only copy is there, another flush tries it again.
+ */
+int DLLEXPORT m25pxx_flush(struct m25pxxflash_t *inst)
+{
+	struct m25pxx_wline_t *l;
+	unsigned int i;
+	int rc = 0;
+
+	for (i = 0; i < M25PXX_WCACHE; i++) {
+		l = &inst->wc[i];
+		if (!l->valid)
+			continue;
+		if (wline_flush(inst, l) != 0) {
+			fprintf(stderr, "%s: sector @ 0x%x not written back!\n",
+				__func__, l->addr);
+			rc = -1;
+			continue;
+		}
+		l->valid = false;
+	}
+
+	return rc;
+}
+
+/*
+ * multi-device session
+ *
+ * Flashes on different chipselects of one bus are worked on at the same
+ * time: while one chip is busy with an erase or page program the others
+ * get their next command and payload, and the status polls of all busy
+ * chips are merged into the same batched transfer.
+ */
+enum {
+	MULTI_PROGRAM,
+	MULTI_SECTORERASE,
+	MULTI_CHIPERASE,
+};
+
+/* occupancy map if it fits the chip, else scan the image piece */
+static bool multi_isblank(const struct m25pxx_multi_t *job, int op,
+			  uint32_t a, size_t n)
+{
+	const struct flashparam_t *chip = job->flash->flash_detected;
+
+	if (job->src == NULL)
+		return false;
+	if (job->occ != NULL && job->occ->pagesize == chip->pagesize &&
+	    job->occ->sectorsize == chip->sectorsize)
+		return op == MULTI_PROGRAM ? !occmap_page(job->occ, a) :
+					     !occmap_sector(job->occ, a);
+
+	return m25pxx_isblank(job->src + job->pos, n);
+}
+
+/*
+ * builds the next command of 'job' in its xbuf, returns its length. The
+ * payload of a program is 'job->cur' bytes at 'job->src + job->pos'.
+ */
+static unsigned int multi_next(struct m25pxx_multi_t *job, int op)
+{
+	struct flashparam_t *chip = job->flash->flash_detected;
+	uint8_t *xbuf = job->flash->xbuf;
+	uint32_t a, unit;
+	size_t n, skip;
+
+	if (op == MULTI_CHIPERASE) {
+		if (job->pos != 0)
+			return 0;
+		job->cur = job->size;
+		xbuf[0] = 0xC7;
+		return 1;
+	}
+
+	unit = op == MULTI_PROGRAM ? chip->pagesize : chip->sectorsize;
+	while (job->pos < job->size) {
+		a = job->addr + job->pos;
+		n = unit - (a % unit);
+		if (n > job->size - job->pos)
+			n = job->size - job->pos;
+		if (multi_isblank(job, op, a, n)) {
+			job->pos += n;
+			continue;
+		}
+		if (op == MULTI_PROGRAM) {
+			/* rest of the page is done by the next command */
+			n = m25pxx_span(job->flash, job->src + job->pos, n,
+					&skip);
+			if (n == 0) {
+				job->pos += skip;
+				continue;
+			}
+			job->pos += skip;
+			a += skip;
+		}
+		job->cur = n;
+		if (op == MULTI_SECTORERASE)
+			a -= a % unit;
+		xbuf[0] = op == MULTI_PROGRAM ? 0x02 : 0xD8;
+		xbuf[1] = (a & 0x00FF0000) >> 16;
+		xbuf[2] = (a & 0x0000FF00) >> 8;
+		xbuf[3] = (a & 0x000000FF) >> 0;
+
+		return 4;
+	}
+
+	return 0;
+}
+
+/* poll interval of an operation, 'tmax' gets its worst case duration */
+static unsigned int multi_timing(struct flashparam_t *chip, int op,
+				 unsigned int *tmax)
+{
+	unsigned int typ, max;
+
+	if (op == MULTI_PROGRAM) {
+		typ = chip->pagetime / 8;
+		max = chip->pagetime_max;
+	} else if (op == MULTI_SECTORERASE) {
+		typ = chip->sectortime / 64;
+		max = chip->sectortime_max;
+	} else {
+		typ = chip->bulktime / 64;
+		max = chip->bulktime_max;
+	}
+	if (tmax)
+		*tmax = max;
+
+	return typ;
+}
+
+static int m25pxx_multi_run(struct m25pxx_multi_t *job, unsigned int cnt,
+			    int op, struct m25pxx_progress_t *progress)
+{
+	struct spixfer_t xfer[3 * M25PXX_MULTI_MAX];
+	struct flashparam_t *chip;
+	struct spihw_t *spi;
+	uint8_t wren = 0x06;
+	unsigned int budget[M25PXX_MULTI_MAX];
+	unsigned int i, n, len, tmax, interval = 0, retry;
+	unsigned int percent, percentx = 0;
+	size_t total = 0, done;
+	bool busy;
+	int rc = 0;
+
+	if (job == NULL || cnt == 0 || cnt > M25PXX_MULTI_MAX)
+		return -1;
+
+	spi = job[0].flash->spi;
+	for (i = 0; i < cnt; i++) {
+		chip = job[i].flash->flash_detected;
+		if (chip == NULL || job[i].flash->spi != spi) {
+			fprintf(stderr,
+				"%s: job %d: no flash detected or not on the same bus!\n",
+				__func__, i);
+			return -1;
+		}
+		len = multi_timing(chip, op, NULL);
+		if (interval == 0 || len < interval)
+			interval = len;
+	}
+	/* all chips are polled with the shortest interval */
+	for (i = 0; i < cnt; i++) {
+		chip = job[i].flash->flash_detected;
+		multi_timing(chip, op, &tmax);
+		budget[i] = tmax / interval;
+		job[i].pos = 0;
+		job[i].busy = false;
+		job[i].rc = 0;
+		if (op == MULTI_CHIPERASE)
+			job[i].size = chip->size;
+		total += job[i].size;
+	}
+
+	if (progress)
+		progress->fct(progress->arg, 0, 0);
+
+	do {
+		/* poll busy chips, hand out the next command to idle ones */
+		n = 0;
+		for (i = 0; i < cnt; i++) {
+			job[i].polled = false;
+			if (job[i].rc != 0)
+				continue;
+			if (job[i].busy) {
+				job[i].sr[0] = 0x05;
+				xfer[n++] = (struct spixfer_t) {
+					job[i].flash->cs, job[i].sr,
+					job[i].sr, 2 };
+				job[i].polled = true;
+				continue;
+			}
+			len = multi_next(&job[i], op);
+			if (len == 0)
+				continue;
+			xfer[n++] = (struct spixfer_t) {
+				job[i].flash->cs, &wren, NULL, 1 };
+			/* page payload goes straight from the image */
+			xfer[n++] = (struct spixfer_t) {
+				job[i].flash->cs, job[i].flash->xbuf, NULL,
+				len, op == MULTI_PROGRAM ?
+				job[i].src + job[i].pos : NULL,
+				op == MULTI_PROGRAM ? job[i].cur : 0 };
+			job[i].busy = true;
+			job[i].polls = budget[i];
+		}
+		if (n == 0)
+			break;
+
+		TRACE_BEGIN_ARG("multi batch", n);
+		rc = spi->ops->trx_batch(spi, xfer, n);
+		/* as m25pxx_wrbatch(), commanded chips must be idle first */
+		for (retry = 0; rc != 0 && retry < SPIHW_RETRIES; retry++) {
+			for (i = 0; i < cnt; i++) {
+				if (job[i].busy && !job[i].polled &&
+				    m25pxx_idle(job[i].flash) != 0)
+					break;
+				job[i].sr[0] = 0x05;
+			}
+			if (i < cnt)
+				break;
+			spi->stat.retries++;
+			rc = spi->ops->trx_batch(spi, xfer, n);
+		}
+		TRACE_END("multi batch");
+		if (rc != 0) {
+			fprintf(stderr, "%s: batch transfer failed!\n",
+				__func__);
+			return -1;
+		}
+
+		busy = false;
+		done = 0;
+		for (i = 0; i < cnt; i++) {
+			if (job[i].polled && (job[i].sr[1] & 0x1) == 0) {
+				job[i].busy = false;
+				job[i].pos += job[i].cur;
+			} else if (job[i].polled && --job[i].polls == 0) {
+				fprintf(stderr,
+					"%s: cs %d stays busy @ 0x%x!\n",
+					__func__, job[i].flash->cs,
+					(unsigned int)(job[i].addr +
+						       job[i].pos));
+				job[i].rc = -1;
+				job[i].busy = false;
+			}
+			busy |= job[i].busy;
+			done += job[i].pos;
+		}
+
+		if (progress && total != 0) {
+			percent = done / (total >= 100 ? (total / 100) : 1);
+			if (percent != 0 && percent < 100 &&
+			    percentx != percent) {
+				percentx = percent;
+				progress->fct(progress->arg, percent, 0);
+			}
+		}
+
+		if (busy)
+			_usleep(interval);
+	} while (1);
+
+	if (progress)
+		progress->fct(progress->arg, 100, 0);
+
+	for (i = 0; i < cnt; i++)
+		if (job[i].rc != 0)
+			rc = -1;
+
+	return rc;
+}
+
+int DLLEXPORT m25pxx_multi_program(struct m25pxx_multi_t *job,
+				   unsigned int cnt,
+				   struct m25pxx_progress_t *progress)
+{
+	uint8_t status;
+	unsigned int i;
+
+	for (i = 0; i < cnt; i++) {
+		if (job[i].src == NULL ||
+		    m25pxx_rdsr(job[i].flash, &status) != 0)
+			return -1;
+		if (status & 0x80) {
+			fprintf(stderr,
+				"%s: cs %d has write protect asserted status 0x%02x.\n",
+				__func__, job[i].flash->cs, status);
+			return -1;
+		}
+	}
+
+	return m25pxx_multi_run(job, cnt, MULTI_PROGRAM, progress);
+}
+
+int DLLEXPORT m25pxx_multi_sectorerase(struct m25pxx_multi_t *job,
+				       unsigned int cnt,
+				       struct m25pxx_progress_t *progress)
+{
+	return m25pxx_multi_run(job, cnt, MULTI_SECTORERASE, progress);
+}
+
+int DLLEXPORT m25pxx_multi_chiperase(struct m25pxx_multi_t *job,
+				     unsigned int cnt,
+				     struct m25pxx_progress_t *progress)
+{
+	return m25pxx_multi_run(job, cnt, MULTI_CHIPERASE, progress);
+}
+
 void DLLEXPORT m25pxx_printflash(struct flashparam_t *pflash)
 {
 	if (pflash == NULL)
@@ -757,11 +1491,17 @@ void DLLEXPORT m25pxx_printflash(struct flashparam_t *pflash)
 
 void m25pxxflash_destroy(struct m25pxxflash_t *inst)
 {
+	unsigned int i;
+
 	if (inst == NULL)
 		return;
 
-	if (inst->xbuf != NULL)
-		free(inst->xbuf);
+	/* unflushed writes are lost */
+	for (i = 0; i < M25PXX_WCACHE; i++) {
+		free(inst->wc[i].flash);
+		free(inst->wc[i].data);
+		free(inst->wc[i].dirty);
+	}
 	free(inst);
 }
 
@@ -5,8 +5,12 @@
  * Copyright (C) 2018 Hannes Schmelzer <oe5hpm@oevsv.at>
  *
  */
+#ifndef __LIBM25PXX_FLASH_H__
+#define __LIBM25PXX_FLASH_H__
+
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <spihw.h>
 
 #ifdef __MINGW32__
@@ -33,14 +37,50 @@ struct flashparam_t {
 	uint32_t	pagetime_max;
 };
 
+#define M25PXX_PAGEMAX		0x100
+
+/* last programmed span, read back with the next page program */
+struct m25pxx_vpend_t {
+	const uint8_t	*src;
+	uint32_t	addr;
+	size_t		size;
+};
+
+#define M25PXX_WCACHE		4	/* sectors of the writer */
+
+/* one sector of the write-back cache, see m25pxx_write() */
+struct m25pxx_wline_t {
+	bool		valid;
+	uint32_t	addr;
+	unsigned long	used;		/* LRU stamp */
+	uint8_t		*flash;		/* content of the flash */
+	uint8_t		*data;		/* content after the writes */
+	uint64_t	*dirty;		/* pages written to */
+};
+
+struct m25pxx_wstat_t {
+	unsigned long	reads;		/* sectors read */
+	unsigned long	erases;		/* sectors erased */
+	unsigned long	pages;		/* pages programmed */
+};
+
 struct m25pxxflash_t {
 	struct flashparam_t	*flash_db;
 	struct flashparam_t	*flash_detected;
 
 	struct spihw_t		*spi;
 	unsigned int		cs;
-	uint8_t			*xbuf;
-	size_t			xbufsize;
+	uint8_t			xbuf[16];	/* command header */
+	/* inline verify: retries of a bad page, 0 is off */
+	unsigned int		verify;
+	unsigned long		verified;
+	unsigned long		reprogrammed;
+	struct m25pxx_vpend_t	vpend;
+	uint8_t			vbuf[4 + M25PXX_PAGEMAX];
+	/* writer */
+	struct m25pxx_wline_t	wc[M25PXX_WCACHE];
+	unsigned long		wstamp;
+	struct m25pxx_wstat_t	wstat;
 };
 
 struct m25pxx_progress_t {
@@ -48,18 +88,75 @@ struct m25pxx_progress_t {
 	void *arg;
 };
 
+#define M25PXX_MULTI_MAX	4
+#define M25PXX_PROBE_XFERS	3
+
+/* raw answers of the ID probes on one chipselect */
+struct m25pxx_probe_t {
+	unsigned int		cs;
+	uint8_t			buf[M25PXX_PROBE_XFERS][8];
+};
+
+/* one flash of a multi-device session, see m25pxx_multi_program() */
+struct occmap_t;
+
+struct m25pxx_multi_t {
+	struct m25pxxflash_t	*flash;
+	const uint8_t		*src;	/* image, erase: NULL or skip blank */
+	const struct occmap_t	*occ;	/* NULL or blank map of 'src' */
+	uint32_t		addr;
+	size_t			size;
+	int			rc;
+	/* session state */
+	size_t			pos;
+	size_t			cur;
+	unsigned int		polls;
+	bool			busy;
+	bool			polled;
+	uint8_t			sr[2];
+};
+
 void m25pxxflash_destroy(struct m25pxxflash_t *inst);
 struct m25pxxflash_t *m25pxxflash_create(struct spihw_t *spi);
 int DLLEXPORT m25pxx_detect(struct m25pxxflash_t *inst, uint8_t cs);
+void DLLEXPORT m25pxx_probe_prepare(struct m25pxx_probe_t *probe,
+				    unsigned int cs, struct spixfer_t *xfer);
+struct flashparam_t DLLEXPORT *m25pxx_probe_decode(struct m25pxxflash_t *inst,
+						   struct m25pxx_probe_t *probe);
+struct flashparam_t DLLEXPORT *m25pxx_find(const char *name);
+int DLLEXPORT m25pxx_attach(struct m25pxxflash_t *inst,
+			    struct flashparam_t *chip, uint8_t cs);
 int DLLEXPORT m25pxx_rdsr(struct m25pxxflash_t *inst, uint8_t *reg);
 int DLLEXPORT m25pxx_wrsr(struct m25pxxflash_t *inst, uint8_t reg);
 int DLLEXPORT m25pxx_read(struct m25pxxflash_t *inst,
 			  void *dst, uint32_t addr, size_t size);
 int DLLEXPORT m25pxx_program(struct m25pxxflash_t *inst,
-			     void *src, uint32_t addr, size_t size,
+			     const void *src, uint32_t addr, size_t size,
 		   struct m25pxx_progress_t *progress);
+int DLLEXPORT m25pxx_progpage(struct m25pxxflash_t *inst,
+			      const void *src, uint32_t addr, size_t size);
 void DLLEXPORT m25pxx_printflash(struct flashparam_t *pflash);
+bool DLLEXPORT m25pxx_isblank(const void *buf, size_t size);
+size_t DLLEXPORT m25pxx_span(struct m25pxxflash_t *inst, const uint8_t *p,
+			     size_t size, size_t *skip);
+int DLLEXPORT m25pxx_verify_flush(struct m25pxxflash_t *inst);
+int DLLEXPORT m25pxx_progspans(struct m25pxxflash_t *inst,
+			       const void *src, uint32_t addr, size_t size);
 int DLLEXPORT m25pxx_chiperase(struct m25pxxflash_t *inst,
 			       struct m25pxx_progress_t *progress);
 int DLLEXPORT m25pxx_sectorerase(struct m25pxxflash_t *inst, uint32_t addr,
 				 struct m25pxx_progress_t *progress);
+int DLLEXPORT m25pxx_write(struct m25pxxflash_t *inst,
+			   const void *src, uint32_t addr, size_t size);
+int DLLEXPORT m25pxx_flush(struct m25pxxflash_t *inst);
+int DLLEXPORT m25pxx_multi_program(struct m25pxx_multi_t *job,
+				   unsigned int cnt,
+				   struct m25pxx_progress_t *progress);
+int DLLEXPORT m25pxx_multi_sectorerase(struct m25pxx_multi_t *job,
+				       unsigned int cnt,
+				       struct m25pxx_progress_t *progress);
+int DLLEXPORT m25pxx_multi_chiperase(struct m25pxx_multi_t *job,
+				     unsigned int cnt,
+				     struct m25pxx_progress_t *progress);
+
+#endif /* __LIBM25PXX_FLASH_H__ */
@@ -0,0 +1,423 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * asynchronous job interface for the M25Pxx Flash Library
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <libM25Pxx_flash.h>
+#include <libtrace.h>
+#include "libM25Pxx_job.h"
+#include "osi.h"
+
+#define JOB_READCHUNK		0x10000
+
+struct m25pxx_job_t {
+	struct m25pxx_job_t	*next;
+	struct m25pxx_worker_t	*w;
+	int			op;
+	uint8_t			*buf;
+	uint32_t		addr;
+	size_t			size;
+	/* below protected by w->lock */
+	int			state;
+	bool			cancel;
+	uint64_t		done;
+	uint64_t		total;
+	uint64_t		ts_start;
+	uint64_t		ts_event;
+};
+
+struct m25pxx_worker_t {
+	struct m25pxxflash_t	*flash;
+	osi_thread_t		thread;
+	osi_mutex_t		lock;
+	osi_cond_t		cond;	/* queue, job state or events changed */
+	struct m25pxx_job_t	*head;
+	struct m25pxx_job_t	*tail;
+	struct m25pxx_event_t	ev[M25PXX_EVQUEUE];
+	unsigned int		evhead;
+	unsigned int		evtail;
+	bool			stop;
+};
+
+/* w->lock held, a full queue drops new progress or the oldest event */
+static void ev_push(struct m25pxx_worker_t *w, struct m25pxx_job_t *job,
+		    int type)
+{
+	struct m25pxx_event_t *ev;
+	uint64_t t;
+
+	if (w->evhead - w->evtail == M25PXX_EVQUEUE) {
+		if (type == M25PXX_EV_PROGRESS)
+			return;
+		w->evtail++;
+	}
+	ev = &w->ev[w->evhead++ % M25PXX_EVQUEUE];
+	ev->job = job;
+	ev->type = type;
+	ev->state = job->state;
+	ev->done = job->done;
+	ev->total = job->total;
+	t = GetTimeStamp() - job->ts_start;
+	ev->rate = t != 0 ? job->done * 1000000 / t : 0;
+	osi_cond_broadcast(&w->cond);
+}
+
+/* account 'done' bytes, returns -1 if the job got cancelled meanwhile */
+static int job_step(struct m25pxx_job_t *job, uint64_t done)
+{
+	struct m25pxx_worker_t *w = job->w;
+	uint64_t now = GetTimeStamp();
+	bool cancel;
+
+	osi_mutex_lock(&w->lock);
+	job->done = done;
+	if (now - job->ts_event >= M25PXX_EVINTERVAL) {
+		job->ts_event = now;
+		ev_push(w, job, M25PXX_EV_PROGRESS);
+	}
+	cancel = job->cancel;
+	osi_mutex_unlock(&w->lock);
+
+	return cancel ? -1 : 0;
+}
+
+static int job_read(struct m25pxx_job_t *job)
+{
+	struct m25pxxflash_t *flash = job->w->flash;
+	size_t pos, n;
+
+	for (pos = 0; pos < job->size; pos += n) {
+		n = job->size - pos > JOB_READCHUNK ?
+		    JOB_READCHUNK : job->size - pos;
+		if (m25pxx_read(flash, job->buf + pos, job->addr + pos,
+				n) != 0)
+			return -1;
+		if (job_step(job, pos + n) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int job_program(struct m25pxx_job_t *job)
+{
+	struct m25pxxflash_t *flash = job->w->flash;
+	uint32_t pagesize = flash->flash_detected->pagesize;
+	uint8_t status;
+	size_t pos, n;
+
+	if (m25pxx_rdsr(flash, &status) != 0)
+		return -1;
+	if (status & 0x80) {
+		fprintf(stderr,
+			"%s: flash has write protect asserted status 0x%02x.\n",
+			__func__, status);
+		return -1;
+	}
+
+	for (pos = 0; pos < job->size; pos += n) {
+		n = pagesize - ((job->addr + pos) % pagesize);
+		if (n > job->size - pos)
+			n = job->size - pos;
+		if (!m25pxx_isblank(job->buf + pos, n) &&
+		    m25pxx_progspans(flash, job->buf + pos,
+				     job->addr + pos, n) != 0) {
+			fprintf(stderr, "%s: cannot program page @ 0x%x\n",
+				__func__, (uint32_t)(job->addr + pos));
+			return -1;
+		}
+		if (job_step(job, pos + n) != 0) {
+			/* 'buf' is the caller's, no read back left behind */
+			m25pxx_verify_flush(flash);
+			return -1;
+		}
+	}
+
+	return m25pxx_verify_flush(flash);
+}
+
+static int job_sectorerase(struct m25pxx_job_t *job)
+{
+	struct m25pxxflash_t *flash = job->w->flash;
+	uint32_t sectorsize = flash->flash_detected->sectorsize;
+	uint32_t a, end = job->addr + job->size;
+
+	for (a = job->addr - (job->addr % sectorsize); a < end;
+	     a += sectorsize) {
+		if (m25pxx_sectorerase(flash, a, NULL) != 0)
+			return -1;
+		if (job_step(job, (a + sectorsize > end ?
+				   end : a + sectorsize) - job->addr) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* a running bulk erase cannot be stopped, just report it */
+static void job_chipprogress(void *arg, unsigned int percent,
+			     unsigned int flag)
+{
+	struct m25pxx_job_t *job = arg;
+
+	job_step(job, job->total * percent / 100);
+}
+
+static int job_chiperase(struct m25pxx_job_t *job)
+{
+	struct m25pxx_progress_t progress = {
+		.fct = job_chipprogress,
+		.arg = job,
+	};
+
+	return m25pxx_chiperase(job->w->flash, &progress);
+}
+
+static void *job_worker(void *arg)
+{
+	struct m25pxx_worker_t *w = arg;
+	struct m25pxx_job_t *job;
+	int rc;
+
+	osi_mutex_lock(&w->lock);
+	while (w->stop == false) {
+		job = w->head;
+		if (job == NULL) {
+			osi_cond_wait(&w->cond, &w->lock);
+			continue;
+		}
+		w->head = job->next;
+		if (w->head == NULL)
+			w->tail = NULL;
+		job->state = M25PXX_JOB_RUNNING;
+		job->ts_start = GetTimeStamp();
+		job->ts_event = job->ts_start;
+		osi_cond_broadcast(&w->cond);
+		osi_mutex_unlock(&w->lock);
+
+		TRACE_BEGIN_ARG("job", job->op);
+		switch (job->op) {
+		case M25PXX_JOB_READ:
+			rc = job_read(job);
+			break;
+		case M25PXX_JOB_PROGRAM:
+			rc = job_program(job);
+			break;
+		case M25PXX_JOB_SECTORERASE:
+			rc = job_sectorerase(job);
+			break;
+		default:
+			rc = job_chiperase(job);
+			break;
+		}
+		TRACE_END("job");
+
+		osi_mutex_lock(&w->lock);
+		if (rc == 0) {
+			job->done = job->total;
+			job->state = M25PXX_JOB_DONE;
+		} else {
+			job->state = job->cancel ?
+				     M25PXX_JOB_CANCELLED : M25PXX_JOB_FAILED;
+		}
+		ev_push(w, job, M25PXX_EV_DONE);
+	}
+	osi_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+struct m25pxx_job_t DLLEXPORT *m25pxx_job_submit(struct m25pxx_worker_t *w,
+						 int op, void *buf,
+						 uint32_t addr, size_t size)
+{
+	struct flashparam_t *chip = w->flash->flash_detected;
+	struct m25pxx_job_t *job;
+
+	if (op == M25PXX_JOB_CHIPERASE) {
+		addr = 0;
+		size = chip->size;
+	}
+	if (op < M25PXX_JOB_READ || op > M25PXX_JOB_CHIPERASE ||
+	    addr >= chip->size || size > chip->size - addr ||
+	    (buf == NULL && (op == M25PXX_JOB_READ ||
+			     op == M25PXX_JOB_PROGRAM))) {
+		fprintf(stderr, "%s: invalid job (op %d, 0x%x + 0x%zx)!\n",
+			__func__, op, addr, size);
+		return NULL;
+	}
+
+	job = calloc(1, sizeof(*job));
+	if (job == NULL) {
+		fprintf(stderr, "%s: no mem for job!\n", __func__);
+		return NULL;
+	}
+	job->w = w;
+	job->op = op;
+	job->buf = buf;
+	job->addr = addr;
+	job->size = size;
+	job->total = size;
+	job->state = M25PXX_JOB_QUEUED;
+
+	osi_mutex_lock(&w->lock);
+	if (w->tail != NULL)
+		w->tail->next = job;
+	else
+		w->head = job;
+	w->tail = job;
+	osi_cond_broadcast(&w->cond);
+	osi_mutex_unlock(&w->lock);
+
+	return job;
+}
+
+int DLLEXPORT m25pxx_job_poll(struct m25pxx_job_t *job,
+			      uint64_t *done, uint64_t *total)
+{
+	struct m25pxx_worker_t *w = job->w;
+	int state;
+
+	osi_mutex_lock(&w->lock);
+	state = job->state;
+	if (done != NULL)
+		*done = job->done;
+	if (total != NULL)
+		*total = job->total;
+	osi_mutex_unlock(&w->lock);
+
+	return state;
+}
+
+int DLLEXPORT m25pxx_job_wait(struct m25pxx_job_t *job)
+{
+	struct m25pxx_worker_t *w = job->w;
+	int state;
+
+	osi_mutex_lock(&w->lock);
+	while (job->state == M25PXX_JOB_QUEUED ||
+	       job->state == M25PXX_JOB_RUNNING)
+		osi_cond_wait(&w->cond, &w->lock);
+	state = job->state;
+	osi_mutex_unlock(&w->lock);
+
+	return state == M25PXX_JOB_DONE ? 0 : -1;
+}
+
+/* w->lock held */
+static void job_unqueue(struct m25pxx_worker_t *w, struct m25pxx_job_t *job)
+{
+	struct m25pxx_job_t **pp, *prev = NULL;
+
+	for (pp = &w->head; *pp != NULL; prev = *pp, pp = &(*pp)->next) {
+		if (*pp != job)
+			continue;
+		*pp = job->next;
+		if (w->tail == job)
+			w->tail = prev;
+		break;
+	}
+	job->state = M25PXX_JOB_CANCELLED;
+	ev_push(w, job, M25PXX_EV_DONE);
+}
+
+void DLLEXPORT m25pxx_job_cancel(struct m25pxx_job_t *job)
+{
+	struct m25pxx_worker_t *w = job->w;
+
+	osi_mutex_lock(&w->lock);
+	if (job->state == M25PXX_JOB_QUEUED)
+		job_unqueue(w, job);
+	else if (job->state == M25PXX_JOB_RUNNING)
+		job->cancel = true;
+	osi_mutex_unlock(&w->lock);
+}
+
+void DLLEXPORT m25pxx_job_free(struct m25pxx_job_t *job)
+{
+	if (job == NULL)
+		return;
+
+	m25pxx_job_cancel(job);
+	m25pxx_job_wait(job);
+	free(job);
+}
+
+bool DLLEXPORT m25pxx_event_get(struct m25pxx_worker_t *w,
+				struct m25pxx_event_t *ev, bool wait)
+{
+	bool got = false;
+
+	osi_mutex_lock(&w->lock);
+	while (wait && w->evhead == w->evtail && w->stop == false)
+		osi_cond_wait(&w->cond, &w->lock);
+	if (w->evhead != w->evtail) {
+		*ev = w->ev[w->evtail++ % M25PXX_EVQUEUE];
+		got = true;
+	}
+	osi_mutex_unlock(&w->lock);
+
+	return got;
+}
+
+/* all job handles have to be freed before */
+void DLLEXPORT m25pxx_worker_destroy(struct m25pxx_worker_t *w)
+{
+	if (w == NULL)
+		return;
+
+	osi_mutex_lock(&w->lock);
+	while (w->head != NULL)
+		job_unqueue(w, w->head);
+	w->stop = true;
+	osi_cond_broadcast(&w->cond);
+	osi_mutex_unlock(&w->lock);
+
+	osi_thread_join(w->thread);
+	osi_cond_destroy(&w->cond);
+	osi_mutex_destroy(&w->lock);
+	free(w);
+}
+
+struct m25pxx_worker_t DLLEXPORT *m25pxx_worker_create(
+					struct m25pxxflash_t *flash)
+{
+	struct m25pxx_worker_t *w;
+
+	if (flash == NULL || flash->flash_detected == NULL) {
+		fprintf(stderr, "%s: no valid flash detected!\n", __func__);
+		return NULL;
+	}
+
+	w = calloc(1, sizeof(*w));
+	if (w == NULL) {
+		fprintf(stderr, "%s: no mem for worker!\n", __func__);
+		return NULL;
+	}
+
+	do {
+		w->flash = flash;
+		osi_mutex_init(&w->lock);
+		osi_cond_init(&w->cond);
+		if (osi_thread_create(&w->thread, job_worker, w) != 0) {
+			fprintf(stderr, "%s: cannot start worker thread!\n",
+				__func__);
+			break;
+		}
+
+		return w;
+	} while (0);
+
+	osi_cond_destroy(&w->cond);
+	osi_mutex_destroy(&w->lock);
+	free(w);
+
+	return NULL;
+}
@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * asynchronous job interface for the M25Pxx Flash Library
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#ifndef __LIBM25PXX_JOB_H__
+#define __LIBM25PXX_JOB_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libM25Pxx_flash.h>
+
+#define M25PXX_EVQUEUE		256	/* pending events per worker */
+#define M25PXX_EVINTERVAL	20000	/* us between progress events */
+
+enum m25pxx_jobop {
+	M25PXX_JOB_READ,
+	M25PXX_JOB_PROGRAM,
+	M25PXX_JOB_SECTORERASE,
+	M25PXX_JOB_CHIPERASE,
+};
+
+enum m25pxx_jobstate {
+	M25PXX_JOB_QUEUED,
+	M25PXX_JOB_RUNNING,
+	M25PXX_JOB_DONE,
+	M25PXX_JOB_FAILED,
+	M25PXX_JOB_CANCELLED,
+};
+
+enum m25pxx_evtype {
+	M25PXX_EV_PROGRESS,
+	M25PXX_EV_DONE,
+};
+
+struct m25pxx_job_t;
+struct m25pxx_worker_t;
+
+struct m25pxx_event_t {
+	struct m25pxx_job_t	*job;
+	int			type;
+	int			state;
+	uint64_t		done;	/* bytes */
+	uint64_t		total;
+	uint32_t		rate;	/* bytes/s since job start */
+};
+
+/*
+ * The worker thread owns 'flash' (and its adapter) from create until
+ * destroy, the caller must not touch it in between. Jobs are executed in
+ * submit order, a job handle stays valid until m25pxx_job_free().
+ */
+struct m25pxx_worker_t DLLEXPORT *m25pxx_worker_create(
+					struct m25pxxflash_t *flash);
+void DLLEXPORT m25pxx_worker_destroy(struct m25pxx_worker_t *w);
+struct m25pxx_job_t DLLEXPORT *m25pxx_job_submit(struct m25pxx_worker_t *w,
+						 int op, void *buf,
+						 uint32_t addr, size_t size);
+int DLLEXPORT m25pxx_job_poll(struct m25pxx_job_t *job,
+			      uint64_t *done, uint64_t *total);
+int DLLEXPORT m25pxx_job_wait(struct m25pxx_job_t *job);
+void DLLEXPORT m25pxx_job_cancel(struct m25pxx_job_t *job);
+void DLLEXPORT m25pxx_job_free(struct m25pxx_job_t *job);
+bool DLLEXPORT m25pxx_event_get(struct m25pxx_worker_t *w,
+				struct m25pxx_event_t *ev, bool wait);
+
+#endif /* __LIBM25PXX_JOB_H__ */
@@ -11,6 +11,8 @@
 #include <string.h>
 #include <ftd2xx.h>
 #include <libaltusb.h>
+#include "libtrace.h"
+#include "spsc.h"
 
 /* - Altera USB Blaster (version 1) - */
 #define ALTUSB_BYTEMODE		0x80
@@ -27,6 +29,7 @@
 
 #define FTDI_TIMEOUT		2000
 #define FTDI_LATENCY		1
+#define FTDI_USBSIZE		4096	/* D2XX default */
 
 static const uint8_t bitreverse[256] = {
 	0x00, 0x80, 0x40, 0xC0, 0x20, 0xA0, 0x60, 0xE0,
@@ -63,91 +66,662 @@ static const uint8_t bitreverse[256] = {
 	0x1F, 0x9F, 0x5F, 0xDF, 0x3F, 0xBF, 0x7F, 0xFF,
 };
 
-static int spi_trx(struct spihw_t *spi, unsigned int cs,
-		   uint8_t *out, uint8_t *in, size_t size)
+/*
+ * bit-reversal / framing kernels
+ *
+ * The CPLD shifts LSB first, so every payload byte is mirrored and a
+ * byte-mode header (0x80 + len, | 0x40 for read-back) is put in front of
+ * each 63 bytes.
+ * A full block therefore is 63 payload bytes -> 64 stream bytes, which
+ * the vector kernels produce with overlapping unaligned loads/stores.
+ * Mirroring is done with two 16-entry nibble lookups (pshufb).
+ */
+static void rev_scalar(uint8_t *dst, const uint8_t *src, unsigned int size)
 {
-	struct altusb_priv_t *priv = (struct altusb_priv_t *)spi->priv;
-	uint8_t xbuf[0x10000] = { 0 };
+	while (size--)
+		*dst++ = bitreverse[*src++];
+}
 
-	FT_STATUS rc;
-	DWORD written, read;
+static unsigned int frame_scalar(uint8_t *xbuf, const uint8_t *out,
+				 unsigned int blocks, uint8_t hdr)
+{
+	unsigned int i;
 
-	unsigned int bufsize, blksize, payloadsize, trxsize;
+	for (i = 0; i < blocks; i++) {
+		*xbuf++ = hdr;
+		rev_scalar(xbuf, out, 0x3F);
+		xbuf += 0x3F;
+		out += 0x3F;
+	}
 
-	if (cs > 0) {
-		fprintf(stderr,
-			"%s: cs %d out of range (0..0).\n",
-			__func__, cs);
+	return blocks * 0x3F;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("ssse3")))
+static inline __m128i rev_128(__m128i v)
+{
+	const __m128i tlo = _mm_setr_epi8(0x00, 0x08, 0x04, 0x0C,
+					  0x02, 0x0A, 0x06, 0x0E,
+					  0x01, 0x09, 0x05, 0x0D,
+					  0x03, 0x0B, 0x07, 0x0F);
+	const __m128i thi = _mm_slli_epi16(tlo, 4);
+	const __m128i msk = _mm_set1_epi8(0x0F);
+	__m128i lo, hi;
+
+	lo = _mm_and_si128(v, msk);
+	hi = _mm_and_si128(_mm_srli_epi16(v, 4), msk);
+
+	return _mm_or_si128(_mm_shuffle_epi8(thi, lo),
+			    _mm_shuffle_epi8(tlo, hi));
+}
+
+__attribute__((target("ssse3")))
+static void rev_ssse3(uint8_t *dst, const uint8_t *src, unsigned int size)
+{
+	__m128i v;
+
+	for (; size >= 16; size -= 16) {
+		v = _mm_loadu_si128((const __m128i *)src);
+		_mm_storeu_si128((__m128i *)dst, rev_128(v));
+		src += 16;
+		dst += 16;
+	}
+	rev_scalar(dst, src, size);
+}
+
+__attribute__((target("ssse3")))
+static unsigned int frame_ssse3(uint8_t *xbuf, const uint8_t *out,
+				unsigned int blocks, uint8_t hdr)
+{
+	__m128i v0, v1, v2, v3;
+	unsigned int i;
+
+	for (i = 0; i < blocks; i++) {
+		v0 = rev_128(_mm_loadu_si128((const __m128i *)(out + 0)));
+		v1 = rev_128(_mm_loadu_si128((const __m128i *)(out + 16)));
+		v2 = rev_128(_mm_loadu_si128((const __m128i *)(out + 32)));
+		v3 = rev_128(_mm_loadu_si128((const __m128i *)(out + 47)));
+		_mm_storeu_si128((__m128i *)(xbuf + 1), v0);
+		_mm_storeu_si128((__m128i *)(xbuf + 17), v1);
+		_mm_storeu_si128((__m128i *)(xbuf + 33), v2);
+		_mm_storeu_si128((__m128i *)(xbuf + 48), v3);
+		xbuf[0] = hdr;
+		xbuf += 0x40;
+		out += 0x3F;
+	}
+
+	return blocks * 0x3F;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i rev_256(__m256i v)
+{
+	const __m256i tlo = _mm256_setr_epi8(0x00, 0x08, 0x04, 0x0C,
+					     0x02, 0x0A, 0x06, 0x0E,
+					     0x01, 0x09, 0x05, 0x0D,
+					     0x03, 0x0B, 0x07, 0x0F,
+					     0x00, 0x08, 0x04, 0x0C,
+					     0x02, 0x0A, 0x06, 0x0E,
+					     0x01, 0x09, 0x05, 0x0D,
+					     0x03, 0x0B, 0x07, 0x0F);
+	const __m256i thi = _mm256_slli_epi16(tlo, 4);
+	const __m256i msk = _mm256_set1_epi8(0x0F);
+	__m256i lo, hi;
+
+	lo = _mm256_and_si256(v, msk);
+	hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), msk);
+
+	return _mm256_or_si256(_mm256_shuffle_epi8(thi, lo),
+			       _mm256_shuffle_epi8(tlo, hi));
+}
+
+__attribute__((target("avx2")))
+static void rev_avx2(uint8_t *dst, const uint8_t *src, unsigned int size)
+{
+	__m256i v;
+
+	for (; size >= 32; size -= 32) {
+		v = _mm256_loadu_si256((const __m256i *)src);
+		_mm256_storeu_si256((__m256i *)dst, rev_256(v));
+		src += 32;
+		dst += 32;
+	}
+	rev_ssse3(dst, src, size);
+}
+
+__attribute__((target("avx2")))
+static unsigned int frame_avx2(uint8_t *xbuf, const uint8_t *out,
+			       unsigned int blocks, uint8_t hdr)
+{
+	__m256i v0, v1;
+	unsigned int i;
+
+	for (i = 0; i < blocks; i++) {
+		v0 = rev_256(_mm256_loadu_si256((const __m256i *)(out + 0)));
+		v1 = rev_256(_mm256_loadu_si256((const __m256i *)(out + 31)));
+		_mm256_storeu_si256((__m256i *)(xbuf + 1), v0);
+		_mm256_storeu_si256((__m256i *)(xbuf + 32), v1);
+		xbuf[0] = hdr;
+		xbuf += 0x40;
+		out += 0x3F;
+	}
+
+	return blocks * 0x3F;
+}
+#endif /* __x86_64__ || __i386__ */
+
+static const struct altusb_kernel_t {
+	const char	*name;
+	void		(*rev)(uint8_t *dst, const uint8_t *src,
+			       unsigned int size);
+	unsigned int	(*frame)(uint8_t *xbuf, const uint8_t *out,
+				 unsigned int blocks, uint8_t hdr);
+} kernels[] = {
+	[ALTUSB_KERNEL_SCALAR] = { "scalar", rev_scalar, frame_scalar },
+#if defined(__x86_64__) || defined(__i386__)
+	[ALTUSB_KERNEL_SSSE3] = { "ssse3", rev_ssse3, frame_ssse3 },
+	[ALTUSB_KERNEL_AVX2] = { "avx2", rev_avx2, frame_avx2 },
+#endif
+};
+
+static const struct altusb_kernel_t *kernel;
+
+int altusb_kernel_select(int level)
+{
+	if (level == ALTUSB_KERNEL_AUTO) {
+		level = ALTUSB_KERNEL_SCALAR;
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			level = ALTUSB_KERNEL_AVX2;
+		else if (__builtin_cpu_supports("ssse3"))
+			level = ALTUSB_KERNEL_SSSE3;
+#endif
+	}
+	if (level < 0 || level >= (int)(sizeof(kernels) / sizeof(kernels[0])))
 		return -1;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if ((level == ALTUSB_KERNEL_AVX2 && !__builtin_cpu_supports("avx2")) ||
+	    (level == ALTUSB_KERNEL_SSSE3 && !__builtin_cpu_supports("ssse3")))
+		return -1;
+#endif
+	kernel = &kernels[level];
+
+	return 0;
+}
+
+const char *altusb_kernel_name(void)
+{
+	if (kernel == NULL)
+		altusb_kernel_select(ALTUSB_KERNEL_AUTO);
+
+	return kernel->name;
+}
+
+/* 'blocks' of don't-care bytes, zero is its own mirror */
+static unsigned int frame_zero(uint8_t *xbuf, unsigned int blocks,
+			       uint8_t hdr)
+{
+	unsigned int i;
+
+	memset(xbuf, 0, blocks * 0x40);
+	for (i = 0; i < blocks; i++)
+		xbuf[i * 0x40] = hdr;
+
+	return blocks * 0x3F;
+}
+
+/* out == NULL frames zeros, the data of a don't-care segment */
+unsigned int altusb_encode(uint8_t *xbuf, unsigned int *xlen,
+			   const uint8_t *out, unsigned int size, bool read)
+{
+	unsigned int blocks, payloadsize, bufsize, trxsize;
+	uint8_t hdr = ALTUSB_BYTEMODE | (read ? ALTUSB_READ : 0);
+
+	if (kernel == NULL)
+		altusb_kernel_select(ALTUSB_KERNEL_AUTO);
+
+	/* full 63 byte blocks */
+	blocks = size / 0x3F;
+	if (blocks > *xlen / 0x40)
+		blocks = *xlen / 0x40;
+	if (out != NULL)
+		payloadsize = kernel->frame(xbuf, out, blocks, hdr + 0x3F);
+	else
+		payloadsize = frame_zero(xbuf, blocks, hdr + 0x3F);
+	bufsize = blocks * 0x40;
+
+	/* partial tail block */
+	trxsize = size - payloadsize;
+	if (trxsize != 0 && trxsize < 0x3F && bufsize + 0x40 <= *xlen) {
+		xbuf[bufsize++] = hdr + trxsize;
+		if (out != NULL)
+			kernel->rev(&xbuf[bufsize], out + payloadsize, trxsize);
+		else
+			memset(&xbuf[bufsize], 0, trxsize);
+		bufsize += trxsize;
+		payloadsize += trxsize;
 	}
+	*xlen = bufsize;
 
-	bufsize = 0;
-	payloadsize = 0;
+	return payloadsize;
+}
+
+void altusb_decode(uint8_t *in, const uint8_t *xbuf, unsigned int size)
+{
+	if (kernel == NULL)
+		altusb_kernel_select(ALTUSB_KERNEL_AUTO);
 
+	kernel->rev(in, xbuf, size);
+}
+
+/* answer of one segment piece, read straight into the caller's buffer */
+struct altusb_rd_t {
+	uint8_t		*in;
+	unsigned int	size;
+};
+
+/* one USB write and the answers it produces */
+struct altusb_blk_t {
+	uint8_t			xbuf[ALTUSB_XBUFSIZE];
+	unsigned int		bufsize;
+	struct altusb_rd_t	rd[ALTUSB_RDSEGS];
+	unsigned int		nrd;
+	bool			last;
+};
+
+/* position within the segment list of a shift */
+struct altusb_cur_t {
+	const struct spiseg_t	*seg;
+	unsigned int		nseg;
+	unsigned int		n;
+	size_t			off;
+	bool			first;
+};
+
+/*
+ * frame the next command buffer of a segment list into 'blk', chipselect
+ * is asserted with the first and released with the last piece. Segments
+ * are packed back to back, only answered ones are shifted with read.
+ */
+static void altusb_frame_blk(struct altusb_priv_t *priv,
+			     struct altusb_blk_t *blk,
+			     struct altusb_cur_t *cur)
+{
+	const struct spiseg_t *seg;
+	unsigned int n = 0, xlen, payloadsize;
+	size_t size;
+
+	blk->nrd = 0;
 	/* assert chipselect */
-	priv->portstate &= ~ALTUSB_BIT_nCS;
-	xbuf[bufsize++] = priv->portstate;
-
-	while (size) {
-		blksize = size;
-		payloadsize = 0;
-
-		while (bufsize < sizeof(xbuf) && blksize != 0) {
-			trxsize = blksize > 0x3F ? 0x3F : blksize;
-			/* transfer job */
-			xbuf[bufsize++] = 0xC0 + trxsize;
-			/* payload */
-			while (trxsize--) {
-				xbuf[bufsize++] = bitreverse[*out++];
-				payloadsize++;
-				blksize--;
-			}
-			/* de-assert chipselect */
-			if ((size - payloadsize) == 0) {
-				priv->portstate |= ALTUSB_BIT_nCS;
-				xbuf[bufsize++] = priv->portstate;
-			}
+	if (cur->first) {
+		priv->portstate &= ~ALTUSB_BIT_nCS;
+		blk->xbuf[n++] = priv->portstate;
+		cur->first = false;
+	}
+	while (cur->n < cur->nseg) {
+		seg = &cur->seg[cur->n];
+		if (cur->off == seg->size) {
+			cur->n++;
+			cur->off = 0;
+			continue;
 		}
-		/* start transfer */
-		rc = spi->ftdifunc->write(spi->fthandle,
-					  xbuf, bufsize, &written);
-		if (rc != FT_OK) {
-			fprintf(stderr,
-				"%s: write to FT245 failed!\n", __func__);
+		if (seg->in != NULL && blk->nrd == ALTUSB_RDSEGS)
+			break;
+		/* keep one byte spare for de-asserting chipselect */
+		xlen = priv->chunk - n - 1;
+		size = seg->size - cur->off;
+		if (size > xlen)
+			size = xlen;
+		payloadsize = altusb_encode(&blk->xbuf[n], &xlen,
+					    seg->out != NULL ?
+					    &seg->out[cur->off] : NULL,
+					    size, seg->in != NULL);
+		if (payloadsize == 0)
+			break;
+		n += xlen;
+		if (seg->in != NULL)
+			blk->rd[blk->nrd++] = (struct altusb_rd_t) {
+				&seg->in[cur->off], payloadsize };
+		cur->off += payloadsize;
+	}
+	blk->last = cur->n == cur->nseg;
+	/* de-assert chipselect */
+	if (blk->last) {
+		priv->portstate |= ALTUSB_BIT_nCS;
+		blk->xbuf[n++] = priv->portstate;
+	}
+	blk->bufsize = n;
+}
 
-			return -1;
-		} else if (written != bufsize) {
-			fprintf(stderr,
-				"%s: failed to write fifo %d != %d\n",
-				__func__, written, bufsize);
+/* mirror the answers of 'blk' in place */
+static void altusb_blk_decode(struct altusb_blk_t *blk)
+{
+	unsigned int i;
 
-			return -1;
-		}
-		/* fetch result */
-		rc = spi->ftdifunc->read(spi->fthandle,
-					 xbuf, payloadsize, &read);
+	for (i = 0; i < blk->nrd; i++)
+		altusb_decode(blk->rd[i].in, blk->rd[i].in, blk->rd[i].size);
+}
+
+static int altusb_xfer(struct spihw_t *spi, struct altusb_blk_t *blk)
+{
+	FT_STATUS rc;
+	DWORD written, read;
+	unsigned int i;
+
+	/* start transfer */
+	TRACE_BEGIN_ARG("FT_Write", blk->bufsize);
+	rc = spi->ftdifunc->write(spi->fthandle, blk->xbuf, blk->bufsize,
+				  &written);
+	TRACE_END("FT_Write");
+	if (rc != FT_OK) {
+		fprintf(stderr,
+			"%s: write to FT245 failed!\n", __func__);
+
+		return -1;
+	} else if (written != blk->bufsize) {
+		fprintf(stderr,
+			"%s: failed to write fifo %d != %d\n",
+			__func__, written, blk->bufsize);
+
+		return -1;
+	}
+
+	/* fetch results, caller mirrors them in place */
+	for (i = 0; i < blk->nrd; i++) {
+		TRACE_BEGIN_ARG("FT_Read", blk->rd[i].size);
+		rc = spi->ftdifunc->read(spi->fthandle, blk->rd[i].in,
+					 blk->rd[i].size, &read);
+		TRACE_END("FT_Read");
 		if (rc != FT_OK) {
 			fprintf(stderr,
 				"%s: read from FT245 failed!\n", __func__);
 
 			return -1;
-		} else if (read != payloadsize) {
+		} else if (read != blk->rd[i].size) {
 			fprintf(stderr,
 				"%s: size mismatch on response %d != %d\n",
-				__func__, read, payloadsize);
+				__func__, read, blk->rd[i].size);
+
+			return -1;
 		}
+	}
+
+	return 0;
+}
+
+/*
+ * pipelined transfer path
+ *
+ * Large shifts are split into blocks which travel through three stages,
+ * connected by lock-free SPSC queues of preallocated blocks:
+ *
+ *   encoder thread -> caller (FT_Write/FT_Read) -> decoder thread
+ *
+ * so framing of block N+1 and mirroring of block N-1 overlap the USB
+ * transfer of block N. Responses are read straight into the caller's
+ * buffer, the decoder mirrors them in place.
+ */
+struct altusb_pipe_t {
+	struct altusb_priv_t	*priv;
+	osi_thread_t		encoder;
+	osi_thread_t		decoder;
+	struct spsc_t		q_job;		/* caller -> encoder */
+	struct spsc_t		q_enc;		/* encoder -> caller */
+	struct spsc_t		q_dec;		/* caller -> decoder */
+	struct spsc_t		q_free;		/* decoder -> encoder */
+	struct spsc_t		q_done;		/* decoder -> caller */
+	struct altusb_blk_t	blk[ALTUSB_PIPEDEPTH];
+};
+
+/* queue entry telling a stage to terminate */
+static char pipe_stop;
+
+static void *altusb_encoder(void *arg)
+{
+	struct altusb_pipe_t *pipe = arg;
+	struct altusb_cur_t *cur;
+	struct altusb_blk_t *blk;
+	bool last;
+
+	while ((cur = spsc_pop_wait(&pipe->q_job)) != (void *)&pipe_stop) {
+		do {
+			blk = spsc_pop_wait(&pipe->q_free);
+			TRACE_BEGIN("encode");
+			altusb_frame_blk(pipe->priv, blk, cur);
+			TRACE_END("encode");
+			last = blk->last;
+			spsc_push_wait(&pipe->q_enc, blk);
+		} while (!last);
+	}
+
+	return NULL;
+}
+
+static void *altusb_decoder(void *arg)
+{
+	struct altusb_pipe_t *pipe = arg;
+	struct altusb_blk_t *blk;
+	bool last;
+
+	while ((blk = spsc_pop_wait(&pipe->q_dec)) != (void *)&pipe_stop) {
+		if (blk->nrd != 0) {
+			TRACE_BEGIN("decode");
+			altusb_blk_decode(blk);
+			TRACE_END("decode");
+		}
+		last = blk->last;
+		spsc_push_wait(&pipe->q_free, blk);
+		if (last)
+			spsc_push_wait(&pipe->q_done, &pipe_stop);
+	}
+
+	return NULL;
+}
+
+static void altusb_pipe_destroy(struct altusb_pipe_t *pipe)
+{
+	spsc_push_wait(&pipe->q_job, &pipe_stop);
+	spsc_push_wait(&pipe->q_dec, &pipe_stop);
+	osi_thread_join(pipe->encoder);
+	osi_thread_join(pipe->decoder);
+
+	spsc_free(&pipe->q_job);
+	spsc_free(&pipe->q_enc);
+	spsc_free(&pipe->q_dec);
+	spsc_free(&pipe->q_free);
+	spsc_free(&pipe->q_done);
+	free(pipe);
+}
 
-		size -= payloadsize;
+static struct altusb_pipe_t *altusb_pipe_create(struct altusb_priv_t *priv)
+{
+	struct altusb_pipe_t *pipe;
+	unsigned int i;
+
+	pipe = calloc(1, sizeof(*pipe));
+	if (pipe == NULL)
+		return NULL;
+	pipe->priv = priv;
+
+	if (spsc_init(&pipe->q_job, 2) != 0 ||
+	    spsc_init(&pipe->q_enc, ALTUSB_PIPEDEPTH) != 0 ||
+	    spsc_init(&pipe->q_dec, ALTUSB_PIPEDEPTH) != 0 ||
+	    spsc_init(&pipe->q_free, ALTUSB_PIPEDEPTH) != 0 ||
+	    spsc_init(&pipe->q_done, 2) != 0)
+		goto err;
 
-		bufsize = 0;
-		while (payloadsize--)
-			*in++ = bitreverse[xbuf[bufsize++]];
+	for (i = 0; i < ALTUSB_PIPEDEPTH; i++)
+		spsc_push(&pipe->q_free, &pipe->blk[i]);
 
-		bufsize = 0;
+	if (osi_thread_create(&pipe->encoder, altusb_encoder, pipe) != 0)
+		goto err;
+	if (osi_thread_create(&pipe->decoder, altusb_decoder, pipe) != 0) {
+		spsc_push_wait(&pipe->q_job, &pipe_stop);
+		osi_thread_join(pipe->encoder);
+		goto err;
 	}
-	return size;
+
+	return pipe;
+err:
+	fprintf(stderr, "%s: cannot setup transfer pipeline!\n", __func__);
+	spsc_free(&pipe->q_job);
+	spsc_free(&pipe->q_enc);
+	spsc_free(&pipe->q_dec);
+	spsc_free(&pipe->q_free);
+	spsc_free(&pipe->q_done);
+	free(pipe);
+
+	return NULL;
+}
+
+static int spi_trx_pipe(struct spihw_t *spi, struct altusb_pipe_t *pipe,
+			struct altusb_cur_t *cur)
+{
+	struct altusb_blk_t *blk;
+	int rc = 0;
+	bool last;
+
+	spsc_push_wait(&pipe->q_job, cur);
+	do {
+		blk = spsc_pop_wait(&pipe->q_enc);
+		last = blk->last;
+		/* after an error the remaining blocks are just drained */
+		if (rc == 0)
+			rc = altusb_xfer(spi, blk);
+		if (rc != 0)
+			blk->nrd = 0;
+		spsc_push_wait(&pipe->q_dec, blk);
+	} while (!last);
+	spsc_pop_wait(&pipe->q_done);
+
+	return rc;
 }
 
+/* 'cs' is always 0, it's there for spihw_trxv_retry() */
+static int spi_trxv_once(struct spihw_t *spi, unsigned int cs,
+			 const struct spiseg_t *seg, unsigned int nseg)
+{
+	struct altusb_priv_t *priv = (struct altusb_priv_t *)spi->priv;
+	struct altusb_cur_t cur = { seg, nseg, 0, 0, true };
+	struct altusb_blk_t blk;
+	unsigned int n;
+	size_t size = 0;
+
+	for (n = 0; n < nseg; n++)
+		size += seg[n].size;
+	if (size > ALTUSB_PIPEMIN) {
+		if (priv->pipe == NULL)
+			priv->pipe = altusb_pipe_create(priv);
+		if (priv->pipe != NULL)
+			return spi_trx_pipe(spi, priv->pipe, &cur);
+	}
+
+	do {
+		altusb_frame_blk(priv, &blk, &cur);
+		if (altusb_xfer(spi, &blk) != 0)
+			return -1;
+		altusb_blk_decode(&blk);
+	} while (!blk.last);
+
+	return 0;
+}
+
+/*
+ * back in step after a failed transaction: drop whatever is queued, feed
+ * the CPLD enough plain bitbang bytes to finish any byte-mode shift it
+ * is in and check it answers a read again, chipselect released
+ */
+static int altusb_resync(struct spihw_t *spi)
+{
+	struct altusb_priv_t *priv = (struct altusb_priv_t *)spi->priv;
+	uint8_t xbuf[256];
+	DWORD avail, xsize, written, readb = 0;
+	FT_STATUS rc;
+
+	TRACE_BEGIN("resync");
+	priv->portstate |= ALTUSB_BIT_nCS;
+	rc = spi->ftdifunc->purge(spi->fthandle, FT_PURGE_RX | FT_PURGE_TX);
+	while (rc == FT_OK) {
+		rc = spi->ftdifunc->get_queuestat(spi->fthandle, &avail);
+		if (rc != FT_OK || avail == 0)
+			break;
+		xsize = avail > sizeof(xbuf) ? sizeof(xbuf) : avail;
+		rc = spi->ftdifunc->read(spi->fthandle, xbuf, xsize, &readb);
+	}
+	if (rc == FT_OK) {
+		memset(xbuf, priv->portstate, sizeof(xbuf));
+		xbuf[sizeof(xbuf) - 1] |= ALTUSB_READ;
+		rc = spi->ftdifunc->write(spi->fthandle,
+					  xbuf, sizeof(xbuf), &written);
+	}
+	if (rc == FT_OK)
+		rc = spi->ftdifunc->read(spi->fthandle, xbuf, 1, &readb);
+	TRACE_END("resync");
+	if (rc != FT_OK || readb != 1) {
+		fprintf(stderr, "%s: USB-Blaster doesn't answer!\n",
+			__func__);
+		return -1;
+	}
+	spi->stat.resyncs++;
+
+	return 0;
+}
+
+static int spi_trxv(struct spihw_t *spi, unsigned int cs,
+		    const struct spiseg_t *seg, unsigned int nseg)
+{
+	if (cs > 0) {
+		fprintf(stderr,
+			"%s: cs %d out of range (0..0).\n",
+			__func__, cs);
+		return -1;
+	}
+
+	return spihw_trxv_retry(spi, cs, seg, nseg, spi_trxv_once,
+				altusb_resync);
+}
+
+static int spi_trx(struct spihw_t *spi, unsigned int cs,
+		   uint8_t *out, uint8_t *in, size_t size)
+{
+	struct spiseg_t seg = { out, in, size };
+
+	return spi_trxv(spi, cs, &seg, 1);
+}
+
+/*
+ * there's only one chipselect, so batching doesn't gain anything. 'out'
+ * and 'data' are framed straight from where they are as two segments.
+ */
+static int spi_trx_batch(struct spihw_t *spi,
+			 struct spixfer_t *xfer, unsigned int cnt)
+{
+	struct spiseg_t seg[2];
+	unsigned int n;
+	int rc;
+
+	for (n = 0; n < cnt; n++) {
+		if (xfer[n].datasize != 0) {
+			seg[0] = (struct spiseg_t) { xfer[n].out, xfer[n].in,
+						     xfer[n].size };
+			seg[1] = (struct spiseg_t) { xfer[n].data, NULL,
+						     xfer[n].datasize };
+			rc = spi_trxv(spi, xfer[n].cs, seg, 2);
+		} else {
+			rc = spi_trx(spi, xfer[n].cs, xfer[n].out,
+				     xfer[n].in, xfer[n].size);
+		}
+		if (rc != 0)
+			return -1;
+	}
+
+	return 0;
+}
 
 static int set_clr_tms(struct spihw_t *spi, bool set_nclear)
 {
@@ -253,13 +827,43 @@ static int spi_release(struct spihw_t *spi)
 }
 
 
+static int spi_set_tune(struct spihw_t *spi, const struct spitune_t *tune)
+{
+	struct altusb_priv_t *priv = (struct altusb_priv_t *)spi->priv;
+	FT_STATUS rc;
+
+	rc = spi->ftdifunc->set_usbpar(spi->fthandle,
+				       tune->usbsize, tune->usbsize);
+	if (rc != FT_OK) {
+		fprintf(stderr,
+			"%s: cannot set usb paket size.\n", __func__);
+		return -1;
+	}
+	rc = spi->ftdifunc->set_latency(spi->fthandle, tune->latency);
+	if (rc != FT_OK) {
+		fprintf(stderr,
+			"%s: cannot setup latency timer.\n", __func__);
+		return -1;
+	}
+	spi->tune = *tune;
+	/* room for the chipselect bytes and at least one byte block */
+	if (spi->tune.chunk < 0x100 || spi->tune.chunk > ALTUSB_XBUFSIZE)
+		spi->tune.chunk = ALTUSB_XBUFSIZE;
+	priv->chunk = spi->tune.chunk;
+
+	return 0;
+}
+
 static const struct spiops_t ops = {
 	.trx = &spi_trx,
+	.trxv = &spi_trxv,
+	.trx_batch = &spi_trx_batch,
 	.claim = &spi_claim,
 	.release = &spi_release,
 	.set_clr_tms = set_clr_tms,
 	.set_clr_nce = set_clr_nce,
 	.set_speed_mode = spi_setspeedmode,
+	.set_tune = spi_set_tune,
 };
 
 void altusb_destroy(struct spihw_t *spi)
@@ -277,8 +881,13 @@ void altusb_destroy(struct spihw_t *spi)
 				"%s: cannot reset USB-Blaster!\n", __func__);
 		spi->ftdifunc->close(spi->fthandle);
 	}
-	if (spi->priv != NULL)
+	if (spi->priv != NULL) {
+		struct altusb_priv_t *priv = spi->priv;
+
+		if (priv->pipe != NULL)
+			altusb_pipe_destroy(priv->pipe);
 		free(spi->priv);
+	}
 
 	ftdi_destroy(spi->ftdifunc);
 	free(spi);
@@ -288,9 +897,15 @@ struct spihw_t *altusb_create(unsigned int ftdi_devidx)
 {
 	struct spihw_t *spi;
 	struct altusb_priv_t *priv;
+	struct spitune_t tune = {
+		.latency = FTDI_LATENCY,
+		.usbsize = FTDI_USBSIZE,
+		.chunk = ALTUSB_XBUFSIZE,
+	};
 	FT_STATUS rc;
 
 	uint8_t xbuf[256];
+	char serial[16] = { };
 	DWORD written, readbytes;
 
 	spi = calloc(1, sizeof(*spi));
@@ -335,7 +950,7 @@ struct spihw_t *altusb_create(unsigned int ftdi_devidx)
 		/* test for valid description string */
 		rc = spi->ftdifunc->get_deviceinfo(spi->fthandle,
 						   NULL, NULL,
-						   NULL, xbuf, NULL);
+						   serial, xbuf, NULL);
 		if (rc != FT_OK) {
 			fprintf(stderr,
 				"%s: cannot querry device info string!\n",
@@ -363,15 +978,11 @@ struct spihw_t *altusb_create(unsigned int ftdi_devidx)
 				"%s: cannot setup timeouts.\n", __func__);
 			break;
 		}
-		/* setup latency timer */
-		rc = spi->ftdifunc->set_latency(spi->fthandle, FTDI_LATENCY);
-		if (rc != FT_OK) {
-			fprintf(stderr,
-				"%s: cannot setup latency timer.\n", __func__);
+		/* paket size, latency timer: tuned profile or defaults */
+		ftdi_tune_load(serial, &tune);
+		if (spi_set_tune(spi, &tune) != 0)
 			break;
-		}
 
-		//spi->ftdifunc->set_usbpar(spi->fthandle, 512, 512);
 		/* reset usb-blaster cpld statemachine */
 		memset(xbuf, priv->portstate, sizeof(xbuf));
 		rc = spi->ftdifunc->write(spi->fthandle,
@@ -11,10 +11,35 @@
 #include <libftdi.h>
 #include <spihw.h>
 
+/* command buffer of one USB write */
+#define ALTUSB_XBUFSIZE		0x10000
+/* shifts above ALTUSB_PIPEMIN go through a pipeline of blocks */
+#define ALTUSB_PIPEMIN		ALTUSB_XBUFSIZE
+#define ALTUSB_PIPEDEPTH	4
+/* answered segment pieces of a vectored shift per USB write */
+#define ALTUSB_RDSEGS		16
+
+/* bit-reversal / framing kernels, see altusb_kernel_select() */
+enum {
+	ALTUSB_KERNEL_AUTO = -1,
+	ALTUSB_KERNEL_SCALAR,
+	ALTUSB_KERNEL_SSSE3,
+	ALTUSB_KERNEL_AVX2,
+};
+
+struct altusb_pipe_t;
+
 struct altusb_priv_t {
 	uint8_t			portstate;
+	unsigned int		chunk;		/* bytes per USB write */
+	struct altusb_pipe_t	*pipe;
 };
 
+int altusb_kernel_select(int level);
+const char *altusb_kernel_name(void);
+unsigned int altusb_encode(uint8_t *xbuf, unsigned int *xlen,
+			   const uint8_t *out, unsigned int size, bool read);
+void altusb_decode(uint8_t *in, const uint8_t *xbuf, unsigned int size);
 void altusb_destroy(struct spihw_t *spi);
 struct spihw_t *altusb_create(unsigned int ftdi_devidx);
 
@@ -0,0 +1,244 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * blank (0xFF) detection and occupancy bitmaps of images
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <libtrace.h>
+#include "libblank.h"
+
+/*
+ * blank scan kernels
+ *
+ * All bytes are AND-ed together, the range is blank if the result is
+ * still 0xFF. The vector kernels fold 64 (128) bytes per step and give up
+ * at the first step with a cleared bit, so data pages are rejected after
+ * a few loads and only blank ones are scanned completely.
+ */
+static bool blank_scalar(const uint8_t *p, size_t size)
+{
+	uint64_t acc = ~0ULL, w;
+
+	for (; size >= 8; size -= 8) {
+		memcpy(&w, p, sizeof(w));
+		acc &= w;
+		if (acc != ~0ULL)
+			return false;
+		p += 8;
+	}
+	while (size--)
+		acc &= 0xFFFFFFFFFFFFFF00ULL | *p++;
+
+	return acc == ~0ULL;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static bool blank_sse2(const uint8_t *p, size_t size)
+{
+	const __m128i ones = _mm_set1_epi8(-1);
+	const __m128i *v;
+	__m128i acc;
+
+	for (; size >= 64; size -= 64) {
+		v = (const __m128i *)p;
+		acc = _mm_and_si128(_mm_and_si128(_mm_loadu_si128(v),
+						  _mm_loadu_si128(v + 1)),
+				    _mm_and_si128(_mm_loadu_si128(v + 2),
+						  _mm_loadu_si128(v + 3)));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, ones)) != 0xFFFF)
+			return false;
+		p += 64;
+	}
+	for (; size >= 16; size -= 16) {
+		acc = _mm_loadu_si128((const __m128i *)p);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, ones)) != 0xFFFF)
+			return false;
+		p += 16;
+	}
+
+	return blank_scalar(p, size);
+}
+
+__attribute__((target("avx2")))
+static bool blank_avx2(const uint8_t *p, size_t size)
+{
+	const __m256i ones = _mm256_set1_epi8(-1);
+	__m256i acc;
+
+	for (; size >= 128; size -= 128) {
+		acc = _mm256_and_si256(
+			_mm256_and_si256(
+				_mm256_loadu_si256((const __m256i *)p),
+				_mm256_loadu_si256((const __m256i *)(p + 32))),
+			_mm256_and_si256(
+				_mm256_loadu_si256((const __m256i *)(p + 64)),
+				_mm256_loadu_si256((const __m256i *)(p + 96))));
+		if (!_mm256_testc_si256(acc, ones))
+			return false;
+		p += 128;
+	}
+	for (; size >= 32; size -= 32) {
+		acc = _mm256_loadu_si256((const __m256i *)p);
+		if (!_mm256_testc_si256(acc, ones))
+			return false;
+		p += 32;
+	}
+
+	return blank_sse2(p, size);
+}
+#endif /* __x86_64__ || __i386__ */
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+
+static bool blank_neon(const uint8_t *p, size_t size)
+{
+	uint8x16_t acc;
+
+	for (; size >= 64; size -= 64) {
+		acc = vandq_u8(vandq_u8(vld1q_u8(p), vld1q_u8(p + 16)),
+			       vandq_u8(vld1q_u8(p + 32), vld1q_u8(p + 48)));
+		if (vminvq_u8(acc) != 0xFF)
+			return false;
+		p += 64;
+	}
+	for (; size >= 16; size -= 16) {
+		if (vminvq_u8(vld1q_u8(p)) != 0xFF)
+			return false;
+		p += 16;
+	}
+
+	return blank_scalar(p, size);
+}
+#endif /* __aarch64__ */
+
+static const struct blank_kernel_t {
+	const char	*name;
+	bool		(*blank)(const uint8_t *p, size_t size);
+} kernels[] = {
+	[BLANK_KERNEL_SCALAR] = { "scalar", blank_scalar },
+#if defined(__x86_64__) || defined(__i386__)
+	[BLANK_KERNEL_SSE2] = { "sse2", blank_sse2 },
+	[BLANK_KERNEL_AVX2] = { "avx2", blank_avx2 },
+#endif
+#if defined(__aarch64__)
+	[BLANK_KERNEL_NEON] = { "neon", blank_neon },
+#endif
+};
+
+static const struct blank_kernel_t *kernel;
+
+int blank_kernel_select(int level)
+{
+	if (level == BLANK_KERNEL_AUTO) {
+		level = BLANK_KERNEL_SCALAR;
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			level = BLANK_KERNEL_AVX2;
+		else if (__builtin_cpu_supports("sse2"))
+			level = BLANK_KERNEL_SSE2;
+#elif defined(__aarch64__)
+		level = BLANK_KERNEL_NEON;
+#endif
+	}
+	if (level < 0 || level >= (int)(sizeof(kernels) / sizeof(kernels[0])) ||
+	    kernels[level].name == NULL)
+		return -1;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if ((level == BLANK_KERNEL_AVX2 && !__builtin_cpu_supports("avx2")) ||
+	    (level == BLANK_KERNEL_SSE2 && !__builtin_cpu_supports("sse2")))
+		return -1;
+#endif
+	kernel = &kernels[level];
+
+	return 0;
+}
+
+const char *blank_kernel_name(void)
+{
+	if (kernel == NULL)
+		blank_kernel_select(BLANK_KERNEL_AUTO);
+
+	return kernel->name;
+}
+
+bool blank_check(const void *buf, size_t size)
+{
+	if (kernel == NULL)
+		blank_kernel_select(BLANK_KERNEL_AUTO);
+
+	return kernel->blank(buf, size);
+}
+
+void occmap_destroy(struct occmap_t *map)
+{
+	if (map == NULL)
+		return;
+
+	free(map->page);
+	free(map->sector);
+	free(map);
+}
+
+/*
+ * Pieces of several extents may share a page, a page already known to be
+ * occupied isn't scanned again. Image data beyond 'size' is ignored.
+ */
+struct occmap_t *occmap_create(const struct image_t *img, uint32_t size,
+			       uint32_t pagesize, uint32_t sectorsize)
+{
+	const struct imgext_t *e;
+	struct occmap_t *map;
+	uint32_t a, end, n, pg, sec;
+	unsigned int i;
+
+	map = calloc(1, sizeof(*map));
+	if (map != NULL) {
+		map->size = size;
+		map->pagesize = pagesize;
+		map->sectorsize = sectorsize;
+		map->npages = (size + pagesize - 1) / pagesize;
+		map->nsectors = (size + sectorsize - 1) / sectorsize;
+		map->page = calloc(map->npages / 64 + 1, sizeof(uint64_t));
+		map->sector = calloc(map->nsectors / 64 + 1,
+				     sizeof(uint64_t));
+	}
+	if (map == NULL || map->page == NULL || map->sector == NULL) {
+		fprintf(stderr, "%s: no mem for occupancy map!\n", __func__);
+		occmap_destroy(map);
+		return NULL;
+	}
+
+	TRACE_BEGIN("occupancy");
+	for (i = 0; i < img->next && img->ext[i].addr < size; i++) {
+		e = &img->ext[i];
+		end = e->size > size - e->addr ? size : e->addr + e->size;
+		for (a = e->addr; a < end; a += n) {
+			/* piece of this extent within one page */
+			n = pagesize - (a % pagesize);
+			if (n > end - a)
+				n = end - a;
+			if (occmap_page(map, a) ||
+			    blank_check(&e->data[a - e->addr], n))
+				continue;
+			pg = a / pagesize;
+			sec = a / sectorsize;
+			map->page[pg / 64] |= 1ULL << (pg % 64);
+			map->sector[sec / 64] |= 1ULL << (sec % 64);
+		}
+	}
+	TRACE_END("occupancy");
+
+	return map;
+}
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * blank (0xFF) detection and occupancy bitmaps of images
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#ifndef __LIBBLANK_H__
+#define __LIBBLANK_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <libimage.h>
+
+/* scan kernels, see blank_kernel_select() */
+enum {
+	BLANK_KERNEL_AUTO = -1,
+	BLANK_KERNEL_SCALAR,
+	BLANK_KERNEL_SSE2,
+	BLANK_KERNEL_AVX2,
+	BLANK_KERNEL_NEON,
+};
+
+/*
+ * which pages and sectors of [0, size) hold non blank image data, a set
+ * bit each. Built with one pass over the image, afterwards every blank
+ * check of the erase and program logic is a bit test.
+ */
+struct occmap_t {
+	uint32_t	size;
+	uint32_t	pagesize;
+	uint32_t	sectorsize;
+	uint32_t	npages;
+	uint32_t	nsectors;
+	uint64_t	*page;
+	uint64_t	*sector;
+};
+
+int blank_kernel_select(int level);
+const char *blank_kernel_name(void);
+bool blank_check(const void *buf, size_t size);
+
+struct occmap_t *occmap_create(const struct image_t *img, uint32_t size,
+			       uint32_t pagesize, uint32_t sectorsize);
+void occmap_destroy(struct occmap_t *map);
+
+static inline bool occmap_page(const struct occmap_t *map, uint32_t addr)
+{
+	uint32_t n = addr / map->pagesize;
+
+	return addr < map->size && (map->page[n / 64] >> (n % 64)) & 1;
+}
+
+static inline bool occmap_sector(const struct occmap_t *map, uint32_t addr)
+{
+	uint32_t n = addr / map->sectorsize;
+
+	return addr < map->size && (map->sector[n / 64] >> (n % 64)) & 1;
+}
+
+#endif /* __LIBBLANK_H__ */
@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * persistent per-station settings (last detect, transport tuning, ...)
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "libconf.h"
+#include "osi.h"
+
+#ifndef PATH_MAX
+#define PATH_MAX		260
+#endif
+
+static bool conf_lockflag;
+
+static void conf_lock(void)
+{
+	while (__atomic_test_and_set(&conf_lockflag, __ATOMIC_ACQUIRE))
+		osi_yield();
+}
+
+static void conf_unlock(void)
+{
+	__atomic_clear(&conf_lockflag, __ATOMIC_RELEASE);
+}
+
+static int conf_path(char *path, size_t size)
+{
+	const char *p;
+
+	p = getenv("HPMFLASH_CONF");
+	if (p != NULL) {
+		snprintf(path, size, "%s", p);
+		return 0;
+	}
+#ifdef __MINGW32__
+	p = getenv("APPDATA");
+	if (p == NULL)
+		return -1;
+	snprintf(path, size, "%s\\hpmflash.conf", p);
+#else
+	p = getenv("HOME");
+	if (p == NULL)
+		return -1;
+	snprintf(path, size, "%s/.hpmflash", p);
+#endif
+	return 0;
+}
+
+/* 'line' is "<key> <value>\n", returns the value or NULL if key differs */
+static char *conf_match(char *line, const char *key)
+{
+	size_t n = strlen(key);
+
+	if (strncmp(line, key, n) != 0 || line[n] != ' ')
+		return NULL;
+	line[strcspn(line, "\r\n")] = '\0';
+
+	return &line[n + 1];
+}
+
+int conf_get(const char *key, char *val, size_t size)
+{
+	char path[PATH_MAX], line[CONF_LINEMAX], *v;
+	int rc = -1;
+	FILE *f;
+
+	if (conf_path(path, sizeof(path)) != 0)
+		return -1;
+
+	conf_lock();
+	f = fopen(path, "r");
+	if (f != NULL) {
+		while (fgets(line, sizeof(line), f) != NULL) {
+			v = conf_match(line, key);
+			if (v == NULL)
+				continue;
+			snprintf(val, size, "%s", v);
+			rc = 0;
+		}
+		fclose(f);
+	}
+	conf_unlock();
+
+	return rc;
+}
+
+/* rewrite the file with 'key' replaced or appended, unchanged is a no-op */
+int conf_set(const char *key, const char *val)
+{
+	char path[PATH_MAX], tmp[PATH_MAX + 16], line[CONF_LINEMAX], *v;
+	bool done = false;
+	FILE *f, *fo;
+	int rc = -1;
+
+	if (conf_path(path, sizeof(path)) != 0)
+		return -1;
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+
+	conf_lock();
+	do {
+		f = fopen(path, "r");
+		fo = fopen(tmp, "w");
+		if (fo == NULL)
+			break;
+		while (f != NULL && fgets(line, sizeof(line), f) != NULL) {
+			v = conf_match(line, key);
+			if (v == NULL) {
+				fputs(line, fo);
+				continue;
+			}
+			if (strcmp(v, val) == 0 && done == false)
+				rc = 1;
+			if (done == false)
+				fprintf(fo, "%s %s\n", key, val);
+			done = true;
+		}
+		if (done == false)
+			fprintf(fo, "%s %s\n", key, val);
+		if (f != NULL)
+			fclose(f);
+		if (fclose(fo) != 0) {
+			rc = -1;
+			break;
+		}
+		if (rc == 1) {
+			rc = 0;
+			break;
+		}
+		rc = osi_rename(tmp, path) == 0 ? 0 : -1;
+	} while (0);
+	remove(tmp);
+	conf_unlock();
+
+	if (rc != 0)
+		fprintf(stderr, "%s: cannot store '%s' in %s!\n",
+			__func__, key, path);
+
+	return rc;
+}
@@ -0,0 +1,22 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * persistent per-station settings (last detect, transport tuning, ...)
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#ifndef __LIBCONF_H__
+#define __LIBCONF_H__
+
+#include <stddef.h>
+
+#define CONF_LINEMAX		256
+
+/*
+ * one "<key> <value>" per line in ~/.hpmflash (%APPDATA%\hpmflash.conf on
+ * windows), $HPMFLASH_CONF overrides the location.
+ */
+int conf_get(const char *key, char *val, size_t size);
+int conf_set(const char *key, const char *val);
+
+#endif /* __LIBCONF_H__ */
@@ -0,0 +1,359 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * checksums over image and flash data
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "libdigest.h"
+
+#define CRC32C_POLY		0x82F63B78	/* reflected */
+
+static uint32_t crc32c_table[256];
+static bool crc32c_init;
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void crc32c_mktable(void)
+{
+	uint32_t c;
+	unsigned int i, k;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (k = 0; k < 8; k++)
+			c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+		crc32c_table[i] = c;
+	}
+	__atomic_store_n(&crc32c_init, true, __ATOMIC_RELEASE);
+}
+
+/* all crc kernels work on the inverted crc */
+static uint32_t crc32c_scalar(uint32_t crc, const uint8_t *p, size_t size)
+{
+	if (!__atomic_load_n(&crc32c_init, __ATOMIC_ACQUIRE))
+		crc32c_mktable();
+
+	while (size--)
+		crc = crc32c_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+	return crc;
+}
+
+#define ROR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_scalar(uint32_t *h, const uint8_t *p, size_t nblk)
+{
+	uint32_t w[64], a, b, c, d, e, f, g, hh, t1, t2;
+	unsigned int i;
+
+	for (; nblk != 0; nblk--, p += 64) {
+		for (i = 0; i < 16; i++)
+			w[i] = (uint32_t)p[4 * i] << 24 |
+			       (uint32_t)p[4 * i + 1] << 16 |
+			       (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+		for (; i < 64; i++)
+			w[i] = w[i - 16] + w[i - 7] +
+			       (ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^
+				(w[i - 15] >> 3)) +
+			       (ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^
+				(w[i - 2] >> 10));
+		a = h[0];
+		b = h[1];
+		c = h[2];
+		d = h[3];
+		e = h[4];
+		f = h[5];
+		g = h[6];
+		hh = h[7];
+		for (i = 0; i < 64; i++) {
+			t1 = hh + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) +
+			     ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+			t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) +
+			     ((a & b) ^ (a & c) ^ (b & c));
+			hh = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		h[0] += a;
+		h[1] += b;
+		h[2] += c;
+		h[3] += d;
+		h[4] += e;
+		h[5] += f;
+		h[6] += g;
+		h[7] += hh;
+	}
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, size_t size)
+{
+	uint64_t c = crc, w;
+
+	for (; size >= 8; size -= 8, p += 8) {
+		memcpy(&w, p, sizeof(w));
+		c = _mm_crc32_u64(c, w);
+	}
+	crc = c;
+	while (size--)
+		crc = _mm_crc32_u8(crc, *p++);
+
+	return crc;
+}
+
+/*
+ * SHA-NI: the state is kept as ABEF/CDGH, each sha256rnds2 does two
+ * rounds, sha256msg1/msg2 extend the schedule four words at a time.
+ */
+__attribute__((target("sha,sse4.1")))
+static void sha256_shani(uint32_t *h, const uint8_t *p, size_t nblk)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					     0x0405060700010203ULL);
+	__m128i s0, s1, tmp, msg, abef, cdgh, m[4];
+	unsigned int i;
+
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[0]),
+				0xB1);				/* CDAB */
+	s1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[4]),
+			       0x1B);				/* EFGH */
+	s0 = _mm_alignr_epi8(tmp, s1, 8);			/* ABEF */
+	s1 = _mm_blend_epi16(s1, tmp, 0xF0);			/* CDGH */
+
+	for (; nblk != 0; nblk--, p += 64) {
+		abef = s0;
+		cdgh = s1;
+		for (i = 0; i < 4; i++)
+			m[i] = _mm_shuffle_epi8(
+				_mm_loadu_si128((const __m128i *)(p + 16 * i)),
+				bswap);
+		for (i = 0; i < 16; i++) {
+			msg = _mm_add_epi32(m[i & 3],
+				_mm_loadu_si128((const __m128i *)
+						&sha256_k[4 * i]));
+			s1 = _mm_sha256rnds2_epu32(s1, s0, msg);
+			s0 = _mm_sha256rnds2_epu32(s0, s1,
+						   _mm_shuffle_epi32(msg,
+								     0x0E));
+			if (i >= 12)
+				continue;
+			/* words 4 (i + 4) .. 4 (i + 4) + 3 replace group i */
+			tmp = _mm_add_epi32(
+				_mm_sha256msg1_epu32(m[i & 3], m[(i + 1) & 3]),
+				_mm_alignr_epi8(m[(i + 3) & 3],
+						m[(i + 2) & 3], 4));
+			m[i & 3] = _mm_sha256msg2_epu32(tmp, m[(i + 3) & 3]);
+		}
+		s0 = _mm_add_epi32(s0, abef);
+		s1 = _mm_add_epi32(s1, cdgh);
+	}
+
+	tmp = _mm_shuffle_epi32(s0, 0x1B);			/* FEBA */
+	s1 = _mm_shuffle_epi32(s1, 0xB1);			/* DCHG */
+	s0 = _mm_blend_epi16(tmp, s1, 0xF0);			/* DCBA */
+	s1 = _mm_alignr_epi8(s1, tmp, 8);			/* HGFE */
+	_mm_storeu_si128((__m128i *)&h[0], s0);
+	_mm_storeu_si128((__m128i *)&h[4], s1);
+}
+#endif /* __x86_64__ */
+
+#if defined(__aarch64__)
+#include <arm_acle.h>
+
+__attribute__((target("+crc")))
+static uint32_t crc32c_armv8(uint32_t crc, const uint8_t *p, size_t size)
+{
+	uint64_t w;
+
+	for (; size >= 8; size -= 8, p += 8) {
+		memcpy(&w, p, sizeof(w));
+		crc = __crc32cd(crc, w);
+	}
+	while (size--)
+		crc = __crc32cb(crc, *p++);
+
+	return crc;
+}
+#endif /* __aarch64__ */
+
+static const struct digest_kernel_t {
+	const char	*name;
+	uint32_t	(*crc)(uint32_t crc, const uint8_t *p, size_t size);
+	void		(*sha)(uint32_t *h, const uint8_t *p, size_t nblk);
+} kernels[] = {
+	[DIGEST_KERNEL_SCALAR] = { "scalar", crc32c_scalar, sha256_scalar },
+#if defined(__x86_64__)
+	[DIGEST_KERNEL_SSE42] = { "sse4.2", crc32c_sse42, sha256_scalar },
+	[DIGEST_KERNEL_SHANI] = { "sse4.2/sha-ni", crc32c_sse42, sha256_shani },
+#endif
+#if defined(__aarch64__)
+	[DIGEST_KERNEL_ARMV8] = { "armv8-crc", crc32c_armv8, sha256_scalar },
+#endif
+};
+
+static const struct digest_kernel_t *kernel;
+
+int digest_kernel_select(int level)
+{
+	if (level == DIGEST_KERNEL_AUTO) {
+		level = DIGEST_KERNEL_SCALAR;
+#if defined(__x86_64__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse4.2"))
+			level = __builtin_cpu_supports("sha") ?
+				DIGEST_KERNEL_SHANI : DIGEST_KERNEL_SSE42;
+#elif defined(__aarch64__)
+		/* crc is mandatory since ARMv8.1 */
+		level = DIGEST_KERNEL_ARMV8;
+#endif
+	}
+	if (level < 0 || level >= (int)(sizeof(kernels) / sizeof(kernels[0])) ||
+	    kernels[level].name == NULL)
+		return -1;
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if ((level >= DIGEST_KERNEL_SSE42 &&
+	     !__builtin_cpu_supports("sse4.2")) ||
+	    (level == DIGEST_KERNEL_SHANI && !__builtin_cpu_supports("sha")))
+		return -1;
+#endif
+	kernel = &kernels[level];
+
+	return 0;
+}
+
+const char *digest_kernel_name(void)
+{
+	if (kernel == NULL)
+		digest_kernel_select(DIGEST_KERNEL_AUTO);
+
+	return kernel->name;
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t size)
+{
+	if (kernel == NULL)
+		digest_kernel_select(DIGEST_KERNEL_AUTO);
+
+	return ~kernel->crc(~crc, buf, size);
+}
+
+void sha256_init(struct sha256_t *ctx)
+{
+	static const uint32_t h0[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+
+	memcpy(ctx->h, h0, sizeof(ctx->h));
+	ctx->len = 0;
+}
+
+void sha256_update(struct sha256_t *ctx, const void *buf, size_t size)
+{
+	const uint8_t *p = buf;
+	unsigned int fill = ctx->len % 64;
+	size_t n;
+
+	if (kernel == NULL)
+		digest_kernel_select(DIGEST_KERNEL_AUTO);
+
+	ctx->len += size;
+	if (fill != 0) {
+		n = 64 - fill < size ? 64 - fill : size;
+		memcpy(&ctx->buf[fill], p, n);
+		p += n;
+		size -= n;
+		if (fill + n < 64)
+			return;
+		kernel->sha(ctx->h, ctx->buf, 1);
+	}
+	/* whole blocks straight from the caller's buffer */
+	kernel->sha(ctx->h, p, size / 64);
+	memcpy(ctx->buf, p + size - size % 64, size % 64);
+}
+
+void sha256_final(struct sha256_t *ctx, uint8_t *md)
+{
+	uint64_t bits = ctx->len * 8;
+	uint8_t pad[72] = { 0x80 };
+	unsigned int i, n;
+
+	n = 64 - (ctx->len + 8) % 64;
+	for (i = 0; i < 8; i++)
+		pad[n + i] = bits >> (56 - 8 * i);
+	sha256_update(ctx, pad, n + 8);
+	for (i = 0; i < 32; i++)
+		md[i] = ctx->h[i / 4] >> (24 - 8 * (i % 4));
+}
+
+int digest_alg(const char *name)
+{
+	if (strcmp(name, "crc32c") == 0)
+		return DIGEST_CRC32C;
+	if (strcmp(name, "sha256") == 0)
+		return DIGEST_SHA256;
+
+	return -1;
+}
+
+void digest_init(struct digest_t *d, int alg)
+{
+	d->alg = alg;
+	d->crc = 0;
+	if (alg == DIGEST_SHA256)
+		sha256_init(&d->sha);
+}
+
+void digest_update(struct digest_t *d, const void *buf, size_t size)
+{
+	if (d->alg == DIGEST_SHA256)
+		sha256_update(&d->sha, buf, size);
+	else
+		d->crc = crc32c(d->crc, buf, size);
+}
+
+unsigned int digest_final(struct digest_t *d, uint8_t *md)
+{
+	if (d->alg == DIGEST_SHA256) {
+		sha256_final(&d->sha, md);
+		return 32;
+	}
+	md[0] = d->crc >> 24;
+	md[1] = d->crc >> 16;
+	md[2] = d->crc >> 8;
+	md[3] = d->crc;
+
+	return 4;
+}
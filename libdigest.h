@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * checksums over image and flash data
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#ifndef __LIBDIGEST_H__
+#define __LIBDIGEST_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* kernels, see digest_kernel_select() */
+enum {
+	DIGEST_KERNEL_AUTO = -1,
+	DIGEST_KERNEL_SCALAR,
+	DIGEST_KERNEL_SSE42,	/* crc32c only */
+	DIGEST_KERNEL_SHANI,	/* SSE4.2 crc32c, SHA-NI sha256 */
+	DIGEST_KERNEL_ARMV8,	/* crc32c only */
+};
+
+enum {
+	DIGEST_CRC32C,
+	DIGEST_SHA256,
+};
+
+#define DIGEST_MAXSIZE		32
+
+struct sha256_t {
+	uint32_t	h[8];
+	uint64_t	len;
+	uint8_t		buf[64];
+};
+
+/* streaming digest of either algorithm */
+struct digest_t {
+	int		alg;
+	uint32_t	crc;
+	struct sha256_t	sha;
+};
+
+int digest_kernel_select(int level);
+const char *digest_kernel_name(void);
+
+/* CRC-32C (Castagnoli), start with crc = 0, chain over several buffers */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t size);
+
+void sha256_init(struct sha256_t *ctx);
+void sha256_update(struct sha256_t *ctx, const void *buf, size_t size);
+void sha256_final(struct sha256_t *ctx, uint8_t *md);
+
+/* "crc32c" or "sha256", -1 if unknown */
+int digest_alg(const char *name);
+void digest_init(struct digest_t *d, int alg);
+void digest_update(struct digest_t *d, const void *buf, size_t size);
+/* writes the digest (big endian for crc32c) to 'md', returns its size */
+unsigned int digest_final(struct digest_t *d, uint8_t *md);
+
+#endif /* __LIBDIGEST_H__ */
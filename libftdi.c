@@ -7,15 +7,21 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
 
 #ifdef __linux__
 # include <dlfcn.h>
+# include <unistd.h>
 #elif __MINGW32__
 # include <windows.h>
 #else
 # error "unsupported platform !"
 #endif
 #include "libftdi.h"
+#include "libconf.h"
+#include "spihw.h"
+#include "osi.h"
 
 /* FTDI shared library */
 static char *ftdi_symbols[] = {
@@ -44,7 +50,28 @@ static char *ftdi_symbols[] = {
 
 };
 
-void ftdi_destroy(struct ftdi_funcptr_t *inst)
+/*
+ * the library is loaded once and shared by the CLI and all backend
+ * instances, the device list is enumerated once and then reused.
+ */
+static struct ftdi_funcptr_t *ftdi_shared;
+static unsigned int ftdi_refcnt;
+static FT_DEVICE_LIST_INFO_NODE *ftdi_devinfo;
+static DWORD ftdi_numdevs;
+static bool ftdi_lockflag;
+
+static void ftdi_lock(void)
+{
+	while (__atomic_test_and_set(&ftdi_lockflag, __ATOMIC_ACQUIRE))
+		osi_yield();
+}
+
+static void ftdi_unlock(void)
+{
+	__atomic_clear(&ftdi_lockflag, __ATOMIC_RELEASE);
+}
+
+static void ftdi_free(struct ftdi_funcptr_t *inst)
 {
 	if (inst->libftdi != NULL)
 #ifdef __linux__
@@ -55,6 +82,113 @@ void ftdi_destroy(struct ftdi_funcptr_t *inst)
 	free(inst);
 }
 
+void ftdi_destroy(struct ftdi_funcptr_t *inst)
+{
+	if (inst == NULL)
+		return;
+
+	ftdi_lock();
+	if (inst == ftdi_shared && --ftdi_refcnt == 0) {
+		free(ftdi_devinfo);
+		ftdi_devinfo = NULL;
+		ftdi_numdevs = 0;
+		ftdi_shared = NULL;
+		ftdi_free(inst);
+	}
+	ftdi_unlock();
+}
+
+/* transport profiles differ by host and hub, so they are keyed by both */
+static int ftdi_tune_key(char *key, size_t size, const char *serial)
+{
+	char host[64] = "localhost";
+
+	if (serial == NULL || serial[0] == '\0')
+		return -1;
+#ifdef __MINGW32__
+	if (getenv("COMPUTERNAME") != NULL)
+		snprintf(host, sizeof(host), "%s", getenv("COMPUTERNAME"));
+#else
+	gethostname(host, sizeof(host) - 1);
+#endif
+	host[strcspn(host, " \t")] = '\0';
+	snprintf(key, size, "tune.%s@%s", serial, host);
+
+	return 0;
+}
+
+/* overwrites 'tune' with the stored profile, if there is one */
+int ftdi_tune_load(const char *serial, struct spitune_t *tune)
+{
+	struct spitune_t t;
+	char key[128], val[64];
+
+	if (ftdi_tune_key(key, sizeof(key), serial) != 0 ||
+	    conf_get(key, val, sizeof(val)) != 0)
+		return -1;
+	if (sscanf(val, "%u %u %u", &t.latency, &t.usbsize, &t.chunk) != 3 ||
+	    t.latency == 0 || t.latency > 255 || t.chunk == 0 ||
+	    t.usbsize < 64 || t.usbsize > 0x10000 || t.usbsize % 64 != 0) {
+		fprintf(stderr, "%s: ignoring invalid profile '%s'!\n",
+			__func__, key);
+		return -1;
+	}
+	*tune = t;
+
+	return 0;
+}
+
+int ftdi_tune_store(const char *serial, const struct spitune_t *tune)
+{
+	char key[128], val[64];
+
+	if (ftdi_tune_key(key, sizeof(key), serial) != 0)
+		return -1;
+	snprintf(val, sizeof(val), "%u %u %u",
+		 tune->latency, tune->usbsize, tune->chunk);
+
+	return conf_set(key, val);
+}
+
+/* the (cached) FTDI device list, NULL and *numdevs = 0 on error */
+FT_DEVICE_LIST_INFO_NODE *ftdi_devlist(struct ftdi_funcptr_t *inst,
+				       DWORD *numdevs, bool refresh)
+{
+	FT_STATUS rc;
+
+	ftdi_lock();
+	if (ftdi_devinfo != NULL && refresh == false)
+		goto out;
+
+	free(ftdi_devinfo);
+	ftdi_devinfo = NULL;
+	ftdi_numdevs = 0;
+#ifndef __MINGW32__
+	/* add the altera usb-blaster to ftdi device list */
+	rc = inst->set_vidpid(0x09fb, 0x6001);
+	if (rc != FT_OK)
+		fprintf(stderr, "%s: cannot add 0x09fb:6001 to ftdi devs!\n",
+			__func__);
+#endif
+	rc = inst->createdevlist(&ftdi_numdevs);
+	if (rc != FT_OK || ftdi_numdevs == 0) {
+		ftdi_numdevs = 0;
+		goto out;
+	}
+	ftdi_devinfo = calloc(ftdi_numdevs, sizeof(*ftdi_devinfo));
+	if (ftdi_devinfo == NULL ||
+	    inst->get_devinfo(ftdi_devinfo, &ftdi_numdevs) != FT_OK) {
+		free(ftdi_devinfo);
+		ftdi_devinfo = NULL;
+		ftdi_numdevs = 0;
+	}
+out:
+	*numdevs = ftdi_numdevs;
+	ftdi_unlock();
+
+	return ftdi_devinfo;
+}
+
 struct ftdi_funcptr_t *ftdi_create(void)
 {
 
@@ -64,10 +198,18 @@ struct ftdi_funcptr_t *ftdi_create(void)
 	unsigned int i;
 	unsigned int errorcode = 0;
 
+	ftdi_lock();
+	if (ftdi_shared != NULL) {
+		ftdi_refcnt++;
+		ftdi_unlock();
+		return ftdi_shared;
+	}
+
 	pfunc = calloc(1, sizeof(struct ftdi_funcptr_t));
 	if (pfunc == NULL) {
 		fprintf(stderr,
 			"%s: no mem to create ftdi instance!\n", __func__);
+		ftdi_unlock();
 		return NULL;
 	}
 
@@ -95,7 +237,8 @@ struct ftdi_funcptr_t *ftdi_create(void)
 		fprintf(stderr,
 			"%s: cannot access %s (err=%d)!\n",
 			__func__, libname, errorcode);
-		ftdi_destroy(pfunc);
+		ftdi_free(pfunc);
+		ftdi_unlock();
 
 		return NULL;
 	}
@@ -126,8 +269,15 @@ struct ftdi_funcptr_t *ftdi_create(void)
 			break;
 		}
 
+		ftdi_shared = pfunc;
+		ftdi_refcnt = 1;
+		ftdi_unlock();
+
 		return pfunc;
 	} while (0);
 
+	ftdi_free(pfunc);
+	ftdi_unlock();
+
 	return NULL;
 }
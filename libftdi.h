@@ -8,6 +8,7 @@
 #ifndef __LIBFTDI_H__
 #define __LIBFTDI_H__
 
+#include <stdbool.h>
 #include <ftd2xx.h>
 
 struct ftdi_funcptr_t {
@@ -49,6 +50,12 @@ struct ftdi_funcptr_t {
 	void *libftdi;
 };
 
+struct spitune_t;
+
+int ftdi_tune_load(const char *serial, struct spitune_t *tune);
+int ftdi_tune_store(const char *serial, const struct spitune_t *tune);
+FT_DEVICE_LIST_INFO_NODE *ftdi_devlist(struct ftdi_funcptr_t *inst,
+				       DWORD *numdevs, bool refresh);
 void ftdi_destroy(struct ftdi_funcptr_t *inst);
 struct ftdi_funcptr_t *ftdi_create(void);
 
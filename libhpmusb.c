@@ -16,159 +16,392 @@
 
 #define FTDI_TIMEOUT		2500
 #define FTDI_LATENCY		1
+#define FTDI_USBSIZE		0x10000
 
+#define MPSSE_SYNC_TIMEOUT	20	/* ms to wait for the echo */
+#define MPSSE_SYNC_TRIES	50
+
+#define MPSSE_WRITE_NEG		0x01
+#define MPSSE_DO_WRITE		0x10
+#define MPSSE_DO_READ		0x20
+
+/*
+ * channel A: SCK, MOSI, MISO, TMS, CS0..3 on ADBUS0..7, CS2 is the config
+ *            register of the FPGA (nCE, target reset, LED, routing)
+ * channel B: SCK, MOSI, MISO on BDBUS0..2, CS0..3 on BDBUS3..6, plain SPI
+ */
+static const struct hpmusb_pinmap_t pinmaps[] = {
+	{
+	  .desc		= "Quad RS232-HS A",
+	  .idle		= 0xF8,
+	  .dir		= 0xFB,
+	  .tms		= 0x08,
+	  .fpgacs	= 2,
+	  .cs		= { 0x10, 0x20, 0x40, 0x80 },
+	},
+	{
+	  .desc		= "Quad RS232-HS B",
+	  .idle		= 0xF8,
+	  .dir		= 0xFB,
+	  .tms		= 0,
+	  .fpgacs	= -1,
+	  .cs		= { 0x08, 0x10, 0x20, 0x40 },
+	},
+	{ .desc = NULL },
+};
+
+/*
+ * sync to the MPSSE: send a bad command and wait for its echo (0xFA, cmd).
+ * Driven by a short read timeout, the driver wakes us as soon as the echo
+ * is there; stale bytes in front of it are skipped.
+ */
 static int mpsse_probe(struct spihw_t *spi, bool retry, unsigned char probecmd)
 {
-	uint8_t xbuf[32] = { };
-	DWORD writeb, readb, avail;
 	bool checknext = false;
+	DWORD writeb, readb;
+	unsigned int i;
 	FT_STATUS rc;
-	unsigned int i, j;
+	uint8_t b;
+	int ret = -1;
 
-	if (retry == false) {
-		xbuf[0] = probecmd;
-		rc = spi->ftdifunc->write(spi->fthandle, xbuf, 1, &writeb);
-		if (rc != FT_OK) {
-			fprintf(stderr,
-				"%s: cannot write to FTx232.\n",
-				__func__);
-			return -1;
-		}
+	TRACE_BEGIN_ARG("mpsse sync", probecmd);
+	rc = spi->ftdifunc->set_timeout(spi->fthandle,
+					MPSSE_SYNC_TIMEOUT, FTDI_TIMEOUT);
+	if (rc != FT_OK) {
+		fprintf(stderr,
+			"%s: cannot setup timeouts.\n", __func__);
+		TRACE_END("mpsse sync");
+		return -1;
 	}
 
-	i = 0;
-	do {
-		if (retry == true) {
-			xbuf[0] = probecmd;
+	for (i = 0; i < MPSSE_SYNC_TRIES && ret != 0; i++) {
+		if (i == 0 || retry == true) {
 			rc = spi->ftdifunc->write(spi->fthandle,
-						  xbuf, 1, &writeb);
+						  &probecmd, 1, &writeb);
 			if (rc != FT_OK) {
 				fprintf(stderr,
 					"%s: cannot write to FTx232.\n",
 					__func__);
-				return -1;
+				break;
 			}
 		}
-		rc = spi->ftdifunc->get_queuestat(spi->fthandle, &avail);
-		if (rc != FT_OK) {
-			fprintf(stderr,
-				"%s: cannot get queue status of FTx232.\n",
-				__func__);
-			return -1;
-		}
-		if (avail == 0) {
-			_usleep(50 * 1000);
-			i++;
-			continue;
-		} else if (avail > sizeof(xbuf)) {
-			fprintf(stderr,
-				"%s: response from FTx232 too large for xbuf.\n",
-				__func__);
-			return -1;
-		}
-		/* check result */
-		rc = spi->ftdifunc->read(spi->fthandle, xbuf, avail, &readb);
-		if (rc != FT_OK) {
-			fprintf(stderr,
-				"%s: cannot read from FTx232.\n",
-				__func__);
-			return -1;
-		}
-		j = 0;
-		while (readb) {
-			if (xbuf[j] == 0xFA) {
-				checknext = true;
-			} else if (checknext == true) {
-				if (xbuf[j] == probecmd)
-					return 0;
-				checknext = false;
+		/* consume bytes until the echo or a read timeout */
+		do {
+			rc = spi->ftdifunc->read(spi->fthandle, &b, 1, &readb);
+			if (rc != FT_OK) {
+				fprintf(stderr,
+					"%s: cannot read from FTx232.\n",
+					__func__);
+				i = MPSSE_SYNC_TRIES;
+				break;
 			}
-			j++;
-			readb--;
-		}
-		_usleep(10 * 1000);
-		i++;
-	} while (i < 512);
+			if (readb == 0)
+				break;
+			if (checknext == true && b == probecmd)
+				ret = 0;
+			checknext = b == 0xFA;
+		} while (ret != 0);
+	}
+
+	/* back to the transfer timeouts */
+	rc = spi->ftdifunc->set_timeout(spi->fthandle,
+					FTDI_TIMEOUT, FTDI_TIMEOUT);
+	if (rc != FT_OK)
+		ret = -1;
+	TRACE_END("mpsse sync");
 
-	return -1;
+	return ret;
 }
 
+static int hpmusb_resync(struct spihw_t *spi);
 static int spi_trx(struct spihw_t *spi, unsigned int cs,
-		   uint8_t *out, uint8_t *in, size_t size)
+		   uint8_t *out, uint8_t *in, size_t size);
+static int spi_trxv(struct spihw_t *spi, unsigned int cs,
+		    const struct spiseg_t *seg, unsigned int nseg);
+
+unsigned int hpmusb_encode(struct hpmusb_priv_t *priv, uint8_t *xbuf,
+			   uint8_t cmd, const uint8_t *out, unsigned int size,
+			   const uint8_t *data, unsigned int datasize,
+			   bool last)
 {
-	struct hpmusb_priv_t *priv = (struct hpmusb_priv_t *)spi->priv;
-	uint8_t xbuf[0x10000] = { };
-	uint16_t trxsize;
-	unsigned int i = 0;
-	unsigned int payloadsize;
-	DWORD writeb, readb;
+	unsigned int i = 0, total = size + datasize;
+
+	/* setup transfer, 'out' and 'data' make up one shift */
+	xbuf[i++] = cmd;
+	xbuf[i++] = (total - 1) & 0xFF;
+	xbuf[i++] = ((total - 1) & 0xFF00) >> 8;
+
+	memcpy(&xbuf[i], out, size);
+	i += size;
+	if (datasize != 0)
+		memcpy(&xbuf[i], data, datasize);
+	i += datasize;
+
+	/* is the transfer finished after this? de-assert chipselect */
+	if (last) {
+		priv->portstate |= priv->csmsk;
+		xbuf[i++] = 0x80;
+		xbuf[i++] = priv->portstate;
+		xbuf[i++] = priv->dir;
+	}
+
+	return i;
+}
+
+static int mpsse_read(struct spihw_t *spi, uint8_t *in, unsigned int size)
+{
+	DWORD readb;
 	FT_STATUS rc;
-	uint8_t csmasks[] = { 0x10, 0x20, 0x40, 0x80  };
 
-	if (cs > 3) {
+	TRACE_BEGIN_ARG("FT_Read", size);
+	rc = spi->ftdifunc->read(spi->fthandle, in, size, &readb);
+	TRACE_END("FT_Read");
+	if (rc != FT_OK) {
 		fprintf(stderr,
-			"%s: cs %d out of range (0 - 3).\n",
-			__func__, cs);
+			"%s: cannot read from FTx232.\n", __func__);
 		return -1;
 	}
-	priv->csmsk = csmasks[cs];
+	if (readb != size) {
+		fprintf(stderr,
+			"%s: FTx232 data out of sync.\n", __func__);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* write the command buffer, then fetch the answers straight into 'rd' */
+static int trxv_flush(struct spihw_t *spi, uint8_t *xbuf, unsigned int len,
+		      const struct spiseg_t *rd, unsigned int nrd)
+{
+	DWORD writeb;
+	FT_STATUS rc;
+	unsigned int n;
+
+	TRACE_BEGIN_ARG("FT_Write", len);
+	rc = spi->ftdifunc->write(spi->fthandle, xbuf, len, &writeb);
+	TRACE_END("FT_Write");
+	if (rc != FT_OK) {
+		fprintf(stderr,
+			"%s: cannot write job to FTx232.\n", __func__);
+		return -1;
+	}
+	for (n = 0; n < nrd; n++)
+		if (mpsse_read(spi, rd[n].in, rd[n].size) != 0)
+			return -1;
+
+	return 0;
+}
+
+/*
+ * Every segment becomes an MPSSE command of its own: read only where the
+ * caller wants the answer, a don't-care 'out' with read is clocked by a
+ * read-only command, so nothing but the header travels to the adapter.
+ * Per USB write up to 'chunk' bytes are shifted, chipselect stays
+ * asserted between the writes.
+ */
+static int spi_trxv_once(struct spihw_t *spi, unsigned int cs,
+			 const struct spiseg_t *seg, unsigned int nseg)
+{
+	struct hpmusb_priv_t *priv = (struct hpmusb_priv_t *)spi->priv;
+	uint8_t xbuf[HPMUSB_XBUFSIZE];
+	struct spiseg_t rd[HPMUSB_RDSEGS];
+	unsigned int i = 0, n = 0, nrd = 0, shifted = 0, room;
+	size_t off = 0, piece;
+	uint8_t cmd;
+
+	priv->csmsk = priv->pin->cs[cs];
 
 	/* assert chipselect */
 	priv->portstate &= ~priv->csmsk;
-	xbuf[i++] = 0x80;		/* setup port and drivers Bus A */
+	xbuf[i++] = 0x80;		/* setup port and drivers */
 	xbuf[i++] = priv->portstate;	/* value */
-	xbuf[i++] = 0xFB;		/* direction */
-
-	while (size != 0) {
-		trxsize = size > (0x10000 - 6) ? (0x10000 - 6) : size;
+	xbuf[i++] = priv->dir;		/* direction */
 
-		/* setup transfer */
-		xbuf[i++] = priv->trxcmd;
-		xbuf[i++] = (trxsize - 1) & 0xFF;
-		xbuf[i++] = ((trxsize - 1) & 0xFF00) >> 8;
-
-		payloadsize = 0;
-		while (trxsize--) {
-			payloadsize++;
-			xbuf[i++] = *out++;
+	while (n < nseg) {
+		if (off == seg[n].size) {
+			n++;
+			off = 0;
+			continue;
+		}
+		/* keep room for the command and de-asserting chipselect */
+		room = i + 6 < HPMUSB_XBUFSIZE ? HPMUSB_XBUFSIZE - 6 - i : 0;
+		piece = seg[n].size - off;
+		if (piece > spi->tune.chunk - shifted)
+			piece = spi->tune.chunk - shifted;
+		if (piece > room && (seg[n].out != NULL || seg[n].in == NULL))
+			piece = room;
+		if (room == 0 || (seg[n].in != NULL && nrd == HPMUSB_RDSEGS))
+			piece = 0;
+		if (piece == 0) {
+			if (trxv_flush(spi, xbuf, i, rd, nrd) != 0)
+				return -1;
+			i = 0;
+			nrd = 0;
+			shifted = 0;
+			continue;
 		}
 
-		/* is the transfer finished after this? de-assert chipselect */
-		if ((size - payloadsize) == 0) {
-			priv->portstate |= priv->csmsk;
-			xbuf[i++] = 0x80;
-			xbuf[i++] = priv->portstate;
-			xbuf[i++] = 0xFB;
+		if (seg[n].in == NULL)
+			cmd = priv->trxcmd & ~MPSSE_DO_READ;
+		else if (seg[n].out == NULL)
+			cmd = priv->trxcmd &
+			      ~(MPSSE_DO_WRITE | MPSSE_WRITE_NEG);
+		else
+			cmd = priv->trxcmd;
+		xbuf[i++] = cmd;
+		xbuf[i++] = (piece - 1) & 0xFF;
+		xbuf[i++] = ((piece - 1) & 0xFF00) >> 8;
+		if (seg[n].out != NULL) {
+			memcpy(&xbuf[i], &seg[n].out[off], piece);
+			i += piece;
+		} else if (seg[n].in == NULL) {
+			/* nothing to send nor to keep, clock zeros */
+			memset(&xbuf[i], 0, piece);
+			i += piece;
 		}
+		if (seg[n].in != NULL)
+			rd[nrd++] = (struct spiseg_t) { NULL, &seg[n].in[off],
+							piece };
+		shifted += piece;
+		off += piece;
+	}
 
-		rc = spi->ftdifunc->write(spi->fthandle, xbuf, i, &writeb);
-		if (rc != FT_OK) {
-			fprintf(stderr,
-				"%s: cannot write job to FTx232.\n",
-				__func__);
+	/* de-assert chipselect */
+	priv->portstate |= priv->csmsk;
+	xbuf[i++] = 0x80;
+	xbuf[i++] = priv->portstate;
+	xbuf[i++] = priv->dir;
+
+	return trxv_flush(spi, xbuf, i, rd, nrd);
+}
+
+static int spi_trx_once(struct spihw_t *spi, unsigned int cs,
+			uint8_t *out, uint8_t *in, size_t size)
+{
+	struct spiseg_t seg = { out, in, size };
+
+	return spi_trxv_once(spi, cs, &seg, 1);
+}
+
+/*
+ * the encoded batch is self-contained (absolute GPIO states, data) and
+ * responses are scattered only on success, so a read-only one can simply
+ * be resent. A batch with a gated command is not, a cut off PP or erase
+ * leaves the chip busy and it would ignore the second WREN + command.
+ */
+static int batch_flush(struct spihw_t *spi, uint8_t *xbuf, unsigned int len,
+		       struct spixfer_t *xfer, unsigned int cnt)
+{
+	uint8_t rbuf[HPMUSB_XBUFSIZE];
+	struct spiseg_t rd = { NULL, rbuf, 0 };
+	unsigned int rsize = 0, n, retry;
+	bool gated = false;
+
+	if (len == 0)
+		return 0;
+
+	for (n = 0; n < cnt; n++) {
+		if (xfer[n].in != NULL)
+			rsize += xfer[n].size;
+		if (spihw_wrgated(xfer[n].out, xfer[n].size))
+			gated = true;
+	}
+
+	rd.size = rsize;
+	for (retry = 0; trxv_flush(spi, xbuf, len, &rd, rsize != 0) != 0;
+	     retry++) {
+		spi->stat.errors++;
+		if (retry == SPIHW_RETRIES || hpmusb_resync(spi) != 0) {
+			spi->stat.fatal++;
 			return -1;
 		}
+		/* the flash layer repeats it once the chip is idle */
+		if (gated)
+			return -1;
+		spi->stat.retries++;
+	}
+	if (rsize == 0)
+		return 0;
 
-		rc = spi->ftdifunc->read(spi->fthandle,
-					 in, payloadsize, &readb);
-		if (rc != FT_OK) {
+	/* scatter responses back */
+	rsize = 0;
+	for (n = 0; n < cnt; n++) {
+		if (xfer[n].in == NULL)
+			continue;
+		memcpy(xfer[n].in, &rbuf[rsize], xfer[n].size);
+		rsize += xfer[n].size;
+	}
+
+	return 0;
+}
+
+/* a shift beyond one command buffer, split by spi_trxv() */
+static int spi_trx_big(struct spihw_t *spi, struct spixfer_t *xfer)
+{
+	const struct spiseg_t seg[2] = {
+		{ xfer->out, xfer->in, xfer->size },
+		{ xfer->data, NULL, xfer->datasize },
+	};
+
+	if (xfer->datasize == 0)
+		return spi_trx(spi, xfer->cs, xfer->out, xfer->in, xfer->size);
+
+	return spi_trxv(spi, xfer->cs, seg, 2);
+}
+
+/*
+ * encode as many shifts as fit into one MPSSE command buffer, each framed
+ * by its own chipselect, and exchange them with a single write/read.
+ */
+static int spi_trx_batch(struct spihw_t *spi,
+			 struct spixfer_t *xfer, unsigned int cnt)
+{
+	struct hpmusb_priv_t *priv = (struct hpmusb_priv_t *)spi->priv;
+	uint8_t xbuf[HPMUSB_XBUFSIZE];
+	unsigned int i = 0, n, first = 0;
+	size_t total;
+	uint8_t cmd;
+
+	for (n = 0; n < cnt; n++) {
+		if (xfer[n].cs > 3 || priv->pin->cs[xfer[n].cs] == 0) {
 			fprintf(stderr,
-				"%s: cannot read from FTx232.\n",
-				__func__);
+				"%s: cs %d not wired on '%s'.\n",
+				__func__, xfer[n].cs, priv->pin->desc);
 			return -1;
 		}
-		if (readb != payloadsize) {
-			fprintf(stderr,
-				"%s: FTx232 data out of sync.\n",
-				__func__);
-			return -1;
+		/* doesn't fit at all, or not anymore: flush what we have */
+		total = xfer[n].size + xfer[n].datasize;
+		if (total == 0 || total > spi->tune.chunk ||
+		    i + total + 9 > spi->tune.chunk + 12) {
+			if (batch_flush(spi, xbuf, i, &xfer[first],
+					n - first) != 0)
+				return -1;
+			i = 0;
+			first = n;
 		}
-		i = 0;
-		size -= payloadsize;
-		in += payloadsize;
+		if (total == 0 || total > spi->tune.chunk) {
+			if (total != 0 && spi_trx_big(spi, &xfer[n]) != 0)
+				return -1;
+			first = n + 1;
+			continue;
+		}
+
+		priv->csmsk = priv->pin->cs[xfer[n].cs];
+		cmd = xfer[n].in != NULL ?
+		      priv->trxcmd : priv->trxcmd & ~MPSSE_DO_READ;
+
+		/* assert chipselect */
+		priv->portstate &= ~priv->csmsk;
+		xbuf[i++] = 0x80;
+		xbuf[i++] = priv->portstate;
+		xbuf[i++] = priv->dir;
+		i += hpmusb_encode(priv, &xbuf[i], cmd, xfer[n].out,
+				   xfer[n].size, xfer[n].data, xfer[n].datasize,
+				   true);
 	}
 
-	return 0;
+	return batch_flush(spi, xbuf, i, &xfer[first], cnt - first);
 }
 
 static int spi_setspeedmode(struct spihw_t *spi,
@@ -221,9 +454,9 @@ static int spi_setspeedmode(struct spihw_t *spi,
 	}
 
 	/* setup GPIO port */
-	xbuf[i++] = 0x80;		/* setup port and drivers Bus A */
+	xbuf[i++] = 0x80;		/* setup port and drivers */
 	xbuf[i++] = priv->portstate;	/* value */
-	xbuf[i++] = 0xFB;		/* direction */
+	xbuf[i++] = priv->dir;		/* direction */
 	/* loopback off */
 	xbuf[i++] = 0x85;
 
@@ -253,16 +486,98 @@ static int spi_setspeedmode(struct spihw_t *spi,
 	return 0;
 }
 
+/*
+ * back in step after a failed transaction: drop whatever is queued, sync
+ * to the MPSSE command parser and restore clock, GPIOs and FPGA register
+ */
+static int hpmusb_resync(struct spihw_t *spi)
+{
+	struct hpmusb_priv_t *priv = (struct hpmusb_priv_t *)spi->priv;
+	uint8_t xbuf[256];
+	DWORD avail, readb, xsize;
+	unsigned int i;
+	FT_STATUS rc;
+
+	TRACE_BEGIN("resync");
+	rc = spi->ftdifunc->purge(spi->fthandle, FT_PURGE_RX | FT_PURGE_TX);
+	while (rc == FT_OK) {
+		rc = spi->ftdifunc->get_queuestat(spi->fthandle, &avail);
+		if (rc != FT_OK || avail == 0)
+			break;
+		xsize = avail > sizeof(xbuf) ? sizeof(xbuf) : avail;
+		rc = spi->ftdifunc->read(spi->fthandle, xbuf, xsize, &readb);
+	}
+	if (rc != FT_OK || mpsse_probe(spi, true, 0xAA) != 0) {
+		fprintf(stderr, "%s: MPSSE doesn't answer!\n", __func__);
+		TRACE_END("resync");
+		return -1;
+	}
+
+	/* all chipselects released, then divider and GPIOs */
+	for (i = 0; i < 4; i++)
+		priv->portstate |= priv->pin->cs[i];
+	if (spi_setspeedmode(spi, spi->speed, spi->mode) != 0 ||
+	    (priv->pin->fpgacs >= 0 &&
+	     spi_trx_once(spi, priv->pin->fpgacs, &priv->fpga_cfg,
+			  NULL, 1) != 0)) {
+		TRACE_END("resync");
+		return -1;
+	}
+	spi->stat.resyncs++;
+	TRACE_END("resync");
+
+	return 0;
+}
+
+static int spi_trxv(struct spihw_t *spi, unsigned int cs,
+		    const struct spiseg_t *seg, unsigned int nseg)
+{
+	struct hpmusb_priv_t *priv = (struct hpmusb_priv_t *)spi->priv;
+
+	if (cs > 3 || priv->pin->cs[cs] == 0) {
+		fprintf(stderr,
+			"%s: cs %d not wired on '%s'.\n",
+			__func__, cs, priv->pin->desc);
+		return -1;
+	}
+
+	return spihw_trxv_retry(spi, cs, seg, nseg, spi_trxv_once,
+				hpmusb_resync);
+}
+
+static int spi_trx(struct spihw_t *spi, unsigned int cs,
+		   uint8_t *out, uint8_t *in, size_t size)
+{
+	struct spiseg_t seg = { out, in, size };
+
+	return spi_trxv(spi, cs, &seg, 1);
+}
+
+/* just the GPIO update, no round trip - it is queued ahead of the next shift */
 static int set_clr_tms(struct spihw_t *spi, bool set_nclear)
 {
 	struct hpmusb_priv_t *priv = (struct hpmusb_priv_t *)spi->priv;
+	uint8_t xbuf[3];
+	DWORD writeb;
+	FT_STATUS rc;
+
+	if (priv->pin->tms == 0)
+		return 0;
 
 	if (set_nclear == true)
-		priv->portstate |= 0x8;
+		priv->portstate |= priv->pin->tms;
 	else
-		priv->portstate &= ~0x8;
+		priv->portstate &= ~priv->pin->tms;
 
-	spi_setspeedmode(spi, 0, -1);
+	xbuf[0] = 0x80;
+	xbuf[1] = priv->portstate;
+	xbuf[2] = priv->dir;
+	rc = spi->ftdifunc->write(spi->fthandle, xbuf, sizeof(xbuf), &writeb);
+	if (rc != FT_OK) {
+		fprintf(stderr,
+			"%s: cannot write GPIO to FTx232.\n", __func__);
+		return -1;
+	}
 
 	return 0;
 }
@@ -272,14 +587,16 @@ static int set_clr_nce(struct spihw_t *spi, bool set_nclear)
 	struct spiops_t *ops = spi->ops;
 	struct hpmusb_priv_t *priv = (struct hpmusb_priv_t *)spi->priv;
 	int rc;
-	uint8_t buf;
+
+	if (priv->pin->fpgacs < 0)
+		return 0;
 
 	if (set_nclear == true)
 		priv->fpga_cfg |= 0x80;
 	else
 		priv->fpga_cfg &= ~0x80;
 
-	rc = ops->trx(spi, 2, &priv->fpga_cfg, &buf, 1);
+	rc = ops->trx(spi, priv->pin->fpgacs, &priv->fpga_cfg, NULL, 1);
 	if (rc != 0) {
 		fprintf(stderr,
 			"%s: FPGA setup failed!\n", __func__);
@@ -297,7 +614,7 @@ static int spi_claim(struct spihw_t *spi)
 	int rc;
 	uint8_t xbuf;
 
-	priv->portstate = 0xF8;
+	priv->portstate = priv->pin->idle;
 
 	rc = ops->set_speed_mode(spi, 6000000, 1);
 	if (rc != 0) {
@@ -305,6 +622,8 @@ static int spi_claim(struct spihw_t *spi)
 			"%s: set_speed_mode failed!\n", __func__);
 		return -1;
 	}
+	if (priv->pin->fpgacs < 0)
+		return 0;
 	/*
 	 * Bit7 = 0 ... TGT_nCE
 	 * Bit6 = 0 ... assert target reset
@@ -317,7 +636,7 @@ static int spi_claim(struct spihw_t *spi)
 	 */
 	priv->fpga_cfg = 0xF;
 
-	ops->trx(spi, 2, &priv->fpga_cfg, &xbuf, 1);
+	rc = ops->trx(spi, priv->pin->fpgacs, &priv->fpga_cfg, &xbuf, 1);
 	if (rc != 0) {
 		fprintf(stderr,
 			"%s: FPGA setup failed!\n", __func__);
@@ -333,24 +652,53 @@ static int spi_release(struct spihw_t *spi)
 {
 	struct spiops_t *ops = spi->ops;
 	struct hpmusb_priv_t *priv = (struct hpmusb_priv_t *)spi->priv;
-	uint8_t xbuf;
 
 	/* reset TMS to initial (high) state */
 	set_clr_tms(spi, true);
 
+	if (priv->pin->fpgacs < 0)
+		return 0;
+
 	/* reset io-shiftregister */
 	priv->fpga_cfg = 0xFF;
-	return ops->trx(spi, 2, &priv->fpga_cfg, &xbuf, 1);
+	return ops->trx(spi, priv->pin->fpgacs, &priv->fpga_cfg, NULL, 1);
 
 }
 
+static int spi_set_tune(struct spihw_t *spi, const struct spitune_t *tune)
+{
+	FT_STATUS rc;
+
+	rc = spi->ftdifunc->set_usbpar(spi->fthandle,
+				       tune->usbsize, tune->usbsize);
+	if (rc != FT_OK) {
+		fprintf(stderr,
+			"%s: cannot set usb paket size.\n", __func__);
+		return -1;
+	}
+	rc = spi->ftdifunc->set_latency(spi->fthandle, tune->latency);
+	if (rc != FT_OK) {
+		fprintf(stderr,
+			"%s: cannot setup latency timer.\n", __func__);
+		return -1;
+	}
+	spi->tune = *tune;
+	if (spi->tune.chunk == 0 || spi->tune.chunk > HPMUSB_CHUNK)
+		spi->tune.chunk = HPMUSB_CHUNK;
+
+	return 0;
+}
+
 static const struct spiops_t ops = {
 	.trx = &spi_trx,
+	.trxv = &spi_trxv,
+	.trx_batch = &spi_trx_batch,
 	.claim = &spi_claim,
 	.release = &spi_release,
 	.set_clr_tms = set_clr_tms,
 	.set_clr_nce = set_clr_nce,
 	.set_speed_mode = spi_setspeedmode,
+	.set_tune = spi_set_tune,
 };
 
 void hpmusb_destroy(struct spihw_t *spi)
@@ -369,10 +717,17 @@ void hpmusb_destroy(struct spihw_t *spi)
 struct spihw_t *hpmusb_create(unsigned int ftdi_devidx)
 {
 	struct spihw_t *spi;
+	struct spitune_t tune = {
+		.latency = FTDI_LATENCY,
+		.usbsize = FTDI_USBSIZE,
+		.chunk = HPMUSB_CHUNK,
+	};
 	uint8_t xbuf[256] = { };
+	char serial[16] = { };
 	DWORD avail, readb;
 	FT_STATUS rc;
 	struct hpmusb_priv_t *priv;
+	const struct hpmusb_pinmap_t *pin;
 
 
 	spi = calloc(1, sizeof(*spi));
@@ -418,19 +773,25 @@ struct spihw_t *hpmusb_create(unsigned int ftdi_devidx)
 		/* test for valid description string */
 		rc = spi->ftdifunc->get_deviceinfo(spi->fthandle,
 						   NULL, NULL,
-						   NULL, xbuf, NULL);
+						   serial, xbuf, NULL);
 		if (rc != FT_OK) {
 			fprintf(stderr,
 				"%s: cannot querry device info string!\n",
 				__func__);
 			break;
 		}
-		if (strcmp(xbuf, "Quad RS232-HS A") != 0) {
+		for (pin = pinmaps; pin->desc != NULL; pin++) {
+			if (strcmp(xbuf, pin->desc) == 0)
+				break;
+		}
+		if (pin->desc == NULL) {
 			fprintf(stderr,
-				"device description '%s' doesn't match '%s'.\n",
-				xbuf, "Quad RS232-HS A");
+				"device description '%s' is no hpm-blaster channel.\n",
+				xbuf);
 			break;
 		}
+		priv->pin = pin;
+		priv->dir = pin->dir;
 		/* reset FTDI device */
 		rc = spi->ftdifunc->reset(spi->fthandle);
 		if (rc != FT_OK) {
@@ -467,14 +828,6 @@ struct spihw_t *hpmusb_create(unsigned int ftdi_devidx)
 			}
 			avail -= xsize;
 		}
-		/* setup paket size */
-		rc = spi->ftdifunc->set_usbpar(spi->fthandle, 0x10000, 0x10000);
-		if (rc != FT_OK) {
-			fprintf(stderr,
-				"%s: cannot set usb paket size.\n",
-				__func__);
-			break;
-		}
 		/* setup timeouts for usb-transfers */
 		rc = spi->ftdifunc->set_timeout(spi->fthandle,
 						FTDI_TIMEOUT, FTDI_TIMEOUT);
@@ -483,13 +836,10 @@ struct spihw_t *hpmusb_create(unsigned int ftdi_devidx)
 				"%s: cannot setup timeouts.\n", __func__);
 			break;
 		}
-		/* setup latency timer */
-		rc = spi->ftdifunc->set_latency(spi->fthandle, FTDI_LATENCY);
-		if (rc != FT_OK) {
-			fprintf(stderr,
-				"%s: cannot setup latency timer.\n", __func__);
+		/* paket size, latency timer: tuned profile or defaults */
+		ftdi_tune_load(serial, &tune);
+		if (spi_set_tune(spi, &tune) != 0)
 			break;
-		}
 		/* disable event/error characters */
 		rc = spi->ftdifunc->set_chars(spi->fthandle, 0, 0, 0, 0);
 		if (rc != FT_OK) {
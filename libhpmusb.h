@@ -11,13 +11,38 @@
 #include <libftdi.h>
 #include <spihw.h>
 
+/* max. payload of one MPSSE shift job, command buffer incl. cs framing */
+#define HPMUSB_CHUNK		(0x10000 - 6)
+#define HPMUSB_XBUFSIZE		(HPMUSB_CHUNK + 12)
+/* answered segment pieces of a vectored shift per USB write */
+#define HPMUSB_RDSEGS		16
+
+/*
+ * wiring of one MPSSE channel, every channel of the FT4232H is a bus of
+ * its own, selected by the description of the opened FTDI interface
+ */
+struct hpmusb_pinmap_t {
+	const char	*desc;		/* FTDI description of the channel */
+	uint8_t		idle;		/* GPIO state, all CS high, SCK low */
+	uint8_t		dir;		/* GPIO direction */
+	uint8_t		tms;		/* TMS pin, 0 if not wired */
+	int		fpgacs;		/* FPGA config register, -1 if none */
+	uint8_t		cs[4];		/* chipselect pins, 0 if not wired */
+};
+
 struct hpmusb_priv_t {
+	const struct hpmusb_pinmap_t *pin;
 	uint8_t		portstate;
+	uint8_t		dir;
 	uint8_t		fpga_cfg;
 	uint8_t		csmsk;
 	uint8_t		trxcmd;
 };
 
+unsigned int hpmusb_encode(struct hpmusb_priv_t *priv, uint8_t *xbuf,
+			   uint8_t cmd, const uint8_t *out, unsigned int size,
+			   const uint8_t *data, unsigned int datasize,
+			   bool last);
 void hpmusb_destroy(struct spihw_t *spi);
 struct spihw_t *hpmusb_create(unsigned int ftdi_devidx);
 
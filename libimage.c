@@ -0,0 +1,684 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * sparse flash images: raw binary, Intel HEX, Motorola S-record, ELF
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+
+#include <libtrace.h>
+#include <libblank.h>
+#include "libimage.h"
+#include "libunpack.h"
+#include "osi.h"
+
+#define IMAGE_BLOCK	0x10000		/* decoder output per round */
+#define IMAGE_PAGE	0x100		/* granularity of blank detection */
+
+/* decoder state of text and compressed formats, data is collected in 'raw' */
+struct imgbuild_t {
+	struct image_t	*img;
+	const char	*name;
+	unsigned int	line;
+	size_t		*off;		/* offset of the extent data in raw */
+	unsigned int	maxext;
+	uint8_t		*raw;
+	size_t		rawsize;
+	size_t		rawmax;
+};
+
+struct imgjob_t {
+	osi_thread_t	thread;
+	bool		joined;
+	int		rc;
+	struct unpack_t	*u;
+	char		*name;
+	char		format[32];
+	uint32_t	offset;
+	uint32_t	size;
+};
+
+static int ext_cmp(const void *a, const void *b)
+{
+	const struct imgext_t *ea = a, *eb = b;
+
+	return ea->addr < eb->addr ? -1 : ea->addr > eb->addr;
+}
+
+/* sort, reject overlaps, merge what is contiguous in flash and memory */
+static int image_finish(struct image_t *img, const char *name)
+{
+	struct imgext_t *e, *prev = NULL;
+	unsigned int i, n = 0;
+
+	qsort(img->ext, img->next, sizeof(*img->ext), ext_cmp);
+	img->payload = 0;
+	for (i = 0; i < img->next; i++) {
+		e = &img->ext[i];
+		if (e->size == 0)
+			continue;
+		if (prev != NULL && e->addr < prev->addr + prev->size) {
+			fprintf(stderr, "%s: %s has overlapping data @ 0x%x!\n",
+				__func__, name, e->addr);
+			return -1;
+		}
+		if (prev != NULL && e->addr == prev->addr + prev->size &&
+		    e->data == prev->data + prev->size) {
+			prev->size += e->size;
+		} else {
+			img->ext[n] = *e;
+			prev = &img->ext[n++];
+		}
+		img->payload += e->size;
+	}
+	img->next = n;
+	if (n == 0) {
+		fprintf(stderr, "%s: %s contains no data!\n", __func__, name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int image_addext(struct image_t *img, unsigned int *maxext,
+			uint32_t addr, uint32_t size, const uint8_t *data)
+{
+	struct imgext_t *ext;
+
+	if (img->next == *maxext) {
+		ext = realloc(img->ext, (*maxext + 64) * sizeof(*ext));
+		if (ext == NULL) {
+			fprintf(stderr, "%s: no mem for image!\n", __func__);
+			return -1;
+		}
+		img->ext = ext;
+		*maxext += 64;
+	}
+	ext = &img->ext[img->next++];
+	ext->addr = addr;
+	ext->size = size;
+	ext->data = data;
+
+	return 0;
+}
+
+static int build_add(struct imgbuild_t *t, uint32_t addr,
+		    const uint8_t *data, unsigned int size)
+{
+	unsigned int maxext = t->maxext, last = t->img->next - 1;
+	size_t *off;
+	uint8_t *raw;
+
+	if (t->rawsize + size > t->rawmax) {
+		raw = realloc(t->raw, t->rawmax * 2 + size);
+		if (raw == NULL) {
+			fprintf(stderr, "%s: no mem for image!\n", __func__);
+			return -1;
+		}
+		t->raw = raw;
+		t->rawmax = t->rawmax * 2 + size;
+	}
+	/* continues the last extent, in flash and in raw */
+	if (t->img->next != 0 &&
+	    t->img->ext[last].addr + t->img->ext[last].size == addr &&
+	    t->off[last] + t->img->ext[last].size == t->rawsize) {
+		t->img->ext[last].size += size;
+		goto out;
+	}
+	if (image_addext(t->img, &t->maxext, addr, size, NULL) != 0)
+		return -1;
+	if (t->maxext != maxext) {
+		off = realloc(t->off, t->maxext * sizeof(*off));
+		if (off == NULL) {
+			fprintf(stderr, "%s: no mem for image!\n", __func__);
+			return -1;
+		}
+		t->off = off;
+	}
+	t->off[t->img->next - 1] = t->rawsize;
+out:
+	memcpy(&t->raw[t->rawsize], data, size);
+	t->rawsize += size;
+
+	return 0;
+}
+
+/* the raw buffer doesn't move anymore, point the extents into it */
+static int build_finish(struct imgbuild_t *t)
+{
+	unsigned int i;
+
+	for (i = 0; i < t->img->next; i++)
+		t->img->ext[i].data = &t->raw[t->off[i]];
+	t->img->heap = t->raw;
+	t->raw = NULL;
+	free(t->off);
+	t->off = NULL;
+
+	return image_finish(t->img, t->name);
+}
+
+static int hexnibble(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* 'n' hex encoded bytes of 's' into 'dst', -1 on bad digits */
+static int hexbytes(const char *s, uint8_t *dst, unsigned int n)
+{
+	int hi, lo;
+
+	while (n--) {
+		hi = hexnibble(*s++);
+		lo = hexnibble(*s++);
+		if (hi < 0 || lo < 0)
+			return -1;
+		*dst++ = hi << 4 | lo;
+	}
+
+	return 0;
+}
+
+static int text_error(struct imgbuild_t *t, const char *what)
+{
+	fprintf(stderr, "%s:%u: %s!\n", t->name, t->line, what);
+
+	return -1;
+}
+
+/* :LLAAAATT<data>CC */
+static int ihex_line(struct imgbuild_t *t, const char *s, size_t len,
+		     uint32_t *base, bool *eof)
+{
+	uint8_t b[4 + 255 + 1], sum = 0;
+	unsigned int i, n;
+
+	if (len < 11 || s[0] != ':' || (len - 1) % 2 != 0)
+		return text_error(t, "malformed HEX record");
+	n = (len - 1) / 2;
+	if (n > sizeof(b) || hexbytes(&s[1], b, n) != 0 || b[0] + 5u != n)
+		return text_error(t, "malformed HEX record");
+	for (i = 0; i < n; i++)
+		sum += b[i];
+	if (sum != 0)
+		return text_error(t, "HEX checksum error");
+
+	switch (b[3]) {
+	case 0x00:
+		return build_add(t, *base + (b[1] << 8 | b[2]), &b[4], b[0]);
+	case 0x01:
+		*eof = true;
+		return 0;
+	case 0x02:
+		if (b[0] != 2)
+			return text_error(t, "malformed HEX segment record");
+		*base = (uint32_t)(b[4] << 8 | b[5]) << 4;
+		return 0;
+	case 0x04:
+		if (b[0] != 2)
+			return text_error(t, "malformed HEX address record");
+		*base = (uint32_t)(b[4] << 8 | b[5]) << 16;
+		return 0;
+	case 0x03:
+	case 0x05:
+		/* start address, nothing to program */
+		return 0;
+	default:
+		return text_error(t, "unknown HEX record type");
+	}
+}
+
+/* S<type>CC<addr><data>KK */
+static int srec_line(struct imgbuild_t *t, const char *s, size_t len,
+		     bool *eof)
+{
+	uint8_t b[1 + 255], sum = 0;
+	unsigned int i, n, alen;
+	uint32_t addr = 0;
+
+	if (len < 4 || s[0] != 'S' || len % 2 != 0)
+		return text_error(t, "malformed S-record");
+	n = (len - 2) / 2;
+	if (n > sizeof(b) || hexbytes(&s[2], b, n) != 0 || b[0] + 1u != n)
+		return text_error(t, "malformed S-record");
+	for (i = 0; i < n; i++)
+		sum += b[i];
+	if (sum != 0xFF)
+		return text_error(t, "S-record checksum error");
+
+	switch (s[1]) {
+	case '1':
+	case '2':
+	case '3':
+		alen = s[1] - '0' + 1;
+		break;
+	case '7':
+	case '8':
+	case '9':
+		*eof = true;
+		return 0;
+	case '0':
+	case '5':
+	case '6':
+		/* header, record count */
+		return 0;
+	default:
+		return text_error(t, "unknown S-record type");
+	}
+	if (b[0] < alen + 1)
+		return text_error(t, "malformed S-record");
+	for (i = 0; i < alen; i++)
+		addr = addr << 8 | b[1 + i];
+
+	return build_add(t, addr, &b[1 + alen], b[0] - alen - 1);
+}
+
+static int image_text(struct image_t *img, const char *name, bool srec)
+{
+	struct imgbuild_t t = { .img = img, .name = name };
+	const char *p = img->map, *end = p + img->mapsize, *nl;
+	uint32_t base = 0;
+	bool eof = false;
+	size_t len;
+	int rc = 0;
+
+	while (rc == 0 && eof == false && p < end) {
+		t.line++;
+		nl = memchr(p, '\n', end - p);
+		if (nl == NULL)
+			nl = end;
+		len = nl - p;
+		while (len > 0 && (p[len - 1] == '\r' || p[len - 1] == ' ' ||
+				   p[len - 1] == '\t'))
+			len--;
+		if (len != 0) {
+			if (srec)
+				rc = srec_line(&t, p, len, &eof);
+			else
+				rc = ihex_line(&t, p, len, &base, &eof);
+		}
+		p = nl + 1;
+	}
+	if (rc == 0)
+		rc = build_finish(&t);
+	free(t.raw);
+	free(t.off);
+
+	return rc;
+}
+
+static uint64_t elf_rd(const uint8_t *p, unsigned int n, bool be)
+{
+	uint64_t v = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		v |= (uint64_t)p[be ? n - 1 - i : i] << (8 * i);
+
+	return v;
+}
+
+/* PT_LOAD segments at their physical (load) address, .bss is skipped */
+static int image_elf(struct image_t *img, const char *name)
+{
+	const uint8_t *f = img->map;
+	unsigned int maxext = 0, i, phnum, phentsize, w;
+	uint64_t phoff, off, paddr, filesz;
+	const uint8_t *ph;
+	bool be, is64;
+
+	if (img->mapsize < 52 || (f[4] != 1 && f[4] != 2) ||
+	    (f[5] != 1 && f[5] != 2) || (f[4] == 2 && img->mapsize < 64)) {
+		fprintf(stderr, "%s: %s is no valid ELF file!\n",
+			__func__, name);
+		return -1;
+	}
+	is64 = f[4] == 2;
+	be = f[5] == 2;
+	w = is64 ? 8 : 4;
+	phoff = elf_rd(&f[is64 ? 32 : 28], w, be);
+	phentsize = elf_rd(&f[is64 ? 54 : 42], 2, be);
+	phnum = elf_rd(&f[is64 ? 56 : 44], 2, be);
+	/* written so that none of the sums can wrap */
+	if (phentsize < (is64 ? 56u : 32u) || phoff > img->mapsize ||
+	    (uint64_t)phnum * phentsize > img->mapsize - phoff) {
+		fprintf(stderr, "%s: %s has a broken program header!\n",
+			__func__, name);
+		return -1;
+	}
+
+	for (i = 0; i < phnum; i++) {
+		ph = &f[phoff + (uint64_t)i * phentsize];
+		if (elf_rd(ph, 4, be) != 1)	/* PT_LOAD */
+			continue;
+		off = elf_rd(&ph[is64 ? 8 : 4], w, be);
+		paddr = elf_rd(&ph[is64 ? 24 : 12], w, be);
+		filesz = elf_rd(&ph[is64 ? 32 : 16], w, be);
+		if (filesz == 0)
+			continue;
+		if (off > img->mapsize || filesz > img->mapsize - off ||
+		    paddr > 0x100000000ULL || filesz > 0x100000000ULL - paddr) {
+			fprintf(stderr, "%s: %s segment %u is out of range!\n",
+				__func__, name, i);
+			return -1;
+		}
+		if (image_addext(img, &maxext, paddr, filesz, &f[off]) != 0)
+			return -1;
+	}
+
+	return image_finish(img, name);
+}
+
+static bool has_ext(const char *filename, const char *const *exts)
+{
+	const char *dot = strrchr(filename, '.');
+
+	for (; dot != NULL && *exts != NULL; exts++) {
+		if (strcasecmp(dot + 1, *exts) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+#define ELFMAG		"\177ELF"
+
+static const char *const ihex_exts[] = { "hex", "ihex", "ihx", NULL };
+static const char *const srec_exts[] = {
+	"srec", "s19", "s28", "s37", "mot", NULL
+};
+
+/* drop everything outside [lo, hi) */
+void image_clip(struct image_t *img, uint32_t lo, uint32_t hi)
+{
+	struct imgext_t *e;
+	unsigned int i, n = 0;
+	uint64_t send;
+	uint32_t end;
+
+	if (img->spansize != 0) {
+		send = (uint64_t)img->spanaddr + img->spansize;
+		if (send <= lo || img->spanaddr >= hi) {
+			img->spansize = 0;
+		} else {
+			if (img->spanaddr < lo)
+				img->spanaddr = lo;
+			if (send > hi)
+				send = hi;
+			img->spansize = send - img->spanaddr;
+		}
+	}
+	img->payload = 0;
+	for (i = 0; i < img->next; i++) {
+		e = &img->ext[i];
+		end = e->addr + e->size;
+		if (end <= lo || e->addr >= hi)
+			continue;
+		if (e->addr < lo) {
+			e->data += lo - e->addr;
+			e->addr = lo;
+		}
+		if (end > hi)
+			end = hi;
+		e->size = end - e->addr;
+		img->ext[n++] = *e;
+		img->payload += e->size;
+	}
+	img->next = n;
+}
+
+/* move by 'offset', clip to [offset, offset + size) if 'size' is given */
+static int image_place(struct image_t *img, const char *name,
+		       uint32_t offset, uint32_t size)
+{
+	unsigned int i;
+
+	if ((uint64_t)img->spanaddr + img->spansize + offset >
+	    0x100000000ULL) {
+		fprintf(stderr, "%s: offset 0x%x moves %s beyond 4GiB!\n",
+			__func__, offset, name);
+		return -1;
+	}
+	if (img->spansize != 0)
+		img->spanaddr += offset;
+	for (i = 0; i < img->next; i++) {
+		if ((uint64_t)img->ext[i].addr + img->ext[i].size +
+		    offset > 0x100000000ULL) {
+			fprintf(stderr,
+				"%s: offset 0x%x moves %s beyond 4GiB!\n",
+				__func__, offset, name);
+			return -1;
+		}
+		img->ext[i].addr += offset;
+	}
+	if (size != 0)
+		image_clip(img, offset, offset + size);
+	if (img->next == 0) {
+		fprintf(stderr, "%s: no data of %s in 0x%x .. 0x%x!\n",
+			__func__, name, offset, offset + size);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * decoder thread of a compressed image, blank pages are dropped as they
+ * come out of the decoder, so memory follows the non blank payload.
+ */
+static void *image_unpack(void *arg)
+{
+	struct image_t *img = arg;
+	struct imgjob_t *job = img->job;
+	struct imgbuild_t t = { .img = img, .name = job->name };
+	uint64_t addr = 0;
+	uint8_t *blk;
+	long n = -1, i, len;
+
+	TRACE_BEGIN("image unpack");
+	blk = malloc(IMAGE_BLOCK);
+	if (blk == NULL)
+		fprintf(stderr, "%s: no mem for image!\n", __func__);
+	while (blk != NULL) {
+		n = unpack_read(job->u, blk, IMAGE_BLOCK);
+		if (n <= 0)
+			break;
+		if (addr + n > 0x100000000ULL) {
+			fprintf(stderr, "%s: %s unpacks beyond 4GiB!\n",
+				__func__, job->name);
+			n = -1;
+			break;
+		}
+		/* all blocks but the last are full, so pages stay aligned */
+		for (i = 0; i < n; i += len) {
+			len = n - i < IMAGE_PAGE ? n - i : IMAGE_PAGE;
+			if (blank_check(&blk[i], len))
+				continue;
+			if (build_add(&t, addr + i, &blk[i], len) != 0)
+				break;
+		}
+		if (i < n) {
+			n = -1;
+			break;
+		}
+		addr += n;
+	}
+	free(blk);
+
+	/* the span tells -U where the dropped pages have been */
+	img->spanaddr = 0;
+	img->spansize = addr < 0x100000000ULL ? addr : 0xFFFFFFFF;
+	if (n == 0 && build_finish(&t) == 0 &&
+	    image_place(img, job->name, job->offset, job->size) == 0)
+		job->rc = 0;
+	free(t.raw);
+	free(t.off);
+	unpack_destroy(job->u);
+	job->u = NULL;
+	/* the compressed file isn't needed anymore */
+	osi_unmapfile(img->map, img->mapsize);
+	img->map = NULL;
+	TRACE_END("image unpack");
+
+	return NULL;
+}
+
+int image_wait(struct image_t *img)
+{
+	if (img->job == NULL)
+		return 0;
+
+	if (img->job->joined == false) {
+		osi_thread_join(img->job->thread);
+		img->job->joined = true;
+	}
+
+	return img->job->rc;
+}
+
+/*
+ * image content of [addr, addr + size), blank where the image has no data.
+ * 'hint' starts at 0 and speeds up walks in ascending order.
+ */
+void image_render(const struct image_t *img, unsigned int *hint,
+		  uint32_t addr, uint32_t size, uint8_t *buf)
+{
+	const struct imgext_t *e;
+	uint32_t lo, hi;
+	unsigned int i;
+
+	memset(buf, 0xFF, size);
+	for (i = *hint; i < img->next &&
+	     img->ext[i].addr + img->ext[i].size <= addr; i++)
+		;
+	*hint = i;
+	for (; i < img->next && img->ext[i].addr < addr + size; i++) {
+		e = &img->ext[i];
+		lo = e->addr > addr ? e->addr : addr;
+		hi = e->addr + e->size < addr + size ?
+		     e->addr + e->size : addr + size;
+		memcpy(&buf[lo - addr], &e->data[lo - e->addr], hi - lo);
+	}
+}
+
+void image_destroy(struct image_t *img)
+{
+	if (img == NULL)
+		return;
+
+	if (img->job != NULL) {
+		image_wait(img);
+		unpack_destroy(img->job->u);
+		free(img->job->name);
+		free(img->job);
+	}
+	if (img->map != NULL)
+		osi_unmapfile(img->map, img->mapsize);
+	free(img->heap);
+	free(img->ext);
+	free(img);
+}
+
+/* start the decoder thread, the image is ready after image_wait() */
+static int image_compressed(struct image_t *img, const char *name,
+			    const char *codec, uint32_t offset,
+			    uint32_t size)
+{
+	struct imgjob_t *job;
+
+	job = calloc(1, sizeof(*job));
+	if (job == NULL) {
+		fprintf(stderr, "%s: no mem for image!\n", __func__);
+		return -1;
+	}
+	img->job = job;
+	job->joined = true;
+	job->rc = -1;
+	job->name = strdup(name);
+	job->offset = offset;
+	job->size = size;
+	snprintf(job->format, sizeof(job->format), "%s compressed binary",
+		 codec);
+	img->format = job->format;
+	job->u = unpack_create(img->map, img->mapsize);
+	if (job->name == NULL || job->u == NULL)
+		return -1;
+	if (osi_thread_create(&job->thread, image_unpack, img) != 0) {
+		fprintf(stderr, "%s: cannot start decoder!\n", __func__);
+		return -1;
+	}
+	job->joined = false;
+
+	return 0;
+}
+
+struct image_t *image_load(const char *filename, uint32_t offset,
+			   uint32_t size)
+{
+	struct image_t *img;
+	unsigned int maxext = 0;
+	const char *codec;
+	int rc;
+
+	img = calloc(1, sizeof(*img));
+	if (img == NULL) {
+		fprintf(stderr, "%s: no mem for image!\n", __func__);
+		return NULL;
+	}
+
+	do {
+		img->map = osi_mapfile(filename, &img->mapsize);
+		if (img->map == NULL) {
+			fprintf(stderr, "%s: cannot map %s (empty?)!\n",
+				__func__, filename);
+			break;
+		}
+		codec = unpack_detect(img->map, img->mapsize);
+		if (codec != NULL) {
+			if (image_compressed(img, filename, codec, offset,
+					     size) != 0)
+				break;
+			return img;
+		}
+
+		TRACE_BEGIN("image parse");
+		if (has_ext(filename, ihex_exts)) {
+			img->format = "Intel HEX";
+			rc = image_text(img, filename, false);
+		} else if (has_ext(filename, srec_exts)) {
+			img->format = "S-record";
+			rc = image_text(img, filename, true);
+		} else if (img->mapsize >= 4 &&
+			   memcmp(img->map, ELFMAG, 4) == 0) {
+			img->format = "ELF";
+			rc = image_elf(img, filename);
+		} else {
+			img->format = "binary";
+			rc = image_addext(img, &maxext, 0, img->mapsize,
+					  img->map);
+			img->payload = img->mapsize;
+			img->spansize = img->mapsize;
+		}
+		TRACE_END("image parse");
+		if (rc != 0 || image_place(img, filename, offset, size) != 0)
+			break;
+
+		return img;
+	} while (0);
+
+	image_destroy(img);
+
+	return NULL;
+}
@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * sparse flash images: raw binary, Intel HEX, Motorola S-record, ELF
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#ifndef __LIBIMAGE_H__
+#define __LIBIMAGE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* one contiguous run of data at a flash address */
+struct imgext_t {
+	uint32_t	addr;
+	uint32_t	size;
+	const uint8_t	*data;
+};
+
+struct imgjob_t;
+
+/*
+ * Extents are sorted by address and don't overlap. Raw and ELF data point
+ * into the mapped file, HEX and S-record data is decoded into 'heap', so
+ * memory follows the payload, not the chip size. Compressed binaries
+ * (gzip, zstd, xz, lz4) are decoded by a thread into 'heap' without their
+ * blank (0xFF) pages.
+ */
+struct image_t {
+	const char	*format;
+	unsigned int	next;
+	struct imgext_t	*ext;
+	uint32_t	payload;	/* sum of all extent sizes */
+	/* range a binary covers, without the pages the decoder dropped */
+	uint32_t	spanaddr;
+	uint32_t	spansize;	/* 0: sparse format */
+	void		*map;
+	size_t		mapsize;
+	uint8_t		*heap;
+	struct imgjob_t	*job;		/* decoder of a compressed image */
+};
+
+/*
+ * 'offset' is added to all addresses (the load address of a raw binary),
+ * a 'size' != 0 clips the image to [offset, offset + size). A compressed
+ * image is still decoded when image_load() returns, image_wait() has to
+ * be called before the extents are used.
+ */
+struct image_t *image_load(const char *filename, uint32_t offset,
+			   uint32_t size);
+int image_wait(struct image_t *img);
+void image_clip(struct image_t *img, uint32_t lo, uint32_t hi);
+void image_render(const struct image_t *img, unsigned int *hint,
+		  uint32_t addr, uint32_t size, uint8_t *buf);
+void image_destroy(struct image_t *img);
+
+#endif /* __LIBIMAGE_H__ */
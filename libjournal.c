@@ -0,0 +1,227 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * append-only checkpoint journal of long running jobs
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "libjournal.h"
+#include "osi.h"
+
+static int journal_push(struct journal_t *j, char type, uint32_t addr,
+			uint32_t size, uint32_t crc)
+{
+	struct jrec_t *rec;
+
+	if (j->nrec == j->maxrec) {
+		rec = realloc(j->rec, (j->maxrec + 256) * sizeof(*rec));
+		if (rec == NULL) {
+			fprintf(stderr, "%s: no mem for journal!\n", __func__);
+			return -1;
+		}
+		j->rec = rec;
+		j->maxrec += 256;
+	}
+	rec = &j->rec[j->nrec++];
+	rec->type = type;
+	rec->addr = addr;
+	rec->size = size;
+	rec->crc = crc;
+
+	return 0;
+}
+
+/* load the records of a previous run, a torn last line is ignored */
+static int journal_load(struct journal_t *j)
+{
+	size_t hlen = strlen(j->header);
+	char line[JOURNAL_HDRMAX + 2];
+	unsigned int addr, size, crc;
+	char type;
+	FILE *f;
+	int rc = 0;
+
+	f = fopen(j->path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "%s: no journal %s to resume from!\n",
+			__func__, j->path);
+		return -1;
+	}
+	if (fgets(line, sizeof(line), f) == NULL ||
+	    strcspn(line, "\n") != hlen ||
+	    strncmp(line, j->header, hlen) != 0) {
+		fprintf(stderr, "%s: journal %s belongs to another job!\n",
+			__func__, j->path);
+		fclose(f);
+		return -1;
+	}
+	while (rc == 0 && fgets(line, sizeof(line), f) != NULL) {
+		if (strchr(line, '\n') == NULL ||
+		    sscanf(line, "%c %x %x %x", &type, &addr, &size,
+			   &crc) != 4)
+			break;
+		rc = journal_push(j, type, addr, size, crc);
+	}
+	fclose(f);
+
+	return rc;
+}
+
+/*
+ * (re)write the whole journal, used on open and after dropping records.
+ * It is written to '<path>.tmp' and renamed over the old one, so a crash
+ * in between leaves either the old or the new journal for -R.
+ */
+static int journal_rewrite(struct journal_t *j)
+{
+	unsigned int i;
+	char *tmp;
+	FILE *f;
+
+	tmp = malloc(strlen(j->path) + 5);
+	if (tmp == NULL) {
+		fprintf(stderr, "%s: no mem for journal!\n", __func__);
+		return -1;
+	}
+	sprintf(tmp, "%s.tmp", j->path);
+
+	f = fopen(tmp, "w");
+	if (f == NULL) {
+		fprintf(stderr, "%s: cannot create journal %s!\n",
+			__func__, tmp);
+		free(tmp);
+		return -1;
+	}
+	fprintf(f, "%s\n", j->header);
+	for (i = 0; i < j->nrec; i++)
+		fprintf(f, "%c %x %x %x\n", j->rec[i].type,
+			j->rec[i].addr, j->rec[i].size, j->rec[i].crc);
+	if (osi_fsync(f) != 0) {
+		fprintf(stderr, "%s: cannot write journal %s!\n",
+			__func__, tmp);
+		fclose(f);
+		remove(tmp);
+		free(tmp);
+		return -1;
+	}
+	fclose(f);
+
+	if (j->f != NULL) {
+		fclose(j->f);
+		j->f = NULL;
+	}
+	if (osi_rename(tmp, j->path) != 0) {
+		fprintf(stderr, "%s: cannot replace journal %s!\n",
+			__func__, j->path);
+		remove(tmp);
+		free(tmp);
+		return -1;
+	}
+	free(tmp);
+
+	j->f = fopen(j->path, "a");
+	if (j->f == NULL) {
+		fprintf(stderr, "%s: cannot open journal %s!\n",
+			__func__, j->path);
+		return -1;
+	}
+
+	return 0;
+}
+
+void journal_close(struct journal_t *j, bool done)
+{
+	if (j == NULL)
+		return;
+
+	if (j->f != NULL)
+		fclose(j->f);
+	if (done)
+		remove(j->path);
+	free(j->rec);
+	free(j->header);
+	free(j->path);
+	free(j);
+}
+
+struct journal_t *journal_open(const char *path, const char *header,
+			       bool resume)
+{
+	struct journal_t *j;
+
+	j = calloc(1, sizeof(*j));
+	if (j == NULL) {
+		fprintf(stderr, "%s: no mem for journal!\n", __func__);
+		return NULL;
+	}
+
+	do {
+		j->path = strdup(path);
+		j->header = strdup(header);
+		if (j->path == NULL || j->header == NULL)
+			break;
+		if (resume && journal_load(j) != 0)
+			break;
+		/* a resumed journal is rewritten, that drops a torn tail */
+		if (journal_rewrite(j) != 0)
+			break;
+
+		return j;
+	} while (0);
+
+	journal_close(j, false);
+
+	return NULL;
+}
+
+int journal_add(struct journal_t *j, char type, uint32_t addr,
+		uint32_t size, uint32_t crc)
+{
+	if (j == NULL)
+		return 0;
+
+	if (journal_push(j, type, addr, size, crc) != 0)
+		return -1;
+	fprintf(j->f, "%c %x %x %x\n", type, addr, size, crc);
+	if (osi_fsync(j->f) != 0) {
+		fprintf(stderr, "%s: cannot write journal %s!\n",
+			__func__, j->path);
+		return -1;
+	}
+
+	return 0;
+}
+
+const struct jrec_t *journal_find(struct journal_t *j, char type,
+				  uint32_t addr)
+{
+	unsigned int i;
+
+	if (j == NULL)
+		return NULL;
+
+	for (i = j->nrec; i > 0; i--) {
+		if (j->rec[i - 1].type == type && j->rec[i - 1].addr == addr)
+			return &j->rec[i - 1];
+	}
+
+	return NULL;
+}
+
+/* forget 'rec' so that unit is done again */
+int journal_drop(struct journal_t *j, const struct jrec_t *rec)
+{
+	unsigned int i = rec - j->rec;
+
+	memmove(&j->rec[i], &j->rec[i + 1],
+		(j->nrec - i - 1) * sizeof(*j->rec));
+	j->nrec--;
+
+	return journal_rewrite(j);
+}
@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * append-only checkpoint journal of long running jobs
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#ifndef __LIBJOURNAL_H__
+#define __LIBJOURNAL_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define JOURNAL_EXTENT		0x10000	/* bytes per program/read record */
+#define JOURNAL_HDRMAX		256
+
+/* record types */
+#define JOURNAL_ERASE		'e'
+#define JOURNAL_PROGRAM		'p'
+#define JOURNAL_READ		'r'
+
+struct jrec_t {
+	char		type;
+	uint32_t	addr;
+	uint32_t	size;
+	uint32_t	crc;		/* crc32c of the data, 0 for erase */
+};
+
+struct journal_t {
+	FILE		*f;
+	char		*path;
+	char		*header;
+	unsigned int	nrec;
+	unsigned int	maxrec;
+	struct jrec_t	*rec;
+};
+
+/*
+ * The first line of a journal describes the job ('header'), every
+ * completed unit is appended and synced before the job moves on.
+ * With 'resume' the records of a previous run of the same job are loaded,
+ * otherwise a fresh journal is started.
+ */
+struct journal_t *journal_open(const char *path, const char *header,
+			       bool resume);
+int journal_add(struct journal_t *j, char type, uint32_t addr,
+		uint32_t size, uint32_t crc);
+const struct jrec_t *journal_find(struct journal_t *j, char type,
+				  uint32_t addr);
+int journal_drop(struct journal_t *j, const struct jrec_t *rec);
+void journal_close(struct journal_t *j, bool done);
+
+#endif /* __LIBJOURNAL_H__ */
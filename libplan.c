@@ -0,0 +1,780 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * precomputed erase/program plan of an image
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <libM25Pxx_flash.h>
+#include <libtrace.h>
+#include <libdigest.h>
+#include <libblank.h>
+#include "libplan.h"
+#include "osi.h"
+
+static void plan_progress(struct m25pxx_progress_t *progress,
+			  unsigned int done, unsigned int total,
+			  unsigned int *percentx)
+{
+	unsigned int percent;
+
+	if (progress == NULL || total == 0)
+		return;
+	percent = (uint64_t)done * 100 / total;
+	if (percent != 0 && percent != 100 && percent != *percentx) {
+		*percentx = percent;
+		progress->fct(progress->arg, percent, 0);
+	}
+}
+
+int DLLEXPORT plan_erase(struct m25pxxflash_t *flash,
+			 const struct flashplan_t *plan,
+			 struct m25pxx_progress_t *progress)
+{
+	unsigned int i, percentx = 0;
+
+	if (flash->flash_detected != plan->chip) {
+		fprintf(stderr, "%s: plan is not made for this flash!\n",
+			__func__);
+		return -1;
+	}
+	if (plan->chiperase)
+		return m25pxx_chiperase(flash, progress);
+
+	if (progress)
+		progress->fct(progress->arg, 0, 0);
+	for (i = 0; i < plan->nsectors; i++) {
+		if (m25pxx_sectorerase(flash, plan->sectors[i].addr,
+				       NULL) != 0) {
+			fprintf(stderr, "%s: cannot erase sector @ 0x%x\n",
+				__func__, plan->sectors[i].addr);
+			return -1;
+		}
+		plan_progress(progress, i + 1, plan->nsectors, &percentx);
+	}
+	if (plan_blank_edges(flash, plan) != 0)
+		return -1;
+	if (progress)
+		progress->fct(progress->arg, 100, 0);
+
+	return 0;
+}
+
+/*
+ * The bytes of an erase range or image within a partly covered sector are
+ * set to 0xFF by the writer, the rest of the sector stays as it is.
+ */
+static int plan_blank(struct m25pxxflash_t *flash,
+		      const struct planrange_t *edge)
+{
+	uint8_t ff[256];
+	uint32_t a, n;
+
+	memset(ff, 0xFF, sizeof(ff));
+
+	for (a = edge->addr; a < edge->addr + edge->size; a += n) {
+		n = edge->addr + edge->size - a;
+		if (n > sizeof(ff))
+			n = sizeof(ff);
+		if (m25pxx_write(flash, ff, a, n) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int plan_blank_flush(struct m25pxxflash_t *flash)
+{
+	if (m25pxx_flush(flash) != 0) {
+		fprintf(stderr, "%s: cannot erase partial sector!\n",
+			__func__);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* a single edge, for callers that journal each of them */
+int DLLEXPORT plan_blank_edge(struct m25pxxflash_t *flash,
+			      const struct planrange_t *edge)
+{
+	if (plan_blank(flash, edge) != 0)
+		return -1;
+
+	return plan_blank_flush(flash);
+}
+
+/* edges sharing a sector are written back together */
+int DLLEXPORT plan_blank_edges(struct m25pxxflash_t *flash,
+			       const struct flashplan_t *plan)
+{
+	unsigned int i;
+
+	for (i = 0; i < plan->nedges; i++) {
+		if (plan_blank(flash, &plan->edges[i]) != 0)
+			return -1;
+	}
+
+	return plan_blank_flush(flash);
+}
+
+int DLLEXPORT plan_program(struct m25pxxflash_t *flash,
+			   const struct flashplan_t *plan,
+			   struct m25pxx_progress_t *progress)
+{
+	return plan_program_range(flash, plan, 0, plan->chip->size, progress);
+}
+
+/* the planned pages within [addr, addr + size), nothing is scanned here */
+int DLLEXPORT plan_program_range(struct m25pxxflash_t *flash,
+				 const struct flashplan_t *plan,
+				 uint32_t addr, uint32_t size,
+				 struct m25pxx_progress_t *progress)
+{
+	const struct planrange_t *pg;
+	unsigned int i, first, lo, hi, percentx = 0;
+	uint8_t status;
+
+	if (flash->flash_detected != plan->chip) {
+		fprintf(stderr, "%s: plan is not made for this flash!\n",
+			__func__);
+		return -1;
+	}
+
+	if (m25pxx_rdsr(flash, &status) != 0)
+		return -1;
+	if (status & 0x80) {
+		fprintf(stderr,
+			"%s: flash has write protect asserted status 0x%02x.\n",
+			__func__, status);
+		return -1;
+	}
+
+	/* first page at or above 'addr' */
+	lo = 0;
+	hi = plan->npages;
+	while (lo < hi) {
+		i = lo + (hi - lo) / 2;
+		if (plan->pages[i].addr < addr)
+			lo = i + 1;
+		else
+			hi = i;
+	}
+	first = lo;
+	for (hi = first; hi < plan->npages &&
+	     plan->pages[hi].addr - addr < size; hi++)
+		;
+
+	if (progress)
+		progress->fct(progress->arg, 0, 0);
+	for (i = first; i < hi; i++) {
+		pg = &plan->pages[i];
+		if (m25pxx_progspans(flash, pg->data, pg->addr,
+				     pg->size) != 0) {
+			fprintf(stderr, "%s: cannot program page @ 0x%x\n",
+				__func__, pg->addr);
+			return -1;
+		}
+		plan_progress(progress, i + 1 - first, hi - first, &percentx);
+	}
+	if (m25pxx_verify_flush(flash) != 0)
+		return -1;
+	if (progress)
+		progress->fct(progress->arg, 100, 0);
+
+	return 0;
+}
+
+/* read back the digested sectors, also catches a base that wasn't there */
+int DLLEXPORT plan_verify(struct m25pxxflash_t *flash,
+			  const struct flashplan_t *plan,
+			  struct m25pxx_progress_t *progress)
+{
+	const struct plandigest_t *d;
+	unsigned int i, percentx = 0;
+	uint32_t size, crc;
+	uint8_t *buf;
+	int rc = 0;
+
+	if (flash->flash_detected != plan->chip) {
+		fprintf(stderr, "%s: plan is not made for this flash!\n",
+			__func__);
+		return -1;
+	}
+	size = plan->chip->sectorsize;
+	buf = malloc(size);
+	if (buf == NULL) {
+		fprintf(stderr, "%s: no mem for sector buffer!\n", __func__);
+		return -1;
+	}
+
+	if (progress)
+		progress->fct(progress->arg, 0, 0);
+	for (i = 0; i < plan->ndigests && rc == 0; i++) {
+		d = &plan->digests[i];
+		if (m25pxx_read(flash, buf, d->addr, size) != 0) {
+			rc = -1;
+			break;
+		}
+		crc = crc32c(0, buf, size);
+		if (crc != d->crc) {
+			fprintf(stderr,
+				"%s: sector @ 0x%x has crc 0x%08x, expected 0x%08x!\n",
+				__func__, d->addr, crc, d->crc);
+			rc = -1;
+		}
+		plan_progress(progress, i + 1, plan->ndigests, &percentx);
+	}
+	if (progress && rc == 0)
+		progress->fct(progress->arg, 100, 0);
+	free(buf);
+
+	return rc;
+}
+
+void plan_destroy(struct flashplan_t *plan)
+{
+	if (plan == NULL)
+		return;
+
+	free(plan->sectors);
+	free(plan->edges);
+	free(plan->pages);
+	free(plan->digests);
+	occmap_destroy(plan->occ);
+	if (plan->map != NULL)
+		osi_unmapfile(plan->map, plan->mapsize);
+	free(plan);
+}
+
+/* bulk erase wins if the range starts in the first sector */
+static void plan_chiperase(struct flashplan_t *plan, uint32_t addr)
+{
+	struct flashparam_t *chip = plan->chip;
+
+	if (addr < chip->sectorsize &&
+	    (uint64_t)chip->sectortime * plan->nsectors > chip->bulktime)
+		plan->chiperase = true;
+}
+
+struct flashplan_t *plan_create_erase(struct flashparam_t *chip,
+				      uint32_t addr, uint32_t size)
+{
+	struct flashplan_t *plan;
+	uint32_t a, n, end;
+
+	if (addr >= chip->size) {
+		fprintf(stderr, "%s: offset 0x%x is beyond chip size 0x%x!\n",
+			__func__, addr, chip->size);
+		return NULL;
+	}
+	if (size == 0 || addr + size > chip->size)
+		size = chip->size - addr;
+	end = addr + size;
+
+	/* only whole sectors are erased, the pieces are edges */
+	a = addr + chip->sectorsize - 1;
+	a -= a % chip->sectorsize;
+	n = end - end % chip->sectorsize;
+
+	plan = calloc(1, sizeof(*plan));
+	if (plan != NULL) {
+		plan->sectors = calloc(chip->size / chip->sectorsize,
+				       sizeof(*plan->sectors));
+		plan->edges = calloc(2, sizeof(*plan->edges));
+	}
+	if (plan == NULL || plan->sectors == NULL || plan->edges == NULL) {
+		fprintf(stderr, "%s: no mem for plan!\n", __func__);
+		plan_destroy(plan);
+		return NULL;
+	}
+	plan->chip = chip;
+	if (a > n) {
+		/* within one sector */
+		plan->edges[0].addr = addr;
+		plan->edges[0].size = size;
+		plan->nedges = 1;
+		return plan;
+	}
+	if (addr < a) {
+		plan->edges[plan->nedges].addr = addr;
+		plan->edges[plan->nedges].size = a - addr;
+		plan->nedges++;
+	}
+	if (n < end) {
+		plan->edges[plan->nedges].addr = n;
+		plan->edges[plan->nedges].size = end - n;
+		plan->nedges++;
+	}
+	for (; a < n; a += chip->sectorsize) {
+		plan->sectors[plan->nsectors].addr = a;
+		plan->sectors[plan->nsectors].size = chip->sectorsize;
+		plan->nsectors++;
+	}
+	/* a bulk erase must not wipe anything outside the range */
+	if (addr == 0 && end == chip->size)
+		plan_chiperase(plan, addr);
+
+	return plan;
+}
+
+/* end of an extent, clipped to the chip */
+static uint32_t plan_extend(const struct flashparam_t *chip,
+			    const struct imgext_t *e)
+{
+	if (e->addr >= chip->size)
+		return e->addr;
+	if (e->size > chip->size - e->addr)
+		return chip->size;
+
+	return e->addr + e->size;
+}
+
+/*
+ * only sectors and pages carrying non blank image data are touched, the
+ * gaps between the extents of a sparse image stay as they are. Blank data
+ * is found by a single scan into the occupancy map, the lists are made
+ * from its bits. Sectors the image covers in part aren't erased, the
+ * image's pieces of them become edges like those of an erase range.
+ */
+struct flashplan_t *plan_create(struct flashparam_t *chip,
+				const struct image_t *img)
+{
+	struct imgext_t span = { img->spanaddr, img->spansize, NULL };
+	const struct imgext_t *e, *run = img->ext;
+	struct flashplan_t *plan;
+	uint32_t a, end, n, lo, hi, cover, ns = 0, np = 0;
+	unsigned int i, k = 0, m, nrun = img->next;
+
+	for (i = 0; i < img->next; i++) {
+		e = &img->ext[i];
+		if (e->addr >= chip->size)
+			break;
+		end = plan_extend(chip, e);
+		ns += (end - (e->addr - e->addr % chip->sectorsize) +
+		       chip->sectorsize - 1) / chip->sectorsize;
+		np += (end - (e->addr - e->addr % chip->pagesize) +
+		       chip->pagesize - 1) / chip->pagesize;
+	}
+
+	plan = calloc(1, sizeof(*plan));
+	if (plan != NULL) {
+		plan->sectors = calloc(ns, sizeof(*plan->sectors));
+		/* one per sector and extent at most */
+		plan->edges = calloc(ns, sizeof(*plan->edges));
+		plan->pages = calloc(np, sizeof(*plan->pages));
+	}
+	if (plan == NULL || plan->sectors == NULL || plan->edges == NULL ||
+	    plan->pages == NULL) {
+		fprintf(stderr, "%s: no mem for plan!\n", __func__);
+		plan_destroy(plan);
+		return NULL;
+	}
+
+	TRACE_BEGIN("plan");
+	plan->chip = chip;
+	plan->img = img;
+	plan->occ = occmap_create(img, chip->size, chip->pagesize,
+				  chip->sectorsize);
+	if (plan->occ == NULL) {
+		TRACE_END("plan");
+		plan_destroy(plan);
+		return NULL;
+	}
+	for (i = 0; i < img->next && img->ext[i].addr < chip->size; i++) {
+		e = &img->ext[i];
+		end = plan_extend(chip, e);
+		for (a = e->addr; a < end; a += n) {
+			/* piece of this extent within one page */
+			n = chip->pagesize - (a % chip->pagesize);
+			if (n > end - a)
+				n = end - a;
+			if (!occmap_page(plan->occ, a))
+				continue;
+			plan->pages[plan->npages].addr = a;
+			plan->pages[plan->npages].size = n;
+			plan->pages[plan->npages].data = e->data +
+							 (a - e->addr);
+			plan->npages++;
+		}
+	}
+	/* a binary covers its span, pages the decoder dropped included */
+	if (img->spansize != 0) {
+		run = &span;
+		nrun = 1;
+	}
+	for (i = 0; i < plan->occ->nsectors; i++) {
+		a = i * chip->sectorsize;
+		if (!occmap_sector(plan->occ, a))
+			continue;
+		/* extents are sorted, skip those ending before this sector */
+		while (k < nrun && plan_extend(chip, &run[k]) <= a)
+			k++;
+		cover = 0;
+		for (m = k; m < nrun && run[m].addr <
+		     a + chip->sectorsize; m++) {
+			lo = run[m].addr > a ? run[m].addr : a;
+			hi = plan_extend(chip, &run[m]);
+			if (hi > a + chip->sectorsize)
+				hi = a + chip->sectorsize;
+			cover += hi - lo;
+		}
+		if (cover == chip->sectorsize) {
+			plan->sectors[plan->nsectors].addr = a;
+			plan->sectors[plan->nsectors].size = chip->sectorsize;
+			plan->nsectors++;
+			continue;
+		}
+		for (m = k; m < nrun && run[m].addr <
+		     a + chip->sectorsize; m++) {
+			lo = run[m].addr > a ? run[m].addr : a;
+			hi = plan_extend(chip, &run[m]);
+			if (hi > a + chip->sectorsize)
+				hi = a + chip->sectorsize;
+			plan->edges[plan->nedges].addr = lo;
+			plan->edges[plan->nedges].size = hi - lo;
+			plan->nedges++;
+		}
+	}
+	/* a bulk erase must not wipe anything the image doesn't cover */
+	if (plan->nsectors == chip->size / chip->sectorsize)
+		plan_chiperase(plan, 0);
+	TRACE_END("plan");
+	if (img->next != 0 &&
+	    plan_extend(chip, &img->ext[img->next - 1]) !=
+	    img->ext[img->next - 1].addr + img->ext[img->next - 1].size)
+		fprintf(stderr,
+			"%s: WARNING: image data beyond chip size 0x%x is ignored!\n",
+			__func__, chip->size);
+
+	return plan;
+}
+
+struct flashplan_t *plan_compile(struct flashparam_t *chip,
+				 const struct image_t *img,
+				 const struct image_t *base)
+{
+	struct flashplan_t *plan;
+	struct occmap_t *bocc = NULL;
+	struct planrange_t *sectors = NULL;
+	unsigned int i, p = 0, ns = 0, np = 0, nd = 0, hint = 0, bhint = 0;
+	uint8_t *cur, *old = NULL;
+	uint32_t sec, nall;
+	bool keep;
+
+	plan = plan_create(chip, img);
+	if (plan == NULL)
+		return NULL;
+	/*
+	 * sectors holding data of the base but not of the image have to be
+	 * erased as well, the plan walks the union of both
+	 */
+	if (base != NULL) {
+		bocc = occmap_create(base, chip->size, chip->pagesize,
+				     chip->sectorsize);
+		if (bocc == NULL) {
+			plan_destroy(plan);
+			return NULL;
+		}
+	}
+	for (nall = 0, i = 0; i < plan->occ->nsectors; i++) {
+		sec = i * chip->sectorsize;
+		if (occmap_sector(plan->occ, sec) ||
+		    (bocc != NULL && occmap_sector(bocc, sec)))
+			nall++;
+	}
+	cur = malloc(chip->sectorsize);
+	if (base != NULL)
+		old = malloc(chip->sectorsize);
+	sectors = calloc(nall + 1, sizeof(*sectors));
+	plan->digests = calloc(nall + 1, sizeof(*plan->digests));
+	if (cur == NULL || (base != NULL && old == NULL) ||
+	    sectors == NULL || plan->digests == NULL) {
+		fprintf(stderr, "%s: no mem for plan!\n", __func__);
+		free(cur);
+		free(old);
+		free(sectors);
+		occmap_destroy(bocc);
+		plan_destroy(plan);
+		return NULL;
+	}
+
+	TRACE_BEGIN("compile");
+	for (i = 0; i < plan->occ->nsectors; i++) {
+		sec = i * chip->sectorsize;
+		if (!occmap_sector(plan->occ, sec) &&
+		    (bocc == NULL || !occmap_sector(bocc, sec)))
+			continue;
+		image_render(img, &hint, sec, chip->sectorsize, cur);
+		plan->digests[nd].addr = sec;
+		plan->digests[nd].crc = crc32c(0, cur, chip->sectorsize);
+		nd++;
+		keep = true;
+		if (base != NULL) {
+			image_render(base, &bhint, sec, chip->sectorsize, old);
+			keep = memcmp(cur, old, chip->sectorsize) != 0;
+		}
+		/* pages are sorted and all of them lie in listed sectors */
+		for (; p < plan->npages &&
+		     plan->pages[p].addr < sec + chip->sectorsize; p++) {
+			if (keep)
+				plan->pages[np++] = plan->pages[p];
+		}
+		if (keep) {
+			sectors[ns].addr = sec;
+			sectors[ns].size = chip->sectorsize;
+			ns++;
+		}
+	}
+	free(plan->sectors);
+	plan->sectors = sectors;
+	plan->ndigests = nd;
+	plan->nsectors = ns;
+	plan->npages = np;
+	/* the digests take the sectors as erased as a whole */
+	plan->nedges = 0;
+	/* a bulk erase would wipe the unchanged sectors as well */
+	plan->chiperase = false;
+	if (base == NULL && img->next != 0)
+		plan_chiperase(plan, img->ext[0].addr);
+	TRACE_END("compile");
+	free(cur);
+	free(old);
+	occmap_destroy(bocc);
+
+	return plan;
+}
+
+/*
+ * plan file: header, erase list (sector addresses), page list, digests,
+ * then the page data at PLAN_DATAALIGN. All of it in host byte order, a
+ * file of a foreign host fails the byte order check. The header crc covers
+ * header and lists, the data is covered by the digests.
+ */
+#define PLAN_MAGIC		"HPMPLAN"
+#define PLAN_BYTEORDER		0x01020304
+#define PLAN_DATAALIGN		0x1000
+
+struct planhdr_t {
+	char		magic[8];
+	uint32_t	byteorder;
+	char		part[12];
+	uint32_t	chipsize;
+	uint32_t	sectorsize;
+	uint32_t	pagesize;
+	uint32_t	chiperase;
+	uint32_t	nsectors;
+	uint32_t	npages;
+	uint32_t	ndigests;
+	uint32_t	dataoff;
+	uint32_t	datasize;
+	uint32_t	crc;
+};
+
+struct planpage_t {
+	uint32_t	addr;
+	uint32_t	size;
+	uint32_t	off;		/* within the data */
+};
+
+static uint32_t plan_crc(const struct planhdr_t *hdr, const void *lists,
+			 size_t size)
+{
+	struct planhdr_t h = *hdr;
+
+	h.crc = 0;
+
+	return crc32c(crc32c(0, &h, sizeof(h)), lists, size);
+}
+
+int plan_save(const struct flashplan_t *plan, const char *filename)
+{
+	const struct flashparam_t *chip = plan->chip;
+	struct planhdr_t hdr = { PLAN_MAGIC };
+	struct planpage_t *pg;
+	uint32_t *sec;
+	size_t size;
+	uint8_t *lists;
+	unsigned int i;
+	int rc = -1;
+	FILE *f;
+
+	size = plan->nsectors * sizeof(*sec) +
+	       plan->npages * sizeof(*pg) +
+	       plan->ndigests * sizeof(*plan->digests);
+	lists = calloc(1, size + 1);
+	if (lists == NULL) {
+		fprintf(stderr, "%s: no mem for plan lists!\n", __func__);
+		return -1;
+	}
+	sec = (uint32_t *)lists;
+	pg = (struct planpage_t *)&sec[plan->nsectors];
+
+	hdr.byteorder = PLAN_BYTEORDER;
+	strncpy(hdr.part, chip->name, sizeof(hdr.part) - 1);
+	hdr.chipsize = chip->size;
+	hdr.sectorsize = chip->sectorsize;
+	hdr.pagesize = chip->pagesize;
+	hdr.chiperase = plan->chiperase;
+	hdr.nsectors = plan->nsectors;
+	hdr.npages = plan->npages;
+	hdr.ndigests = plan->ndigests;
+	for (i = 0; i < plan->nsectors; i++)
+		sec[i] = plan->sectors[i].addr;
+	for (i = 0; i < plan->npages; i++) {
+		pg[i].addr = plan->pages[i].addr;
+		pg[i].size = plan->pages[i].size;
+		pg[i].off = hdr.datasize;
+		hdr.datasize += plan->pages[i].size;
+	}
+	memcpy(&pg[plan->npages], plan->digests,
+	       plan->ndigests * sizeof(*plan->digests));
+	hdr.dataoff = (sizeof(hdr) + size + PLAN_DATAALIGN - 1) &
+		      ~(PLAN_DATAALIGN - 1);
+	/* an erase only plan ends with its lists */
+	if (hdr.datasize == 0)
+		hdr.dataoff = sizeof(hdr) + size;
+	hdr.crc = plan_crc(&hdr, lists, size);
+
+	f = fopen(filename, "wb");
+	do {
+		if (f == NULL)
+			break;
+		if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+		    fwrite(lists, 1, size, f) != size ||
+		    fseek(f, hdr.dataoff, SEEK_SET) != 0)
+			break;
+		for (i = 0; i < plan->npages; i++) {
+			if (fwrite(plan->pages[i].data, 1, plan->pages[i].size,
+				   f) != plan->pages[i].size)
+				break;
+		}
+		if (i == plan->npages)
+			rc = 0;
+	} while (0);
+	if (f != NULL && fclose(f) != 0)
+		rc = -1;
+	if (rc != 0)
+		fprintf(stderr, "%s: cannot write plan to %s!\n",
+			__func__, filename);
+	free(lists);
+
+	return rc;
+}
+
+/* page data is used from the mapped file, nothing is copied */
+struct flashplan_t *plan_load(const char *filename)
+{
+	const struct planhdr_t *hdr;
+	const struct planpage_t *pg;
+	const uint32_t *sec;
+	struct flashparam_t *chip;
+	struct flashplan_t *plan;
+	const uint8_t *data;
+	size_t mapsize, size;
+	unsigned int i;
+	void *map;
+
+	map = osi_mapfile(filename, &mapsize);
+	if (map == NULL) {
+		fprintf(stderr, "%s: cannot map %s!\n", __func__, filename);
+		return NULL;
+	}
+	hdr = map;
+	sec = (const uint32_t *)&hdr[1];
+	size = 0;
+	if (mapsize >= sizeof(*hdr))
+		size = (uint64_t)hdr->nsectors * sizeof(*sec) +
+		       (uint64_t)hdr->npages * sizeof(*pg) +
+		       (uint64_t)hdr->ndigests * sizeof(struct plandigest_t);
+	if (mapsize < sizeof(*hdr) ||
+	    memcmp(hdr->magic, PLAN_MAGIC, sizeof(PLAN_MAGIC)) != 0 ||
+	    hdr->byteorder != PLAN_BYTEORDER ||
+	    memchr(hdr->part, 0, sizeof(hdr->part)) == NULL ||
+	    sizeof(*hdr) + size > hdr->dataoff ||
+	    (uint64_t)hdr->dataoff + hdr->datasize > mapsize ||
+	    plan_crc(hdr, sec, size) != hdr->crc) {
+		fprintf(stderr, "%s: %s is no valid plan!\n",
+			__func__, filename);
+		osi_unmapfile(map, mapsize);
+		return NULL;
+	}
+	chip = m25pxx_find(hdr->part);
+	if (chip == NULL || chip->size != hdr->chipsize ||
+	    chip->sectorsize != hdr->sectorsize ||
+	    chip->pagesize != hdr->pagesize) {
+		fprintf(stderr, "%s: part '%.12s' of %s is unknown!\n",
+			__func__, hdr->part, filename);
+		osi_unmapfile(map, mapsize);
+		return NULL;
+	}
+
+	plan = calloc(1, sizeof(*plan));
+	if (plan != NULL) {
+		plan->map = map;
+		plan->mapsize = mapsize;
+		plan->sectors = calloc(hdr->nsectors + 1,
+				       sizeof(*plan->sectors));
+		plan->pages = calloc(hdr->npages + 1, sizeof(*plan->pages));
+		plan->digests = calloc(hdr->ndigests + 1,
+				       sizeof(*plan->digests));
+	}
+	if (plan == NULL || plan->sectors == NULL || plan->pages == NULL ||
+	    plan->digests == NULL) {
+		fprintf(stderr, "%s: no mem for plan!\n", __func__);
+		if (plan == NULL)
+			osi_unmapfile(map, mapsize);
+		plan_destroy(plan);
+		return NULL;
+	}
+
+	plan->chip = chip;
+	plan->chiperase = hdr->chiperase != 0;
+	for (i = 0; i < hdr->nsectors; i++) {
+		if (sec[i] >= chip->size || sec[i] % chip->sectorsize) {
+			fprintf(stderr, "%s: sector @ 0x%x of %s is broken!\n",
+				__func__, sec[i], filename);
+			plan_destroy(plan);
+			return NULL;
+		}
+		plan->sectors[i].addr = sec[i];
+		plan->sectors[i].size = chip->sectorsize;
+	}
+	plan->nsectors = hdr->nsectors;
+	pg = (const struct planpage_t *)&sec[hdr->nsectors];
+	data = (const uint8_t *)map + hdr->dataoff;
+	for (i = 0; i < hdr->npages; i++) {
+		if ((uint64_t)pg[i].off + pg[i].size > hdr->datasize ||
+		    pg[i].addr >= chip->size || pg[i].size == 0 ||
+		    pg[i].addr % chip->pagesize + pg[i].size >
+		    chip->pagesize) {
+			fprintf(stderr, "%s: page @ 0x%x of %s is broken!\n",
+				__func__, pg[i].addr, filename);
+			plan_destroy(plan);
+			return NULL;
+		}
+		plan->pages[i].addr = pg[i].addr;
+		plan->pages[i].size = pg[i].size;
+		plan->pages[i].data = &data[pg[i].off];
+	}
+	plan->npages = hdr->npages;
+	memcpy(plan->digests, &pg[hdr->npages],
+	       hdr->ndigests * sizeof(*plan->digests));
+	plan->ndigests = hdr->ndigests;
+	for (i = 0; i < plan->ndigests; i++) {
+		if (plan->digests[i].addr >= chip->size ||
+		    plan->digests[i].addr % chip->sectorsize) {
+			fprintf(stderr, "%s: digest @ 0x%x of %s is broken!\n",
+				__func__, plan->digests[i].addr, filename);
+			plan_destroy(plan);
+			return NULL;
+		}
+	}
+
+	return plan;
+}
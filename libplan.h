@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * precomputed erase/program plan of an image
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#ifndef __LIBPLAN_H__
+#define __LIBPLAN_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libM25Pxx_flash.h>
+#include <libimage.h>
+#include <libblank.h>
+
+struct planrange_t {
+	uint32_t	addr;
+	uint32_t	size;
+	const uint8_t	*data;	/* pages only, points into the image */
+};
+
+/* crc32c of a whole sector once the plan has run */
+struct plandigest_t {
+	uint32_t	addr;
+	uint32_t	crc;
+};
+
+/*
+ * what has to be done to get 'img' into the flash, the plan holds no state
+ * of its own and is shared read-only between sessions. A compiled plan
+ * loaded from a file has no image, its pages point into the mapped file.
+ */
+struct flashplan_t {
+	struct flashparam_t	*chip;
+	const struct image_t	*img;	/* NULL: erase only or loaded */
+
+	bool			chiperase;
+	unsigned int		nsectors;
+	struct planrange_t	*sectors;
+	/* pieces of partly covered sectors, see plan_blank_edges() */
+	unsigned int		nedges;
+	struct planrange_t	*edges;
+	unsigned int		npages;
+	struct planrange_t	*pages;
+	unsigned int		ndigests;
+	struct plandigest_t	*digests;
+	struct occmap_t		*occ;	/* NULL if loaded */
+
+	void			*map;	/* file of a loaded plan */
+	size_t			mapsize;
+};
+
+void plan_destroy(struct flashplan_t *plan);
+struct flashplan_t *plan_create(struct flashparam_t *chip,
+				const struct image_t *img);
+struct flashplan_t *plan_create_erase(struct flashparam_t *chip,
+				      uint32_t addr, uint32_t size);
+/*
+ * plan_create() plus the digests of all sectors it touches. With a 'base'
+ * image, the one known to be in the flash, sectors whose content doesn't
+ * change are dropped and a chip erase is never used.
+ */
+struct flashplan_t *plan_compile(struct flashparam_t *chip,
+				 const struct image_t *img,
+				 const struct image_t *base);
+int plan_save(const struct flashplan_t *plan, const char *filename);
+struct flashplan_t *plan_load(const char *filename);
+int DLLEXPORT plan_erase(struct m25pxxflash_t *flash,
+			 const struct flashplan_t *plan,
+			 struct m25pxx_progress_t *progress);
+int DLLEXPORT plan_blank_edge(struct m25pxxflash_t *flash,
+			      const struct planrange_t *edge);
+int DLLEXPORT plan_blank_edges(struct m25pxxflash_t *flash,
+			       const struct flashplan_t *plan);
+int DLLEXPORT plan_program(struct m25pxxflash_t *flash,
+			   const struct flashplan_t *plan,
+			   struct m25pxx_progress_t *progress);
+int DLLEXPORT plan_program_range(struct m25pxxflash_t *flash,
+				 const struct flashplan_t *plan,
+				 uint32_t addr, uint32_t size,
+				 struct m25pxx_progress_t *progress);
+int DLLEXPORT plan_verify(struct m25pxxflash_t *flash,
+			  const struct flashplan_t *plan,
+			  struct m25pxx_progress_t *progress);
+
+#endif /* __LIBPLAN_H__ */
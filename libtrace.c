@@ -0,0 +1,180 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Timeline tracing (chrome trace-event format)
+ *
+ * Every thread records into its own ring, so the hot path neither locks
+ * nor shares cachelines. Rings are chained into a global list on first
+ * use and collected by trace_dump(), which also releases them.
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "libtrace.h"
+#include "osi.h"
+
+#define TRACE_RINGSIZE		(1 << 18)	/* events per thread */
+#define TRACE_MAXDEPTH		32		/* nesting closed at export */
+
+struct trace_ev_t {
+	uint64_t	ts;
+	const char	*name;
+	uint32_t	arg;
+	char		phase;
+};
+
+struct trace_ring_t {
+	struct trace_ring_t	*next;
+	unsigned int		tid;
+	uint32_t		head;
+	struct trace_ev_t	ev[TRACE_RINGSIZE];
+};
+
+bool trace_enabled;
+
+static struct trace_ring_t *rings;
+static unsigned int tidcnt;
+static unsigned int trace_gen;
+static uint64_t ts_base;
+static __thread struct trace_ring_t *ring;
+static __thread unsigned int ring_gen;
+
+static struct trace_ring_t *trace_ring_attach(void)
+{
+	struct trace_ring_t *r;
+
+	r = calloc(1, sizeof(*r));
+	if (r == NULL)
+		return NULL;
+
+	r->tid = __atomic_add_fetch(&tidcnt, 1, __ATOMIC_RELAXED);
+	r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&rings, &r->next, r, true,
+					    __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED))
+		;
+
+	return r;
+}
+
+void trace_event(const char *name, char phase, uint32_t arg)
+{
+	struct trace_ev_t *ev;
+	uint32_t head;
+
+	/* rings of an earlier generation have been freed by trace_dump() */
+	if (ring == NULL ||
+	    ring_gen != __atomic_load_n(&trace_gen, __ATOMIC_ACQUIRE)) {
+		ring_gen = __atomic_load_n(&trace_gen, __ATOMIC_ACQUIRE);
+		ring = trace_ring_attach();
+		if (ring == NULL)
+			return;
+	}
+
+	/* owner is the only writer, oldest events get overwritten */
+	head = ring->head;
+	ev = &ring->ev[head & (TRACE_RINGSIZE - 1)];
+	ev->ts = GetTimeStamp();
+	ev->name = name;
+	ev->arg = arg;
+	ev->phase = phase;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_start(void)
+{
+	ts_base = GetTimeStamp();
+	trace_enabled = true;
+}
+
+static void trace_put(FILE *f, bool *first, const struct trace_ev_t *ev,
+		      char phase, uint64_t ts, unsigned int tid)
+{
+	fprintf(f,
+		"%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":1,\"tid\":%u",
+		*first ? "" : ",\n", ev->name, phase,
+		(unsigned long long)(ts - ts_base), tid);
+	if (phase == 'B')
+		fprintf(f, ",\"args\":{\"arg\":%u}", ev->arg);
+	fprintf(f, "}");
+	*first = false;
+}
+
+/*
+ * trace_dump - write all rings as chrome trace and release them
+ *
+ * A wrapped ring has lost the oldest events, so E events whose B got
+ * overwritten are dropped and spans still open at the end of a ring are
+ * closed with its last timestamp, the viewer needs balanced pairs.
+ * Tracing is stopped, the caller has to make sure that no other thread
+ * is inside trace_event() anymore.
+ */
+int trace_dump(const char *filename)
+{
+	struct trace_ev_t *ev, *open[TRACE_MAXDEPTH];
+	struct trace_ring_t *r, *next;
+	uint32_t head, i;
+	unsigned int depth;
+	bool first = true;
+	uint64_t ts;
+	FILE *f;
+	int ret = 0;
+
+	trace_enabled = false;
+
+	f = fopen(filename, "w");
+	if (f == NULL) {
+		fprintf(stderr, "%s: cannot open %s for write!\n",
+			__func__, filename);
+		ret = -1;
+	} else {
+		fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	}
+	r = __atomic_exchange_n(&rings, NULL, __ATOMIC_ACQ_REL);
+	__atomic_add_fetch(&trace_gen, 1, __ATOMIC_RELEASE);
+	for (; r != NULL; r = next) {
+		next = r->next;
+		if (f == NULL)
+			goto release;
+
+		head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		i = head > TRACE_RINGSIZE ? head - TRACE_RINGSIZE : 0;
+		depth = 0;
+		ts = ts_base;
+		for (; i != head; i++) {
+			ev = &r->ev[i & (TRACE_RINGSIZE - 1)];
+			if (ev->phase == 'E') {
+				if (depth == 0)
+					continue;
+				depth--;
+			} else if (ev->phase == 'B') {
+				if (depth < TRACE_MAXDEPTH)
+					open[depth] = ev;
+				depth++;
+			}
+			trace_put(f, &first, ev, ev->phase, ev->ts, r->tid);
+			ts = ev->ts;
+		}
+		/* beyond TRACE_MAXDEPTH the name does not matter for pairing */
+		while (depth > 0) {
+			depth--;
+			ev = open[depth < TRACE_MAXDEPTH ?
+				  depth : TRACE_MAXDEPTH - 1];
+			trace_put(f, &first, ev, 'E', ts, r->tid);
+		}
+release:
+		free(r);
+	}
+	ring = NULL;
+
+	if (f != NULL) {
+		fprintf(f, "\n]}\n");
+		fclose(f);
+	}
+
+	return ret;
+}
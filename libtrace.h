@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Timeline tracing (chrome trace-event format)
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#ifndef __LIBTRACE_H__
+#define __LIBTRACE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+extern bool trace_enabled;
+
+void trace_event(const char *name, char phase, uint32_t arg);
+void trace_start(void);
+int trace_dump(const char *filename);
+
+/*
+ * with tracing switched off the instrumentation points are reduced to a
+ * single test of 'trace_enabled', names have to be string literals.
+ */
+#define TRACE_BEGIN_ARG(name, arg) \
+	do { \
+		if (__builtin_expect(trace_enabled, 0)) \
+			trace_event(name, 'B', arg); \
+	} while (0)
+#define TRACE_BEGIN(name)	TRACE_BEGIN_ARG(name, 0)
+#define TRACE_END(name) \
+	do { \
+		if (__builtin_expect(trace_enabled, 0)) \
+			trace_event(name, 'E', 0); \
+	} while (0)
+
+#endif /* __LIBTRACE_H__ */
@@ -0,0 +1,408 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * streaming decompression of gzip, zstd, xz and lz4 images
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef __linux__
+# include <dlfcn.h>
+#elif __MINGW32__
+# include <windows.h>
+#else
+# error "unsupported platform !"
+#endif
+#include "libunpack.h"
+
+/*
+ * The few structures of the codec ABIs used here, they are stable since
+ * ages and save us the -dev packages (and their mingw builds).
+ */
+struct z_stream_t {
+	const uint8_t	*next_in;
+	unsigned int	avail_in;
+	unsigned long	total_in;
+	uint8_t		*next_out;
+	unsigned int	avail_out;
+	unsigned long	total_out;
+	const char	*msg;
+	void		*state;
+	void		*zalloc;
+	void		*zfree;
+	void		*opaque;
+	int		data_type;
+	unsigned long	adler;
+	unsigned long	reserved;
+};
+
+#define Z_OK			0
+#define Z_STREAM_END		1
+#define Z_BUF_ERROR		(-5)
+#define Z_WBITS_AUTO		(15 + 32)	/* gzip or zlib header */
+
+struct lzma_stream_t {
+	const uint8_t	*next_in;
+	size_t		avail_in;
+	uint64_t	total_in;
+	uint8_t		*next_out;
+	size_t		avail_out;
+	uint64_t	total_out;
+	const void	*allocator;
+	void		*internal;
+	void		*reserved_ptr[4];
+	uint64_t	reserved_int[2];
+	size_t		reserved_size[2];
+	int		reserved_enum[2];
+};
+
+#define LZMA_OK			0
+#define LZMA_STREAM_END		1
+#define LZMA_BUF_ERROR		10
+#define LZMA_RUN		0
+#define LZMA_FINISH		3
+#define LZMA_CONCATENATED	0x08
+
+struct zstd_buf_t {
+	void		*ptr;
+	size_t		size;
+	size_t		pos;
+};
+
+#define LZ4F_VERSION		100
+
+struct unpack_t;
+
+struct codec_t {
+	const char	*name;
+	const uint8_t	*magic;
+	unsigned int	magiclen;
+	const char	*libname;
+	const char	*const *symbols;
+	int		(*init)(struct unpack_t *u);
+	/* 1: input is done, 0: more to come, -1: error */
+	int		(*step)(struct unpack_t *u, uint8_t *out,
+				size_t *outlen);
+	void		(*end)(struct unpack_t *u);
+};
+
+struct unpack_t {
+	const struct codec_t	*codec;
+	void			*lib;
+	void			*fn[4];		/* codec symbols */
+	const uint8_t		*in;
+	size_t			insize;
+	size_t			inpos;
+	bool			done;
+	union {
+		struct z_stream_t	z;
+		struct lzma_stream_t	xz;
+		void			*ctx;
+	};
+};
+
+/* a codec symbol, casted to the prototype it has */
+#define FN(u, i, ret, ...)	((ret (*)(__VA_ARGS__))(u)->fn[i])
+
+/* gzip (zlib): inflateInit2_, inflate, inflateReset, inflateEnd */
+static int gz_init(struct unpack_t *u)
+{
+	return FN(u, 0, int, struct z_stream_t *, int, const char *, int)
+		(&u->z, Z_WBITS_AUTO, "1.2.11", sizeof(u->z)) == Z_OK ?
+		0 : -1;
+}
+
+static int gz_step(struct unpack_t *u, uint8_t *out, size_t *outlen)
+{
+	size_t avail = u->insize - u->inpos;
+	int rc;
+
+	u->z.next_in = &u->in[u->inpos];
+	u->z.avail_in = avail > 0x40000000 ? 0x40000000 : avail;
+	u->z.next_out = out;
+	u->z.avail_out = *outlen;
+	rc = FN(u, 1, int, struct z_stream_t *, int)(&u->z, 0);
+	u->inpos += u->z.next_in - &u->in[u->inpos];
+	*outlen -= u->z.avail_out;
+	if (rc == Z_STREAM_END) {
+		/* concatenated members, as 'cat a.gz b.gz' makes them */
+		if (u->inpos == u->insize)
+			return 1;
+		rc = FN(u, 2, int, struct z_stream_t *)(&u->z);
+	}
+
+	return rc == Z_OK || rc == Z_BUF_ERROR ? 0 : -1;
+}
+
+static void gz_end(struct unpack_t *u)
+{
+	FN(u, 3, int, struct z_stream_t *)(&u->z);
+}
+
+/* xz (liblzma): lzma_stream_decoder, lzma_code, lzma_end */
+static int xz_init(struct unpack_t *u)
+{
+	return FN(u, 0, int, struct lzma_stream_t *, uint64_t, uint32_t)
+		(&u->xz, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK ? 0 : -1;
+}
+
+static int xz_step(struct unpack_t *u, uint8_t *out, size_t *outlen)
+{
+	int rc;
+
+	u->xz.next_in = &u->in[u->inpos];
+	u->xz.avail_in = u->insize - u->inpos;
+	u->xz.next_out = out;
+	u->xz.avail_out = *outlen;
+	rc = FN(u, 1, int, struct lzma_stream_t *, int)
+		(&u->xz, LZMA_FINISH);
+	u->inpos = u->insize - u->xz.avail_in;
+	*outlen -= u->xz.avail_out;
+	if (rc == LZMA_STREAM_END)
+		return 1;
+
+	return rc == LZMA_OK || rc == LZMA_BUF_ERROR ? 0 : -1;
+}
+
+static void xz_end(struct unpack_t *u)
+{
+	FN(u, 2, void, struct lzma_stream_t *)(&u->xz);
+}
+
+/*
+ * zstd: ZSTD_createDStream, ZSTD_decompressStream, ZSTD_isError,
+ * ZSTD_freeDStream
+ */
+static int zstd_init(struct unpack_t *u)
+{
+	u->ctx = FN(u, 0, void *, void)();
+
+	return u->ctx != NULL ? 0 : -1;
+}
+
+static int zstd_step(struct unpack_t *u, uint8_t *out, size_t *outlen)
+{
+	struct zstd_buf_t o = { out, *outlen, 0 };
+	struct zstd_buf_t i = { (void *)u->in, u->insize, u->inpos };
+	size_t rc;
+
+	rc = FN(u, 1, size_t, void *, struct zstd_buf_t *,
+		struct zstd_buf_t *)(u->ctx, &o, &i);
+	u->inpos = i.pos;
+	*outlen = o.pos;
+	if (FN(u, 2, unsigned int, size_t)(rc))
+		return -1;
+	if (rc == 0 && u->inpos == u->insize)
+		return 1;
+
+	return 0;
+}
+
+static void zstd_end(struct unpack_t *u)
+{
+	FN(u, 3, size_t, void *)(u->ctx);
+}
+
+/*
+ * lz4 frame: LZ4F_createDecompressionContext, LZ4F_decompress,
+ * LZ4F_isError, LZ4F_freeDecompressionContext
+ */
+static int lz4_init(struct unpack_t *u)
+{
+	size_t rc;
+
+	rc = FN(u, 0, size_t, void **, unsigned int)(&u->ctx, LZ4F_VERSION);
+
+	return FN(u, 2, unsigned int, size_t)(rc) ? -1 : 0;
+}
+
+static int lz4_step(struct unpack_t *u, uint8_t *out, size_t *outlen)
+{
+	size_t insize = u->insize - u->inpos, rc;
+
+	rc = FN(u, 1, size_t, void *, void *, size_t *, const void *,
+		size_t *, const void *)(u->ctx, out, outlen,
+					&u->in[u->inpos], &insize, NULL);
+	u->inpos += insize;
+	if (FN(u, 2, unsigned int, size_t)(rc))
+		return -1;
+	if (rc == 0 && u->inpos == u->insize)
+		return 1;
+
+	return 0;
+}
+
+static void lz4_end(struct unpack_t *u)
+{
+	FN(u, 3, size_t, void *)(u->ctx);
+}
+
+#ifdef __linux__
+# define LIBNAME(so, dll)	so
+#else
+# define LIBNAME(so, dll)	dll
+#endif
+
+static const char *const gz_symbols[] = {
+	"inflateInit2_", "inflate", "inflateReset", "inflateEnd", NULL
+};
+
+static const char *const xz_symbols[] = {
+	"lzma_stream_decoder", "lzma_code", "lzma_end", NULL
+};
+
+static const char *const zstd_symbols[] = {
+	"ZSTD_createDStream", "ZSTD_decompressStream", "ZSTD_isError",
+	"ZSTD_freeDStream", NULL
+};
+
+static const char *const lz4_symbols[] = {
+	"LZ4F_createDecompressionContext", "LZ4F_decompress",
+	"LZ4F_isError", "LZ4F_freeDecompressionContext", NULL
+};
+
+static const struct codec_t codecs[] = {
+	{ "gzip", (const uint8_t *)"\x1f\x8b", 2,
+	  LIBNAME("libz.so.1", "zlib1.dll"), gz_symbols,
+	  gz_init, gz_step, gz_end },
+	{ "zstd", (const uint8_t *)"\x28\xb5\x2f\xfd", 4,
+	  LIBNAME("libzstd.so.1", "libzstd.dll"), zstd_symbols,
+	  zstd_init, zstd_step, zstd_end },
+	{ "xz", (const uint8_t *)"\xfd\x37\x7a\x58\x5a\x00", 6,
+	  LIBNAME("liblzma.so.5", "liblzma.dll"), xz_symbols,
+	  xz_init, xz_step, xz_end },
+	{ "lz4", (const uint8_t *)"\x04\x22\x4d\x18", 4,
+	  LIBNAME("liblz4.so.1", "liblz4.dll"), lz4_symbols,
+	  lz4_init, lz4_step, lz4_end },
+};
+
+static const struct codec_t *codec_find(const void *src, size_t size)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+		if (size >= codecs[i].magiclen &&
+		    memcmp(src, codecs[i].magic, codecs[i].magiclen) == 0)
+			return &codecs[i];
+	}
+
+	return NULL;
+}
+
+const char *unpack_detect(const void *src, size_t size)
+{
+	const struct codec_t *c = codec_find(src, size);
+
+	return c != NULL ? c->name : NULL;
+}
+
+static void unpack_free(struct unpack_t *u)
+{
+	if (u->lib != NULL) {
+#ifdef __linux__
+		dlclose(u->lib);
+#else
+		FreeLibrary(u->lib);
+#endif
+	}
+	free(u);
+}
+
+void unpack_destroy(struct unpack_t *u)
+{
+	if (u == NULL)
+		return;
+
+	u->codec->end(u);
+	unpack_free(u);
+}
+
+struct unpack_t *unpack_create(const void *src, size_t size)
+{
+	const struct codec_t *c = codec_find(src, size);
+	struct unpack_t *u;
+	unsigned int i;
+
+	if (c == NULL) {
+		fprintf(stderr, "%s: unknown compression!\n", __func__);
+		return NULL;
+	}
+	u = calloc(1, sizeof(*u));
+	if (u == NULL) {
+		fprintf(stderr, "%s: no mem for %s decoder!\n",
+			__func__, c->name);
+		return NULL;
+	}
+	u->codec = c;
+	u->in = src;
+	u->insize = size;
+
+	do {
+#ifdef __linux__
+		u->lib = dlopen(c->libname, RTLD_LAZY);
+#else
+		u->lib = LoadLibrary(c->libname);
+#endif
+		if (u->lib == NULL) {
+			fprintf(stderr, "%s: %s image needs %s!\n",
+				__func__, c->name, c->libname);
+			break;
+		}
+		for (i = 0; c->symbols[i] != NULL; i++) {
+#ifdef __linux__
+			u->fn[i] = dlsym(u->lib, c->symbols[i]);
+#else
+			u->fn[i] = GetProcAddress(u->lib, c->symbols[i]);
+#endif
+			if (u->fn[i] == NULL) {
+				fprintf(stderr,
+					"%s: error get symbol '%s' from %s!\n",
+					__func__, c->symbols[i], c->libname);
+				break;
+			}
+		}
+		if (c->symbols[i] != NULL)
+			break;
+		if (c->init(u) != 0) {
+			fprintf(stderr, "%s: cannot init %s decoder!\n",
+				__func__, c->name);
+			break;
+		}
+
+		return u;
+	} while (0);
+
+	unpack_free(u);
+
+	return NULL;
+}
+
+long unpack_read(struct unpack_t *u, void *dst, size_t size)
+{
+	size_t pos = 0, inpos, n;
+	int rc;
+
+	while (pos < size && u->done == false) {
+		n = size - pos;
+		inpos = u->inpos;
+		rc = u->codec->step(u, (uint8_t *)dst + pos, &n);
+		/* no progress at all: the input ends within a frame */
+		if (rc == 0 && n == 0 && inpos == u->inpos)
+			rc = -1;
+		if (rc < 0) {
+			fprintf(stderr, "%s: %s data corrupt @ 0x%zx!\n",
+				__func__, u->codec->name, u->inpos);
+			return -1;
+		}
+		pos += n;
+		if (rc == 1)
+			u->done = true;
+	}
+
+	return pos;
+}
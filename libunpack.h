@@ -0,0 +1,26 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * streaming decompression of gzip, zstd, xz and lz4 images
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#ifndef __LIBUNPACK_H__
+#define __LIBUNPACK_H__
+
+#include <stddef.h>
+
+struct unpack_t;
+
+/*
+ * The codec is picked by the magic of 'src' and its library is loaded at
+ * runtime like the FTDI one, so none of them is needed for building and
+ * only the one of a compressed image has to be installed.
+ */
+const char *unpack_detect(const void *src, size_t size);
+struct unpack_t *unpack_create(const void *src, size_t size);
+/* fills 'dst' up to 'size', less only at the end, 0 at end, -1 on error */
+long unpack_read(struct unpack_t *u, void *dst, size_t size);
+void unpack_destroy(struct unpack_t *u);
+
+#endif /* __LIBUNPACK_H__ */
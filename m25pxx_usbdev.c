@@ -47,7 +47,6 @@ struct m25pxxflash_t DLLEXPORT *m25pxx_usbdev_create(char *devname)
 	/* FTDI stuff */
 	struct ftdi_funcptr_t *ftdifunc = NULL;
 	DWORD numdevs;
-	FT_STATUS rc;
 	FT_DEVICE_LIST_INFO_NODE *devinfo_base, *devinfo;
 
 	/* SPI hardware */
@@ -64,19 +63,15 @@ struct m25pxxflash_t DLLEXPORT *m25pxx_usbdev_create(char *devname)
 		return NULL;
 	}
 
-	/* check for available FTDI devices */
-	rc = ftdifunc->createdevlist(&numdevs);
-	if (rc != FT_OK) {
-		fprintf(stderr, "cannot create ftdi devlist!\n");
-		goto out;
-	}
+	/*
+	 * check for available FTDI devices, the cached list may be older
+	 * than a replug while another handle is open
+	 */
+	devinfo_base = ftdi_devlist(ftdifunc, &numdevs, true);
 	if (numdevs == 0) {
 		fprintf(stderr, "no FTDI devices available!\n");
 		goto out;
 	}
-
-	devinfo_base = calloc(numdevs, sizeof(*devinfo));
-	ftdifunc->get_devinfo(devinfo_base, &numdevs);
 	devinfo = devinfo_base;
 
 	for (i = 0; i < numdevs; i++) {
@@ -86,7 +81,6 @@ struct m25pxxflash_t DLLEXPORT *m25pxx_usbdev_create(char *devname)
 		}
 		devinfo++;
 	}
-	free(devinfo_base);
 
 	if (devidx == -1) {
 		STDERR(
@@ -98,7 +92,8 @@ struct m25pxxflash_t DLLEXPORT *m25pxx_usbdev_create(char *devname)
 	/* create the spi interface */
 	if (strcmp(devname, "USB-Blaster") == 0) {
 		spihw = altusb_create(devidx);
-	} else if (strcmp(devname, "Quad RS232-HS A") == 0) {
+	} else if (strcmp(devname, "Quad RS232-HS A") == 0 ||
+		   strcmp(devname, "Quad RS232-HS B") == 0) {
 		spihw = hpmusb_create(devidx);
 	} else {
 		STDERR("invalid devicename '%s' !\n", devname);
@@ -115,6 +110,9 @@ struct m25pxxflash_t DLLEXPORT *m25pxx_usbdev_create(char *devname)
 		fprintf(stderr, "cannot create M25Pxx flash instance!\n");
 		goto out;
 	}
+	/* the backend holds its own reference to the library */
+	ftdi_destroy(ftdifunc);
+
 	return flash;
 out:
 	if (flash != NULL)
@@ -125,7 +123,7 @@ out:
 
 		if (strcmp(devname, "USB-Blaster") == 0)
 			altusb_destroy(spihw);
-		else if (strcmp(devname, "Quad RS232-HS A") == 0)
+		else
 			hpmusb_destroy(spihw);
 	}
 
@@ -5,17 +5,30 @@
  * Copyright (C) 2019 Hannes Schmelzer <oe5hpm@oevsv.at>
  *
  */
+#ifndef __OSI_H__
+#define __OSI_H__
+
 #ifndef __MINGW32__
 # include <unistd.h>
+# include <fcntl.h>
 # include <sys/time.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <pthread.h>
+# include <sched.h>
 #else
 # include <windows.h>
+# include <io.h>
 #endif /* __MINGW32__ */
+#include <stdio.h>
+#include "libtrace.h"
 
 #ifdef __linux__
 static __inline__ void _usleep(unsigned int us)
 {
+	TRACE_BEGIN_ARG("usleep", us);
 	usleep(us);
+	TRACE_END("usleep");
 }
 
 static __inline__ uint64_t GetTimeStamp(void)
@@ -25,6 +38,111 @@ static __inline__ uint64_t GetTimeStamp(void)
 	gettimeofday(&tv, NULL);
 	return tv.tv_sec * (uint64_t)1000000 + tv.tv_usec;
 }
+
+typedef pthread_t osi_thread_t;
+
+static __inline__ int osi_thread_create(osi_thread_t *thread,
+					void *(*fct)(void *), void *arg)
+{
+	return pthread_create(thread, NULL, fct, arg) == 0 ? 0 : -1;
+}
+
+static __inline__ void osi_thread_join(osi_thread_t thread)
+{
+	pthread_join(thread, NULL);
+}
+
+static __inline__ void osi_yield(void)
+{
+	sched_yield();
+}
+
+typedef pthread_mutex_t osi_mutex_t;
+
+static __inline__ void osi_mutex_init(osi_mutex_t *mtx)
+{
+	pthread_mutex_init(mtx, NULL);
+}
+
+static __inline__ void osi_mutex_destroy(osi_mutex_t *mtx)
+{
+	pthread_mutex_destroy(mtx);
+}
+
+static __inline__ void osi_mutex_lock(osi_mutex_t *mtx)
+{
+	pthread_mutex_lock(mtx);
+}
+
+static __inline__ void osi_mutex_unlock(osi_mutex_t *mtx)
+{
+	pthread_mutex_unlock(mtx);
+}
+
+typedef pthread_cond_t osi_cond_t;
+
+static __inline__ void osi_cond_init(osi_cond_t *cond)
+{
+	pthread_cond_init(cond, NULL);
+}
+
+static __inline__ void osi_cond_destroy(osi_cond_t *cond)
+{
+	pthread_cond_destroy(cond);
+}
+
+static __inline__ void osi_cond_wait(osi_cond_t *cond, osi_mutex_t *mtx)
+{
+	pthread_cond_wait(cond, mtx);
+}
+
+static __inline__ void osi_cond_broadcast(osi_cond_t *cond)
+{
+	pthread_cond_broadcast(cond);
+}
+
+/* map a whole file read-only, NULL on error or empty file */
+static __inline__ void *osi_mapfile(const char *filename, size_t *size)
+{
+	struct stat st;
+	void *p;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return NULL;
+	*size = st.st_size;
+
+	return p;
+}
+
+static __inline__ void osi_unmapfile(void *p, size_t size)
+{
+	munmap(p, size);
+}
+
+/* flush 'f' down to the disk */
+static __inline__ int osi_fsync(FILE *f)
+{
+	if (fflush(f) != 0)
+		return -1;
+
+	return fsync(fileno(f));
+}
+
+/* replace 'to' by 'from' in one step */
+static __inline__ int osi_rename(const char *from, const char *to)
+{
+	return rename(from, to);
+}
 #else
 static __inline__ uint64_t GetTimeStamp(void)
 {
@@ -36,12 +154,131 @@ static __inline__ uint64_t GetTimeStamp(void)
 	return t1 / (freq / 1000000);
 }
 
+typedef HANDLE osi_thread_t;
+
+/* only built for x64, where WINAPI and cdecl are the same convention */
+static __inline__ int osi_thread_create(osi_thread_t *thread,
+					void *(*fct)(void *), void *arg)
+{
+	*thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)fct,
+			       arg, 0, NULL);
+
+	return *thread != NULL ? 0 : -1;
+}
+
+static __inline__ void osi_thread_join(osi_thread_t thread)
+{
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+static __inline__ void osi_yield(void)
+{
+	SwitchToThread();
+}
+
+typedef CRITICAL_SECTION osi_mutex_t;
+
+static __inline__ void osi_mutex_init(osi_mutex_t *mtx)
+{
+	InitializeCriticalSection(mtx);
+}
+
+static __inline__ void osi_mutex_destroy(osi_mutex_t *mtx)
+{
+	DeleteCriticalSection(mtx);
+}
+
+static __inline__ void osi_mutex_lock(osi_mutex_t *mtx)
+{
+	EnterCriticalSection(mtx);
+}
+
+static __inline__ void osi_mutex_unlock(osi_mutex_t *mtx)
+{
+	LeaveCriticalSection(mtx);
+}
+
+typedef CONDITION_VARIABLE osi_cond_t;
+
+static __inline__ void osi_cond_init(osi_cond_t *cond)
+{
+	InitializeConditionVariable(cond);
+}
+
+static __inline__ void osi_cond_destroy(osi_cond_t *cond)
+{
+}
+
+static __inline__ void osi_cond_wait(osi_cond_t *cond, osi_mutex_t *mtx)
+{
+	SleepConditionVariableCS(cond, mtx, INFINITE);
+}
+
+static __inline__ void osi_cond_broadcast(osi_cond_t *cond)
+{
+	WakeAllConditionVariable(cond);
+}
+
+/* map a whole file read-only, NULL on error or empty file */
+static __inline__ void *osi_mapfile(const char *filename, size_t *size)
+{
+	HANDLE f, m;
+	LARGE_INTEGER fsize;
+	void *p = NULL;
+
+	f = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (f == INVALID_HANDLE_VALUE)
+		return NULL;
+	if (GetFileSizeEx(f, &fsize) && fsize.QuadPart != 0) {
+		m = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m != NULL) {
+			p = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(m);
+		}
+	}
+	CloseHandle(f);
+	if (p != NULL)
+		*size = fsize.QuadPart;
+
+	return p;
+}
+
+static __inline__ void osi_unmapfile(void *p, size_t size)
+{
+	UnmapViewOfFile(p);
+}
+
+/* flush 'f' down to the disk */
+static __inline__ int osi_fsync(FILE *f)
+{
+	if (fflush(f) != 0)
+		return -1;
+
+	return _commit(_fileno(f));
+}
+
+/* replace 'to' by 'from' in one step */
+static __inline__ int osi_rename(const char *from, const char *to)
+{
+	if (!MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING |
+			 MOVEFILE_WRITE_THROUGH))
+		return -1;
+
+	return 0;
+}
+
 static __inline__ void _usleep(unsigned int us)
 {
 	__int64 t1, t2, freq, cmp;
 
-	if (us >= 1000)
-		return Sleep(us / 1000);
+	TRACE_BEGIN_ARG("usleep", us);
+	if (us >= 1000) {
+		Sleep(us / 1000);
+		TRACE_END("usleep");
+		return;
+	}
 
 	QueryPerformanceCounter((LARGE_INTEGER *) &t1);
 	QueryPerformanceFrequency((LARGE_INTEGER *)&freq);
@@ -50,5 +287,8 @@ static __inline__ void _usleep(unsigned int us)
 	do {
 		QueryPerformanceCounter((LARGE_INTEGER *)&t2);
 	} while ((t2 - t1) < cmp);
+	TRACE_END("usleep");
 }
 #endif /* __linux__ */
+
+#endif /* __OSI_H__ */
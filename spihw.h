@@ -10,25 +10,170 @@
 
 #include <ftd2xx.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* USB transport parameters, profile per adapter/host see ftdi_tune_load() */
+struct spitune_t {
+	unsigned int	latency;	/* FTDI latency timer [ms] */
+	unsigned int	usbsize;	/* USB in/out transfer size */
+	unsigned int	chunk;		/* max. shift payload per USB write */
+};
+
+/*
+ * a failed USB transaction makes the backend resync to the adapter and
+ * repeat the whole shift, up to SPIHW_RETRIES times
+ */
+#define SPIHW_RETRIES		3
+
+/* in place shifts up to this size are saved on the stack for a retry */
+#define SPIHW_SAVESIZE		16
+
+struct spistat_t {
+	unsigned long	errors;		/* failed USB transactions */
+	unsigned long	resyncs;	/* successful resynchronisations */
+	unsigned long	retries;	/* shifts repeated after a resync */
+	unsigned long	fatal;		/* shifts given up */
+};
 
 struct spihw_t {
 	FT_HANDLE		fthandle;
 	struct ftdi_funcptr_t	*ftdifunc;
 	unsigned int		speed;
 	unsigned int		mode;
+	struct spitune_t	tune;
+	struct spistat_t	stat;
 	void			*priv;
 	struct spiops_t		*ops;
 };
 
+/*
+ * one chipselect framed shift within a batch. 'data' is shifted out right
+ * after 'out' in the same frame, the backend encodes it straight from the
+ * caller's (mapped) memory, so a page program needs no assembled copy of
+ * command and payload. Write-only shifts (in == NULL) only.
+ */
+struct spixfer_t {
+	unsigned int	cs;
+	uint8_t		*out;
+	uint8_t		*in;		/* NULL: write-only */
+	size_t		size;
+	const uint8_t	*data;
+	size_t		datasize;
+};
+
+/*
+ * one piece of a vectored shift, all segments of a list make up a single
+ * chipselect frame. out == NULL is "don't care" (the backend clocks
+ * whatever is cheapest), in == NULL discards what comes back. The
+ * backends encode from and scatter into the segments directly.
+ */
+struct spiseg_t {
+	const uint8_t	*out;		/* NULL: don't care */
+	uint8_t		*in;		/* NULL: discard */
+	size_t		size;
+};
+
+/*
+ * commands that only run with the write enable latch set: WRSR, PP and
+ * the erases. A failed shift may have run or not, either way the latch is
+ * gone, so the backends resync but don't repeat these on their own. The
+ * flash layer sends WREN and the command again once the chip is idle.
+ */
+static inline bool spihw_wrgated(const uint8_t *out, size_t size)
+{
+	if (out == NULL || size == 0)
+		return false;
+
+	switch (out[0]) {
+	case 0x01:	/* WRSR */
+	case 0x02:	/* PP */
+	case 0x20:	/* subsector erase */
+	case 0x52:	/* 32k block erase */
+	case 0x60:	/* chip erase */
+	case 0xC7:	/* bulk erase */
+	case 0xD8:	/* sector erase */
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * spihw_trxv_retry - shift with resync and retry, common to the backends
+ *
+ * 'once' does a single try, 'resync' gets the adapter back in step after
+ * a failed one. A single segment shifted in place (in overlapping out)
+ * destroys the data to send, so it is saved up front - short ones such
+ * as status polls on the stack. Segments of a list must not overlap,
+ * they are encoded again on a retry.
+ */
+static inline int spihw_trxv_retry(struct spihw_t *spi, unsigned int cs,
+				   const struct spiseg_t *seg,
+				   unsigned int nseg,
+				   int (*once)(struct spihw_t *spi,
+					       unsigned int cs,
+					       const struct spiseg_t *seg,
+					       unsigned int nseg),
+				   int (*resync)(struct spihw_t *spi))
+{
+	bool gated = nseg != 0 && spihw_wrgated(seg[0].out, seg[0].size);
+	bool inplace = nseg == 1 && seg->out != NULL && seg->in != NULL &&
+		       seg->in < seg->out + seg->size &&
+		       seg->out < seg->in + seg->size;
+	uint8_t buf[SPIHW_SAVESIZE], *save = NULL;
+	unsigned int retry;
+	int rc;
+
+	if (inplace) {
+		save = seg->size <= sizeof(buf) ? buf : malloc(seg->size);
+		if (save != NULL)
+			memcpy(save, seg->out, seg->size);
+	}
+
+	for (retry = 0; ; retry++) {
+		rc = once(spi, cs, seg, nseg);
+		if (rc == 0)
+			break;
+		spi->stat.errors++;
+		if (retry == SPIHW_RETRIES || (inplace && save == NULL) ||
+		    resync(spi) != 0) {
+			spi->stat.fatal++;
+			break;
+		}
+		if (gated)
+			break;
+		spi->stat.retries++;
+		/* 'out' is the caller's buffer that 'in' overlaps */
+		if (save != NULL)
+			memcpy((uint8_t *)seg->out, save, seg->size);
+	}
+	if (save != buf)
+		free(save);
+
+	return rc;
+}
+
 struct spiops_t {
 	int (*claim)(struct spihw_t *spi);
 	int (*release)(struct spihw_t *spi);
+	/* in == NULL: write-only shift, nothing is read back */
 	int (*trx)(struct spihw_t *spi, unsigned int cs,
 		   uint8_t *out, uint8_t *in, size_t size);
+	/* 'nseg' segments shifted in order within one chipselect frame */
+	int (*trxv)(struct spihw_t *spi, unsigned int cs,
+		    const struct spiseg_t *seg, unsigned int nseg);
+	/* executes 'cnt' shifts in order, batched into few USB transfers */
+	int (*trx_batch)(struct spihw_t *spi,
+			 struct spixfer_t *xfer, unsigned int cnt);
 	int (*set_speed_mode)(struct spihw_t *spi,
 			      unsigned int speed, int mode);
 	int (*set_clr_tms)(struct spihw_t *spi, bool set_nclear);
 	int (*set_clr_nce)(struct spihw_t *spi, bool set_nclear);
+	/* chunk is clamped to what the adapter can take */
+	int (*set_tune)(struct spihw_t *spi, const struct spitune_t *tune);
 };
 
 #endif /* __SPIHW_H__ */
@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * lock-free single producer / single consumer queue
+ *
+ * Copyright (C) 2026 Hannes Schmelzer <oe5hpm@oevsv.at>
+ *
+ */
+#ifndef __SPSC_H__
+#define __SPSC_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "osi.h"
+
+#define SPSC_SPIN		1000	/* busy polls before yielding */
+#define SPSC_YIELD		8	/* yields before blocking */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define spsc_relax()		__builtin_ia32_pause()
+#else
+#define spsc_relax()		do { } while (0)
+#endif
+
+struct spsc_t {
+	unsigned int	head __attribute__((aligned(64)));	/* producer */
+	unsigned int	tail __attribute__((aligned(64)));	/* consumer */
+	unsigned int	mask;
+	void		**slot;
+	/* an idle side blocks here, the other one wakes it if it sleeps */
+	unsigned int	sleepers;
+	osi_mutex_t	lock;
+	osi_cond_t	cond;
+};
+
+/* 'size' has to be a power of 2 */
+static __inline__ int spsc_init(struct spsc_t *q, unsigned int size)
+{
+	q->slot = calloc(size, sizeof(void *));
+	if (q->slot == NULL)
+		return -1;
+	q->head = 0;
+	q->tail = 0;
+	q->mask = size - 1;
+	q->sleepers = 0;
+	osi_mutex_init(&q->lock);
+	osi_cond_init(&q->cond);
+
+	return 0;
+}
+
+static __inline__ void spsc_free(struct spsc_t *q)
+{
+	if (q->slot == NULL)
+		return;
+	osi_cond_destroy(&q->cond);
+	osi_mutex_destroy(&q->lock);
+	free(q->slot);
+	q->slot = NULL;
+}
+
+/*
+ * pairs with the sleeper count taken in spsc_block(): either the sleeper
+ * sees the new head/tail, or we see the sleeper and wake it under the lock
+ */
+static __inline__ void spsc_wake(struct spsc_t *q)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&q->sleepers, __ATOMIC_RELAXED) == 0)
+		return;
+	osi_mutex_lock(&q->lock);
+	osi_cond_broadcast(&q->cond);
+	osi_mutex_unlock(&q->lock);
+}
+
+static __inline__ bool __spsc_push(struct spsc_t *q, void *p)
+{
+	unsigned int head = q->head;
+
+	if (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) > q->mask)
+		return false;
+	q->slot[head & q->mask] = p;
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static __inline__ void *__spsc_pop(struct spsc_t *q)
+{
+	unsigned int tail = q->tail;
+	void *p;
+
+	if (__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == tail)
+		return NULL;
+	p = q->slot[tail & q->mask];
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return p;
+}
+
+static __inline__ bool spsc_push(struct spsc_t *q, void *p)
+{
+	if (!__spsc_push(q, p))
+		return false;
+	spsc_wake(q);
+
+	return true;
+}
+
+static __inline__ void *spsc_pop(struct spsc_t *q)
+{
+	void *p = __spsc_pop(q);
+
+	if (p != NULL)
+		spsc_wake(q);
+
+	return p;
+}
+
+/* blocks until 'p' is pushed or, with p == NULL, something is popped */
+static __inline__ void *spsc_block(struct spsc_t *q, void *p)
+{
+	void *ret = NULL;
+
+	osi_mutex_lock(&q->lock);
+	__atomic_fetch_add(&q->sleepers, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for (;;) {
+		if (p != NULL && __spsc_push(q, p))
+			break;
+		if (p == NULL && (ret = __spsc_pop(q)) != NULL)
+			break;
+		osi_cond_wait(&q->cond, &q->lock);
+	}
+	/* the other side may have gone to sleep meanwhile */
+	if (__atomic_sub_fetch(&q->sleepers, 1, __ATOMIC_SEQ_CST) != 0)
+		osi_cond_broadcast(&q->cond);
+	osi_mutex_unlock(&q->lock);
+
+	return ret;
+}
+
+/*
+ * spin, then yield - the other side usually just waits for USB. An idle
+ * pipeline (adapter open, nothing to do) ends up blocked on the condvar
+ * and costs no wakeups at all.
+ */
+static __inline__ bool spsc_backoff(unsigned int *spin)
+{
+	if (*spin < SPSC_SPIN) {
+		(*spin)++;
+		spsc_relax();
+		return false;
+	}
+	if (*spin < SPSC_SPIN + SPSC_YIELD) {
+		(*spin)++;
+		osi_yield();
+		return false;
+	}
+
+	return true;
+}
+
+static __inline__ void spsc_push_wait(struct spsc_t *q, void *p)
+{
+	unsigned int spin = 0;
+
+	while (!spsc_push(q, p)) {
+		if (spsc_backoff(&spin)) {
+			spsc_block(q, p);
+			return;
+		}
+	}
+}
+
+static __inline__ void *spsc_pop_wait(struct spsc_t *q)
+{
+	unsigned int spin = 0;
+	void *p;
+
+	while ((p = spsc_pop(q)) == NULL) {
+		if (spsc_backoff(&spin))
+			return spsc_block(q, NULL);
+	}
+
+	return p;
+}
+
+#endif /* __SPSC_H__ */